@@ -0,0 +1,166 @@
+/*
+ * A simple region (bump) allocator.  See arena.h.
+ *
+ * The arena header and its first chunk share one malloc'd block,
+ * so a typical command line is parsed with a single allocation.
+ * Further chunks double in size; requests that do not fit in a
+ * regular chunk get a chunk of their own.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdalign.h>
+
+#include "arena.h"
+#include "esh-sys-utils.h"
+
+#define ARENA_FIRST_CHUNK   2048
+
+/* A chunk of memory.  Objects are allocated from 'data'. */
+struct arena_chunk {
+    struct arena_chunk *next;   /* Previously filled chunk */
+    size_t size;                /* Usable bytes in 'data' */
+    alignas(max_align_t) char data[];
+};
+
+struct arena {
+    struct arena_chunk *chunks; /* Current chunk, heads the chain */
+    char *next;                 /* Next free byte in current chunk */
+    char *end;                  /* End of current chunk */
+    size_t nchunks;             /* Number of chunks in the chain */
+    size_t allocated;           /* Bytes handed out, see arena_allocated() */
+    struct arena_chunk first;   /* Must be last */
+};
+
+#define ARENA_ALIGN  (alignof(max_align_t))
+
+static size_t
+round_up(size_t size)
+{
+    return (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+}
+
+/* Create an empty arena with a first chunk of 'size' bytes */
+struct arena *
+arena_create_sized(size_t size)
+{
+    size = round_up(size);
+    struct arena *arena = malloc(sizeof *arena + size);
+    if (arena == NULL)
+        esh_sys_fatal_error("arena_create: ");
+
+    arena->first.next = NULL;
+    arena->first.size = size;
+    arena->chunks = &arena->first;
+    arena->next = arena->first.data;
+    arena->end = arena->first.data + size;
+    arena->nchunks = 1;
+    arena->allocated = 0;
+    return arena;
+}
+
+/* Create an empty arena */
+struct arena *
+arena_create(void)
+{
+    return arena_create_sized(ARENA_FIRST_CHUNK);
+}
+
+/* Bytes an allocation of 'size' bytes takes up */
+size_t
+arena_alloc_size(size_t size)
+{
+    return round_up(size);
+}
+
+/* Allocate 'size' bytes */
+void *
+arena_alloc(struct arena *arena, size_t size)
+{
+    size = round_up(size);
+
+    if (size > (size_t) (arena->end - arena->next)) {
+        size_t chunk_size = arena->chunks->size * 2;
+        if (chunk_size < size)
+            chunk_size = round_up(size);
+
+        struct arena_chunk *chunk = malloc(sizeof *chunk + chunk_size);
+        if (chunk == NULL)
+            esh_sys_fatal_error("arena_alloc: ");
+
+        chunk->size = chunk_size;
+        chunk->next = arena->chunks;
+        arena->chunks = chunk;
+        arena->next = chunk->data;
+        arena->end = chunk->data + chunk_size;
+        arena->nchunks++;
+    }
+
+    void *p = arena->next;
+    arena->next += size;
+    arena->allocated += size;
+    return p;
+}
+
+/* Copy the first 'len' bytes of 's' into the arena */
+char *
+arena_strndup(struct arena *arena, const char *s, size_t len)
+{
+    char *p = arena_alloc(arena, len + 1);
+    memcpy(p, s, len);
+    p[len] = '\0';
+    return p;
+}
+
+/* Copy 's' into the arena */
+char *
+arena_strdup(struct arena *arena, const char *s)
+{
+    return arena_strndup(arena, s, strlen(s));
+}
+
+/* Copy a single-chunk 'arena' */
+struct arena *
+arena_copy(struct arena *arena)
+{
+    if (arena->nchunks != 1)
+        return NULL;
+
+    struct arena *copy = malloc(sizeof *arena + arena->first.size);
+    if (copy == NULL)
+        esh_sys_fatal_error("arena_copy: ");
+
+    // The header and the used part of the chunk, which follows it
+    memcpy(copy, arena, arena->next - (char *) arena);
+    copy->chunks = &copy->first;
+    copy->next = copy->first.data + (arena->next - arena->first.data);
+    copy->end = copy->first.data + copy->first.size;
+    return copy;
+}
+
+/* Bytes allocated from 'arena' so far */
+size_t
+arena_allocated(struct arena *arena)
+{
+    return arena->allocated;
+}
+
+/* Number of chunks obtained from malloc so far */
+size_t
+arena_chunk_count(struct arena *arena)
+{
+    return arena->nchunks;
+}
+
+/* Release the arena and everything allocated from it */
+void
+arena_destroy(struct arena *arena)
+{
+    struct arena_chunk *chunk = arena->chunks;
+    while (chunk != &arena->first) {
+        struct arena_chunk *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    free(arena);
+}
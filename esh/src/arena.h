@@ -0,0 +1,52 @@
+#ifndef __ARENA_H
+#define __ARENA_H
+/*
+ * A simple region (bump) allocator.
+ *
+ * Objects are carved out of large chunks and are never freed
+ * individually; arena_destroy() releases everything at once.
+ * esh uses one arena per parsed command line, so that a parse
+ * error or a finished command line costs a single release, and
+ * one arena per job, so that a job's data can outlive the command
+ * line it was typed on.
+ */
+#include <stddef.h>
+
+struct arena;
+
+/* Create an empty arena */
+struct arena * arena_create(void);
+
+/* Create an empty arena whose first chunk holds 'size' bytes.
+ * Use arena_alloc_size() to add up the space objects will take. */
+struct arena * arena_create_sized(size_t size);
+
+/* Bytes an allocation of 'size' bytes takes up in an arena */
+size_t arena_alloc_size(size_t size);
+
+/* Allocate 'size' bytes, suitably aligned for any object */
+void * arena_alloc(struct arena *arena, size_t size);
+
+/* Copy a string, or the first 'len' bytes of a string, into the arena */
+char * arena_strdup(struct arena *arena, const char *s);
+char * arena_strndup(struct arena *arena, const char *s, size_t len);
+
+/* Copy 'arena', which must have a single chunk, with one allocation
+ * and one memcpy.  Every object is at the same offset from the copy
+ * as from 'arena'; pointers between objects still point into 'arena'
+ * and are for the caller to adjust.  Returns NULL if 'arena' has more
+ * than one chunk. */
+struct arena * arena_copy(struct arena *arena);
+
+/* Bytes allocated from 'arena' so far, rounded as by
+ * arena_alloc_size().  The same allocations fit in one chunk of an
+ * arena created with arena_create_sized() of this size. */
+size_t arena_allocated(struct arena *arena);
+
+/* Number of chunks obtained from malloc so far */
+size_t arena_chunk_count(struct arena *arena);
+
+/* Release the arena and everything allocated from it */
+void arena_destroy(struct arena *arena);
+
+#endif //__ARENA_H
@@ -0,0 +1,960 @@
+/*
+ * esh-bench.c
+ * Microbenchmarks for libesh.  Built and run by 'make bench'.
+ *
+ * Each benchmark measures one operation in isolation, for one or more
+ * values of a parameter (a list size, a number of stages, ...):
+ *
+ *      parse           esh_parse_command_line and esh_command_line_free
+ *                      of one line of the corpus
+ *      parse_cached    the same through the parse cache, all hits
+ *      scan            tokenizing a line of 'param' bytes made of lines
+ *                      of the corpus, to its end
+ *      scan_flex       the same with the flex scanner esh-scanner.c
+ *                      replaced, which strdup's every word
+ *      list_size       list_size of a list of 'param' elements
+ *      list_sort       list_sort of a shuffled list of 'param' elements
+ *      list_remove     list_remove of one element, in random order,
+ *                      from a list of 'param' elements
+ *      cmdline         creating and freeing a command line of 'param'
+ *                      stages, the way the parser builds one
+ *      cmdline_copy    esh_pipeline_copy and esh_pipeline_free of a
+ *                      pipeline of 'param' stages, as for every job
+ *      dispatch_builtin    dispatching a registered builtin, with
+ *                      'param' further names registered
+ *      dispatch_plugin dispatching a command handled by the last of
+ *                      'param' plugins implementing process_builtin
+ *      dispatch_miss   dispatching a command nobody handles, past
+ *                      'param' such plugins
+ *      pipeline_fork   running /bin/true | ... of 'param' stages in
+ *      pipeline_spawn  the foreground, with fork() or posix_spawn(),
+ *                      until the job is reaped
+ *      filter          copying a file of 'param' bytes to /dev/null with
+ *                      an in-process filter stage, until it is reaped
+ *      filter_exec     the same with /bin/cat, the filter as a binary
+ *      history_search  finding, in a history of 'param' lines of the
+ *                      corpus, the text only the oldest one has
+ *      complete        completing the first 'param' letters of "grep"
+ *                      against PATH and the builtins, as Tab does
+ *      script          the esh binary running a script of 'param'
+ *                      lines of 'jobs', which prints nothing, from
+ *                      fork until it exits
+ *      startup         the esh binary running 'esh -c /bin/true', from
+ *                      fork until it exits; bench/eshlatency.py times
+ *                      an interactive start
+ *
+ * The number of operations per round is raised until a round takes
+ * the target time; then the rounds are timed.  Output is one line per
+ * benchmark and parameter, tab-separated, after a '#' header:
+ *
+ *      benchmark param ops rounds median_ns min_ns max_ns
+ *
+ * where the times are per operation.  The median is the figure to
+ * compare between releases.
+ *
+ * usage: esh-bench [-r rounds] [-t ms] [-f corpus] [-s shell] [benchmark...]
+ * Naming benchmarks, or prefixes of them ('list', 'pipeline'), runs
+ * only those.  A corpus file has one command line per line.  The
+ * benchmarks of the binary run ./esh, or 'shell', in an empty
+ * directory, so that no plugins are loaded.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+
+#include "arena.h"
+#include "esh.h"
+#include "esh-parse-cache.h"
+#include "esh-scanner.h"
+#include "esh-utils-builtin.h"
+#include "esh-utils-complete.h"
+#include "esh-utils-filter.h"
+#include "esh-utils-helper.h"
+#include "esh-utils-history.h"
+#include "esh-utils-plugin.h"
+#include "esh-utils-spawn.h"
+#include "flex-scanner.h"
+
+static int rounds = 7;
+static uint64_t target_ns = 20000000;       /* per round */
+
+static uint64_t
+now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* A small deterministic generator, so every run shuffles alike */
+static uint64_t rng_state = 88172645463325252ULL;
+
+static uint64_t
+rng(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+/* Sinks, so that the compiler keeps results nobody looks at */
+static volatile size_t sink;
+
+/* --- PARSING --- */
+
+/* Lines of the kind people type, and some they write in scripts */
+static const char *default_corpus[] = {
+    "ls",
+    "ls -l",
+    "cd /tmp",
+    "echo hello world",
+    "jobs",
+    "fg 1",
+    "sleep 10 &",
+    "cat file.txt | grep pattern | wc -l",
+    "ls -la /usr/bin | sort -k5 -n | tail -n 20 > biggest.txt",
+    "make -j4 | tee build.log",
+    "grep -rn 'struct esh_command' . | cut -d: -f1 | sort | uniq -c",
+    "sort < input.txt >> output.txt",
+    "ps aux | grep esh | grep -v grep | awk '{print $2}'",
+    "find . -name \"*.c\" | xargs wc -l | sort -n ; echo done",
+    "tar czf backup.tar.gz src docs README &",
+    "./configure --prefix=/usr/local ; make ; make install",
+    "kill -9 %2",
+    "gcc -Wall -Werror -g -o esh esh.c esh-utils.c list.c -lreadline",
+    "a | b | c | d | e | f | g | h",
+    "echo 'a quoted | not a pipe' \"and > not a redirect\"",
+};
+
+static char **corpus;
+static int ncorpus;
+
+/* Read the corpus from 'path', one command line per line */
+static bool
+load_corpus(const char *path)
+{
+    FILE *f = fopen(path, "r");
+    if (f == NULL)
+        return false;
+
+    char *line = NULL;
+    size_t size = 0;
+    ssize_t len;
+    int capacity = 0;
+    while ((len = getline(&line, &size, f)) > 0) {
+        if (line[len - 1] == '\n')
+            line[len - 1] = '\0';
+        if (ncorpus == capacity) {
+            capacity = capacity ? 2 * capacity : 64;
+            corpus = realloc(corpus, capacity * sizeof *corpus);
+        }
+        corpus[ncorpus++] = strdup(line);
+    }
+    free(line);
+    fclose(f);
+    return ncorpus > 0;
+}
+
+static void
+use_default_corpus(void)
+{
+    ncorpus = sizeof default_corpus / sizeof default_corpus[0];
+    corpus = malloc(ncorpus * sizeof *corpus);
+    int i;
+    for (i = 0; i < ncorpus; i++)
+        corpus[i] = strdup(default_corpus[i]);
+}
+
+static uint64_t
+run_parse(long param, long ops)
+{
+    long i;
+    uint64_t start = now_ns();
+    for (i = 0; i < ops; i++) {
+        struct esh_command_line *cmdline = esh_parse_command_line(corpus[i % ncorpus]);
+        if (cmdline)
+            esh_command_line_free(cmdline);
+    }
+    return now_ns() - start;
+}
+
+static uint64_t
+run_parse_cached(long param, long ops)
+{
+    long i;
+
+    // Fill the cache first, so that every timed lookup is a hit
+    esh_parse_cache_set_capacity(ncorpus);
+    for (i = 0; i < ncorpus; i++) {
+        struct esh_command_line *cmdline = esh_parse_command_line_cached(corpus[i]);
+        if (cmdline)
+            esh_command_line_free(cmdline);
+    }
+
+    uint64_t start = now_ns();
+    for (i = 0; i < ops; i++) {
+        struct esh_command_line *cmdline = esh_parse_command_line_cached(corpus[i % ncorpus]);
+        if (cmdline)
+            esh_command_line_free(cmdline);
+    }
+    return now_ns() - start;
+}
+
+/* A line of 'len' bytes: lines of the corpus joined with ';' */
+static char *
+long_line(long len)
+{
+    char *line = malloc(len + 1);
+    long n = 0;
+    int i = 0;
+    while (n < len) {
+        long k = strlen(corpus[i]);
+        if (k > len - n)
+            k = len - n;
+        memcpy(line + n, corpus[i], k);
+        n += k;
+        if (n < len)
+            line[n++] = ';';
+        i = (i + 1) % ncorpus;
+    }
+    line[len] = '\0';
+    return line;
+}
+
+static uint64_t
+run_scan(long param, long ops)
+{
+    char *line = long_line(param);
+
+    long i;
+    uint64_t start = now_ns();
+    for (i = 0; i < ops; i++) {
+        // Without terminating words in place, so the line can be scanned again
+        struct esh_scanner s;
+        struct esh_token tok;
+        esh_scanner_init(&s, line, param, false);
+        while (esh_scanner_next(&s, &tok) != ESH_TOKEN_EOF)
+            sink += tok.len;
+    }
+    uint64_t elapsed = now_ns() - start;
+
+    free(line);
+    return elapsed;
+}
+
+static uint64_t
+run_scan_flex(long param, long ops)
+{
+    char *line = long_line(param);
+
+    long i;
+    uint64_t start = now_ns();
+    for (i = 0; i < ops; i++)
+        sink += esh_flex_scan(line);
+    uint64_t elapsed = now_ns() - start;
+
+    free(line);
+    return elapsed;
+}
+
+/* --- LISTS --- */
+
+struct item {
+    struct list_elem elem;
+    int key;
+};
+
+static bool
+item_less(const struct list_elem *a, const struct list_elem *b, void *aux)
+{
+    return list_entry(a, struct item, elem)->key < list_entry(b, struct item, elem)->key;
+}
+
+/* Link 'n' items into 'list' in a random order, with random keys */
+static void
+shuffle_into(struct list *list, struct item *items, int n)
+{
+    int i;
+    for (i = n - 1; i > 0; i--) {
+        int j = rng() % (i + 1);
+        struct item t = items[i];
+        items[i] = items[j];
+        items[j] = t;
+    }
+    list_init(list);
+    for (i = 0; i < n; i++) {
+        items[i].key = rng();
+        list_push_back(list, &items[i].elem);
+    }
+}
+
+static uint64_t
+run_list_size(long param, long ops)
+{
+    struct item *items = calloc(param, sizeof *items);
+    struct list list;
+    shuffle_into(&list, items, param);
+
+    long i;
+    uint64_t start = now_ns();
+    for (i = 0; i < ops; i++)
+        sink += list_size(&list);
+    uint64_t elapsed = now_ns() - start;
+
+    free(items);
+    return elapsed;
+}
+
+static uint64_t
+run_list_sort(long param, long ops)
+{
+    struct item *items = calloc(param, sizeof *items);
+    struct list list;
+    uint64_t elapsed = 0;
+
+    long i;
+    for (i = 0; i < ops; i++) {
+        shuffle_into(&list, items, param);
+        uint64_t start = now_ns();
+        list_sort(&list, item_less, NULL);
+        elapsed += now_ns() - start;
+    }
+
+    free(items);
+    return elapsed;
+}
+
+static uint64_t
+run_list_remove(long param, long ops)
+{
+    struct item *items = calloc(param, sizeof *items);
+    struct item **order = calloc(param, sizeof *order);
+    struct list list;
+    uint64_t elapsed = 0;
+
+    long done = 0;
+    while (done < ops) {
+        // Link the items in one random order, remove them in another
+        shuffle_into(&list, items, param);
+        long i, n = ops - done < param ? ops - done : param;
+        for (i = 0; i < param; i++)
+            order[i] = &items[i];
+        for (i = param - 1; i > 0; i--) {
+            long j = rng() % (i + 1);
+            struct item *t = order[i];
+            order[i] = order[j];
+            order[j] = t;
+        }
+
+        uint64_t start = now_ns();
+        for (i = 0; i < n; i++)
+            list_remove(&order[i]->elem);
+        elapsed += now_ns() - start;
+        done += n;
+    }
+
+    free(order);
+    free(items);
+    return elapsed;
+}
+
+/* --- COMMAND LINES --- */
+
+static char *stage_argv[] = { "grep", "-v", "pattern", NULL };
+
+/* Build a command line of 'stages' commands as the parser does */
+static struct esh_command_line *
+build_cmdline(long stages)
+{
+    struct arena *arena = arena_create();
+    struct esh_pipeline *pipe = NULL;
+    long i;
+    for (i = 0; i < stages; i++) {
+        char **argv = arena_alloc(arena, sizeof stage_argv);
+        int j;
+        for (j = 0; stage_argv[j]; j++)
+            argv[j] = arena_strdup(arena, stage_argv[j]);
+        argv[j] = NULL;
+
+        struct esh_command *cmd = esh_command_create(arena, argv,
+                i == 0 ? arena_strdup(arena, "in.txt") : NULL,
+                i == stages - 1 ? arena_strdup(arena, "out.txt") : NULL, false);
+        if (pipe == NULL)
+            pipe = esh_pipeline_create(arena, cmd);
+        else
+            list_push_back(&pipe->commands, &cmd->elem);
+    }
+    esh_pipeline_finish(pipe);
+    return esh_command_line_create(arena, pipe);
+}
+
+static uint64_t
+run_cmdline(long param, long ops)
+{
+    long i;
+    uint64_t start = now_ns();
+    for (i = 0; i < ops; i++)
+        esh_command_line_free(build_cmdline(param));
+    return now_ns() - start;
+}
+
+static uint64_t
+run_cmdline_copy(long param, long ops)
+{
+    struct esh_command_line *cmdline = build_cmdline(param);
+    struct esh_pipeline *pipe = list_entry(list_begin(&cmdline->pipes), struct esh_pipeline, elem);
+
+    long i;
+    uint64_t start = now_ns();
+    for (i = 0; i < ops; i++)
+        esh_pipeline_free(esh_pipeline_copy(pipe));
+    uint64_t elapsed = now_ns() - start;
+
+    esh_command_line_free(cmdline);
+    return elapsed;
+}
+
+/* --- DISPATCH --- */
+
+#define MAX_PLUGINS 100
+
+static struct esh_plugin plugins[MAX_PLUGINS];
+static int nplugins;
+static int nregistered;
+static struct esh_shell bench_shell;
+
+static bool
+builtin_accept(struct esh_command *cmd, void *aux)
+{
+    return true;
+}
+
+static bool
+plugin_decline(struct esh_command *cmd)
+{
+    return strcmp(cmd->argv[0], "bench-never") == 0;
+}
+
+static bool
+plugin_accept(struct esh_command *cmd)
+{
+    return strcmp(cmd->argv[0], "bench-plugin") == 0;
+}
+
+/* Have 'n' plugins implement process_builtin; only the last accepts */
+static void
+set_plugins(int n)
+{
+    for (; nplugins < n; nplugins++) {
+        plugins[nplugins].rank = nplugins;
+        list_push_back(&esh_plugin_list, &plugins[nplugins].elem);
+    }
+    int i;
+    for (i = 0; i < nplugins; i++)
+        plugins[i].process_builtin = i == nplugins - 1 ? plugin_accept : plugin_decline;
+    esh_plugin_initialize(&bench_shell);
+}
+
+/* Time 'ops' dispatches of a command named 'name', as the shell does */
+static uint64_t
+time_dispatch(const char *name, long ops)
+{
+    char *argv[] = { (char *) name, "arg", NULL };
+    struct esh_command cmd = { .argv = argv };
+
+    long i;
+    uint64_t start = now_ns();
+    for (i = 0; i < ops; i++)
+        sink += esh_builtin_run(&cmd) || esh_plugin_process_builtin(&cmd);
+    return now_ns() - start;
+}
+
+static uint64_t
+run_dispatch_builtin(long param, long ops)
+{
+    char name[32];
+    for (; nregistered < param; nregistered++) {
+        snprintf(name, sizeof name, "bench-%d", nregistered);
+        esh_builtin_register(name, builtin_accept, NULL);
+    }
+    esh_builtin_register("bench-builtin", builtin_accept, NULL);
+    return time_dispatch("bench-builtin", ops);
+}
+
+static uint64_t
+run_dispatch_plugin(long param, long ops)
+{
+    set_plugins(param);
+    return time_dispatch("bench-plugin", ops);
+}
+
+static uint64_t
+run_dispatch_miss(long param, long ops)
+{
+    set_plugins(param);
+    return time_dispatch("bench-nobody", ops);
+}
+
+/* --- PIPELINES --- */
+
+/* "/bin/true | /bin/true ..." of 'stages' stages */
+static char *
+pipeline_line(long stages)
+{
+    static const char stage[] = "/bin/true | ";
+    char *line = malloc(stages * sizeof stage);
+    line[0] = '\0';
+    long i;
+    for (i = 0; i < stages; i++)
+        strcat(line, stage);
+    line[strlen(line) - 3] = '\0';          /* the last " | " */
+    return line;
+}
+
+/* Time 'ops' foreground runs of a pipeline, from the command line
+ * handed to the shell until its job is reaped */
+static uint64_t
+time_pipeline(long stages, long ops)
+{
+    char *line = pipeline_line(stages);
+    uint64_t elapsed = 0;
+
+    long i;
+    for (i = 0; i < ops; i++) {
+        struct esh_command_line *cmdline = esh_parse_command_line(line);
+        uint64_t start = now_ns();
+        esh_command_line_helper(cmdline);
+        elapsed += now_ns() - start;
+        esh_command_line_free(cmdline);
+    }
+
+    free(line);
+    return elapsed;
+}
+
+static uint64_t
+run_pipeline_fork(long param, long ops)
+{
+    esh_launch_mode_set("fork");
+    return time_pipeline(param, ops);
+}
+
+static uint64_t
+run_pipeline_spawn(long param, long ops)
+{
+    esh_launch_mode_set("spawn");
+    uint64_t elapsed = time_pipeline(param, ops);
+    esh_launch_mode_set("fork");
+    return elapsed;
+}
+
+/* --- FILTERS --- */
+
+static char filter_file[] = "/tmp/esh-bench-filter.XXXXXX";
+static long filter_bytes;
+
+static void
+remove_filter_file(void)
+{
+    unlink(filter_file);
+}
+
+/* Make the input file 'bytes' long, of lines of the corpus */
+static void
+make_filter_file(long bytes)
+{
+    if (filter_bytes == 0) {
+        int fd = mkstemp(filter_file);
+        if (fd < 0) {
+            perror(filter_file);
+            exit(1);
+        }
+        close(fd);
+        atexit(remove_filter_file);
+    }
+    if (filter_bytes == bytes)
+        return;
+
+    FILE *f = fopen(filter_file, "w");
+    long n = 0;
+    int i = 0;
+    while (n < bytes) {
+        long k = strlen(corpus[i]);
+        if (k > bytes - n - 1)
+            k = bytes - n - 1;
+        fwrite(corpus[i], 1, k, f);
+        fputc('\n', f);
+        n += k + 1;
+        i = (i + 1) % ncorpus;
+    }
+    fclose(f);
+    filter_bytes = bytes;
+}
+
+/* What /bin/cat does, as a filter */
+static int
+copy_filter(int in_fd, int out_fd, char **argv)
+{
+    char buf[65536];
+    ssize_t n;
+    while ((n = read(in_fd, buf, sizeof buf)) > 0) {
+        ssize_t done = 0;
+        while (done < n) {
+            ssize_t k = write(out_fd, buf + done, n - done);
+            if (k < 0)
+                return 1;
+            done += k;
+        }
+    }
+    return n < 0;
+}
+
+static esh_filter_func
+resolve_copy_filter(const char *name, void *aux)
+{
+    return copy_filter;
+}
+
+/* Time 'ops' foreground runs of 'cmd < input > /dev/null' */
+static uint64_t
+time_filter(const char *cmd, long bytes, long ops)
+{
+    make_filter_file(bytes);
+    char line[sizeof filter_file + 64];
+    snprintf(line, sizeof line, "%s < %s > /dev/null", cmd, filter_file);
+    uint64_t elapsed = 0;
+
+    long i;
+    for (i = 0; i < ops; i++) {
+        struct esh_command_line *cmdline = esh_parse_command_line(line);
+        uint64_t start = now_ns();
+        esh_command_line_helper(cmdline);
+        elapsed += now_ns() - start;
+        esh_command_line_free(cmdline);
+    }
+    return elapsed;
+}
+
+static uint64_t
+run_filter(long param, long ops)
+{
+    esh_filter_register("bench-copy", resolve_copy_filter, NULL);
+    return time_filter("bench-copy", param, ops);
+}
+
+static uint64_t
+run_filter_exec(long param, long ops)
+{
+    return time_filter("/bin/cat", param, ops);
+}
+
+/* --- HISTORY --- */
+
+static char history_file[] = "/tmp/esh-bench-history.XXXXXX";
+static long history_lines;
+
+static void
+remove_history(void)
+{
+    char idx[sizeof history_file + 4];
+    snprintf(idx, sizeof idx, "%s.idx", history_file);
+    unlink(history_file);
+    unlink(idx);
+}
+
+/* A history of 'lines' lines of the corpus, indexed, after a first
+ * one with text that is in no other */
+static void
+make_history(long lines)
+{
+    if (history_lines == 0) {
+        int fd = mkstemp(history_file);
+        if (fd < 0) {
+            perror(history_file);
+            exit(1);
+        }
+        close(fd);
+        atexit(remove_history);
+    }
+    if (history_lines == lines)
+        return;
+
+    FILE *f = fopen(history_file, "w");
+    fprintf(f, "echo needle-in-history\n");
+    long i;
+    for (i = 1; i < lines; i++)
+        fprintf(f, "%s\n", corpus[rng() % ncorpus]);
+    fclose(f);
+
+    esh_history_set_file(history_file);
+    esh_history_build_index();
+    esh_history_count();        /* map and check the index here, untimed */
+    history_lines = lines;
+}
+
+static uint64_t
+run_history_search(long param, long ops)
+{
+    make_history(param);
+    long i;
+    uint64_t start = now_ns();
+    for (i = 0; i < ops; i++)
+        sink += esh_history_search("needle-in", param, -1, false);
+    return now_ns() - start;
+}
+
+/* --- COMPLETION --- */
+
+static uint64_t
+run_complete(long param, long ops)
+{
+    char prefix[] = "grep";
+    prefix[param] = '\0';
+    const char * const *first;
+
+    long i;
+    uint64_t start = now_ns();
+    for (i = 0; i < ops; i++)
+        sink += esh_complete_commands(prefix, &first);
+    return now_ns() - start;
+}
+
+/* --- THE BINARY --- */
+
+static char *shell_path;
+static char scratch_dir[] = "/tmp/esh-bench.XXXXXX";
+static bool have_scratch;
+
+static void
+remove_scratch(void)
+{
+    char script[sizeof scratch_dir + 16];
+    snprintf(script, sizeof script, "%s/script.esh", scratch_dir);
+    unlink(script);
+    rmdir(scratch_dir);
+}
+
+/* The empty directory the shell is run in */
+static const char *
+make_scratch(void)
+{
+    if (!have_scratch) {
+        if (mkdtemp(scratch_dir) == NULL) {
+            perror(scratch_dir);
+            exit(1);
+        }
+        have_scratch = true;
+        atexit(remove_scratch);
+    }
+    return scratch_dir;
+}
+
+/* Run the shell with 'argv' in the scratch directory, its output
+ * discarded, and wait for it to exit.  Returns the ns taken. */
+static uint64_t
+run_shell(char **argv)
+{
+    const char *dir = make_scratch();
+    uint64_t start = now_ns();
+    pid_t pid = fork();
+    if (pid == 0) {
+        int null = open("/dev/null", O_RDWR);
+        dup2(null, 0);
+        dup2(null, 1);
+        dup2(null, 2);
+        if (chdir(dir) == 0)
+            execv(shell_path, argv);
+        _exit(127);
+    }
+    int status;
+    waitpid(pid, &status, 0);
+    uint64_t elapsed = now_ns() - start;
+
+    if (!WIFEXITED(status) || WEXITSTATUS(status) == 127) {
+        fprintf(stderr, "esh-bench: %s failed\n", shell_path);
+        exit(1);
+    }
+    return elapsed;
+}
+
+static uint64_t
+run_script(long param, long ops)
+{
+    static long script_lines;
+    char script[sizeof scratch_dir + 16];
+    snprintf(script, sizeof script, "%s/script.esh", make_scratch());
+    char *argv[] = { shell_path, "script.esh", NULL };
+
+    if (script_lines != param) {
+        FILE *f = fopen(script, "w");
+        long i;
+        for (i = 0; i < param; i++)
+            fputs("jobs\n", f);
+        fclose(f);
+        script_lines = param;
+    }
+
+    long i;
+    uint64_t elapsed = 0;
+    for (i = 0; i < ops; i++)
+        elapsed += run_shell(argv);
+    return elapsed;
+}
+
+static uint64_t
+run_startup(long param, long ops)
+{
+    char *argv[] = { shell_path, "-c", "/bin/true", NULL };
+
+    long i;
+    uint64_t elapsed = 0;
+    for (i = 0; i < ops; i++)
+        elapsed += run_shell(argv);
+    return elapsed;
+}
+
+/* --- DRIVER --- */
+
+struct bench {
+    const char *name;
+    uint64_t (* run)(long param, long ops);     /* ns taken by 'ops' operations */
+    long params[5];                             /* 0-terminated */
+};
+
+static struct bench benches[] = {
+    { "parse",            run_parse,            { 1 } },
+    { "parse_cached",     run_parse_cached,     { 1 } },
+    { "scan",             run_scan,             { 16, 4096, 1 << 20, 8 << 20 } },
+    { "scan_flex",        run_scan_flex,        { 16, 4096, 1 << 20, 8 << 20 } },
+    { "list_size",        run_list_size,        { 1000, 100000 } },
+    { "list_sort",        run_list_sort,        { 1000, 100000 } },
+    { "list_remove",      run_list_remove,      { 1000, 100000 } },
+    { "cmdline",          run_cmdline,          { 1, 8 } },
+    { "cmdline_copy",     run_cmdline_copy,     { 1, 8 } },
+    { "dispatch_builtin", run_dispatch_builtin, { 16, 1024 } },
+    { "dispatch_plugin",  run_dispatch_plugin,  { 1, 10, 100 } },
+    { "dispatch_miss",    run_dispatch_miss,    { 1, 10, 100 } },
+    { "pipeline_fork",    run_pipeline_fork,    { 1, 2, 8, 64 } },
+    { "pipeline_spawn",   run_pipeline_spawn,   { 1, 2, 8, 64 } },
+    { "filter",           run_filter,           { 4096, 1 << 20, 16 << 20 } },
+    { "filter_exec",      run_filter_exec,      { 4096, 1 << 20, 16 << 20 } },
+    { "history_search",   run_history_search,   { 1000, 1000000 } },
+    { "complete",         run_complete,         { 1, 2, 4 } },
+    { "script",           run_script,           { 1000, 100000 } },
+    { "startup",          run_startup,          { 1 } },
+};
+
+static int
+compare_double(const void *a, const void *b)
+{
+    double x = *(const double *) a, y = *(const double *) b;
+    return x < y ? -1 : x > y;
+}
+
+/* Calibrate, time the rounds and print the result line */
+static void
+measure(struct bench *b, long param)
+{
+    long ops = 1;
+    for (;;) {
+        uint64_t ns = b->run(param, ops);
+        if (ns >= target_ns)
+            break;
+        // Grow towards the target, by at most 10x a step
+        long grow = ns ? target_ns / ns + 1 : 10;
+        ops *= grow < 2 ? 2 : grow > 10 ? 10 : grow;
+    }
+
+    double per_op[rounds];
+    int r;
+    for (r = 0; r < rounds; r++)
+        per_op[r] = (double) b->run(param, ops) / ops;
+    qsort(per_op, rounds, sizeof per_op[0], compare_double);
+
+    printf("%s\t%ld\t%ld\t%d\t%.1f\t%.1f\t%.1f\n", b->name, param, ops, rounds,
+           per_op[rounds / 2], per_op[0], per_op[rounds - 1]);
+    fflush(stdout);
+}
+
+/* True if benchmark 'name' is selected by the arguments 'sel' */
+static bool
+selected(const char *name, char **sel, int nsel)
+{
+    int i;
+    if (nsel == 0)
+        return true;
+    for (i = 0; i < nsel; i++)
+        if (strncmp(name, sel[i], strlen(sel[i])) == 0)
+            return true;
+    return false;
+}
+
+static void
+usage(char *progname)
+{
+    fprintf(stderr, "usage: %s [-r rounds] [-t ms] [-f corpus] [-s shell] [benchmark...]\n", progname);
+    exit(2);
+}
+
+int
+main(int ac, char *av[])
+{
+    int opt;
+    char *shell = "./esh";
+    while ((opt = getopt(ac, av, "r:t:f:s:")) > 0) {
+        switch (opt) {
+        case 'r':
+            rounds = atoi(optarg);
+            if (rounds < 1)
+                usage(av[0]);
+            break;
+        case 't':
+            target_ns = atol(optarg) * 1000000;
+            break;
+        case 'f':
+            if (!load_corpus(optarg)) {
+                fprintf(stderr, "%s: cannot read a corpus from %s\n", av[0], optarg);
+                exit(1);
+            }
+            break;
+        case 's':
+            shell = optarg;
+            break;
+        default:
+            usage(av[0]);
+        }
+    }
+    if (corpus == NULL)
+        use_default_corpus();
+    // The shell is run from another directory
+    shell_path = realpath(shell, NULL);
+    if (shell_path == NULL)
+        shell_path = shell;
+
+    // The shell as esh.c sets it up, without a terminal or plugins
+    list_init(&esh_plugin_list);
+    esh_register_builtins();
+    list_init(&jobs_list);
+    esh_sigchld_init();
+    esh_plugin_initialize(&bench_shell);
+    shell_pid = getpid();
+    esh_interactive = false;
+
+    printf("# esh-bench: benchmark\tparam\tops\trounds\tmedian_ns\tmin_ns\tmax_ns\n");
+    unsigned i;
+    for (i = 0; i < sizeof benches / sizeof benches[0]; i++) {
+        struct bench *b = &benches[i];
+        if (!selected(b->name, av + optind, ac - optind))
+            continue;
+        const long *param;
+        for (param = b->params; *param; param++)
+            measure(b, *param);
+    }
+    return 0;
+}
@@ -0,0 +1,303 @@
+#!/usr/bin/env python3
+#
+# eshlatency.py - interactive latency of esh, measured through a pty.
+#
+# Drives the shell the way a user at a terminal does and timestamps,
+# for each operation, the keystroke that submits it, the first byte
+# of output it causes and the redisplay of the prompt.  Job control is
+# driven with the real keys: Ctrl-Z and Ctrl-C reach the foreground
+# job through the pty's line discipline, as they do from a terminal,
+# so give_terminal_to and the SIGCHLD path are on the measured path.
+#
+#   empty       Enter on an empty line                  -> prompt
+#   builtin     'jobs', no jobs                         -> prompt
+#   exec        '/bin/echo X'                           -> output, prompt
+#   pipeline    '/bin/echo X | /bin/cat'                -> output, prompt
+#   ctrl-z      Ctrl-Z on a foreground 'sleep'          -> 'Stopped', prompt
+#   bg          'bg N' on the stopped job               -> prompt
+#   fg          'fg N' on the background job            -> output
+#   ctrl-c      Ctrl-C on a foreground 'sleep'          -> prompt
+#   kill        'kill N' on a stopped job               -> prompt
+#   startup     starting another esh on a new pty       -> prompt
+#
+# Times are from the write of the submitting key, after the echo of
+# the typed text.  Output is one line per operation and event,
+# tab-separated, after a '#' header, like bench/esh-bench:
+#
+#   op event count p50_us p90_us p99_us max_us
+#
+# The prompt and the job status words come from eshoutput.py.  esh is
+# started in an empty directory so that no plugins are loaded, unless
+# -d names another (e.g. '.' to time the plugins too, with -p giving
+# their prompt).  The environment is passed on, so ESH_LAUNCH=spawn and
+# the like apply.  -r writes every sample to a file as well.
+#
+# usage: eshlatency.py [-n rounds] [-s shell] [-d dir] [-p prompt]
+#                      [-r rawfile] [op...]
+#
+import getopt
+import os
+import pty
+import re
+import select
+import shutil
+import signal
+import sys
+import tempfile
+import time
+import warnings
+
+SRC = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+sys.path.insert(0, SRC)
+sys.dont_write_bytecode = True
+with warnings.catch_warnings():
+    warnings.simplefilter("ignore")         # eshoutput's regexes predate raw strings
+    import eshoutput
+
+TIMEOUT = 5.0
+SETTLE = 0.05       # for a started job to be running before a key reaches it
+
+# Readline's bracketed paste switches and other CSI sequences
+ESCAPES = re.compile(rb"\x1b\[[0-9;?]*[A-Za-z]")
+
+class Timeout(Exception):
+    pass
+
+class Shell:
+    """esh on the slave side of a pty"""
+
+    def __init__(self, shell, cwd, prompt):
+        self.args = (shell, cwd, prompt)
+        env = dict(os.environ)
+        env.setdefault("TERM", "xterm")
+        env["INPUTRC"] = "/dev/null"        # no user key bindings
+        env.setdefault("ESH_HISTFILE", os.devnull)  # appended to, never grows
+        self.pid, self.fd = pty.fork()
+        if self.pid == 0:
+            os.chdir(cwd)
+            try:
+                os.execve(shell, [shell], env)
+            finally:
+                os._exit(127)
+        self.buf = b""
+        self.prompt = re.compile(re.escape(prompt).encode())
+
+    def read(self, deadline):
+        """Wait for output until 'deadline'; returns its arrival time"""
+        left = deadline - time.monotonic()
+        if left <= 0 or not select.select([self.fd], [], [], left)[0]:
+            raise Timeout(self.buf[-200:])
+        now = time.monotonic()
+        try:
+            data = os.read(self.fd, 65536)
+        except OSError:
+            data = b""
+        if not data:
+            raise Timeout(b"esh exited")
+        self.buf += ESCAPES.sub(b"", data)
+        return now
+
+    def expect(self, regex):
+        """Read until 'regex' matches the output since the last write.
+        Returns the time the matching output arrived."""
+        if isinstance(regex, str):
+            regex = re.compile(regex.encode())
+        deadline = time.monotonic() + TIMEOUT
+        when = time.monotonic()
+        while not regex.search(self.buf):
+            when = self.read(deadline)
+        return when
+
+    def output(self):
+        """Read until the command's own output starts: the first
+        printable byte after the line readline ends with the Enter.
+        Returns the time it arrived."""
+        deadline = time.monotonic() + TIMEOUT
+        when = time.monotonic()
+        while True:
+            line_end = self.buf.find(b"\n")
+            if line_end >= 0 and self.buf[line_end + 1:].strip():
+                return when
+            when = self.read(deadline)
+
+    def type(self, text):
+        """Type 'text' without submitting it, and wait for its echo"""
+        self.buf = b""
+        os.write(self.fd, text.encode())
+        if text:
+            self.expect(re.escape(text))
+
+    def key(self, key):
+        """Press 'key'; returns the time it was written"""
+        self.buf = b""
+        now = time.monotonic()
+        os.write(self.fd, key.encode())
+        return now
+
+    def close(self):
+        try:
+            os.kill(self.pid, signal.SIGKILL)
+        except OSError:
+            pass
+        os.waitpid(self.pid, 0)
+        os.close(self.fd)
+
+# --- OPERATIONS ---
+#
+# Each takes the shell at a prompt, leaves it at a prompt, and records
+# samples with record(op, event, seconds).
+
+def job_command(name, job):
+    return eshoutput.builtin_commands[name] % job
+
+def submit(sh, text):
+    sh.type(text)
+    return sh.key("\r")
+
+def op_empty(sh, record):
+    start = submit(sh, "")
+    record("empty", "prompt", sh.expect(sh.prompt) - start)
+
+def op_builtin(sh, record):
+    start = submit(sh, eshoutput.builtin_commands['jobs'])
+    record("builtin", "prompt", sh.expect(sh.prompt) - start)
+
+def op_exec(sh, record):
+    start = submit(sh, "/bin/echo X")
+    record("exec", "output", sh.output() - start)
+    record("exec", "prompt", sh.expect(sh.prompt) - start)
+
+def op_pipeline(sh, record):
+    start = submit(sh, "/bin/echo X | /bin/cat")
+    record("pipeline", "output", sh.output() - start)
+    record("pipeline", "prompt", sh.expect(sh.prompt) - start)
+
+def start_sleep(sh):
+    submit(sh, "sleep 1000")
+    time.sleep(SETTLE)
+
+def stop_foreground(sh, record):
+    start = sh.key("\x1a")
+    record("ctrl-z", "status", sh.expect(eshoutput.jobs_status_msg['stopped']) - start)
+    record("ctrl-z", "prompt", sh.expect(sh.prompt) - start)
+    return int(re.search(rb"\[(\d+)\]", sh.buf).group(1))
+
+def op_jobcontrol(sh, record):
+    start_sleep(sh)
+    job = stop_foreground(sh, record)
+
+    start = submit(sh, job_command('bg', job))
+    record("bg", "prompt", sh.expect(sh.prompt) - start)
+
+    start = submit(sh, job_command('fg', job))
+    record("fg", "output", sh.output() - start)
+    time.sleep(SETTLE)
+    stop_foreground(sh, record)
+
+    start = submit(sh, job_command('kill', job))
+    record("kill", "prompt", sh.expect(sh.prompt) - start)
+    # Let the notification of the killed job go by
+    submit(sh, eshoutput.builtin_commands['jobs'])
+    sh.expect(sh.prompt)
+
+def op_interrupt(sh, record):
+    start_sleep(sh)
+    start = sh.key("\x03")
+    record("ctrl-c", "prompt", sh.expect(sh.prompt) - start)
+
+def op_startup(sh, record):
+    start = time.monotonic()
+    fresh = Shell(*sh.args)
+    try:
+        record("startup", "prompt", fresh.expect(fresh.prompt) - start)
+    finally:
+        fresh.close()
+
+OPERATIONS = [
+    ("empty", op_empty),
+    ("builtin", op_builtin),
+    ("exec", op_exec),
+    ("pipeline", op_pipeline),
+    ("jobcontrol", op_jobcontrol),
+    ("ctrl-c", op_interrupt),
+    ("startup", op_startup),
+]
+
+# --- REPORT ---
+
+def percentile(sorted_samples, q):
+    return sorted_samples[min(len(sorted_samples) - 1, int(q * len(sorted_samples)))]
+
+def report(samples):
+    print("# eshlatency: op\tevent\tcount\tp50_us\tp90_us\tp99_us\tmax_us")
+    for (op, event), values in samples.items():
+        values = sorted(values)
+        print("%s\t%s\t%d\t%.0f\t%.0f\t%.0f\t%.0f" % (op, event, len(values),
+              percentile(values, 0.5) * 1e6, percentile(values, 0.9) * 1e6,
+              percentile(values, 0.99) * 1e6, values[-1] * 1e6))
+
+def usage():
+    sys.stderr.write("usage: %s [-n rounds] [-s shell] [-d dir] [-p prompt] [-r rawfile] [op...]\n"
+                     "ops: %s\n" % (sys.argv[0], " ".join(name for name, _ in OPERATIONS)))
+    sys.exit(2)
+
+def main():
+    try:
+        opts, args = getopt.getopt(sys.argv[1:], "n:s:d:p:r:h")
+    except getopt.GetoptError:
+        usage()
+
+    rounds = 30
+    shell = os.path.join(SRC, eshoutput.shell)
+    cwd = None
+    prompt = eshoutput.prompt
+    raw = None
+    for opt, value in opts:
+        if opt == "-n":
+            rounds = int(value)
+        elif opt == "-s":
+            shell = os.path.abspath(value)
+        elif opt == "-d":
+            cwd = os.path.abspath(value)
+        elif opt == "-p":
+            prompt = value
+        elif opt == "-r":
+            raw = open(value, "w")
+        else:
+            usage()
+
+    operations = [(name, op) for name, op in OPERATIONS
+                  if not args or any(name.startswith(a) for a in args)]
+    if not operations:
+        usage()
+
+    scratch = None
+    if cwd is None:
+        cwd = scratch = tempfile.mkdtemp(prefix="eshlatency.")
+
+    # Samples by (op, event), in the order they are first seen
+    samples = {}
+    def record(op, event, seconds):
+        samples.setdefault((op, event), []).append(seconds)
+        if raw:
+            raw.write("%s\t%s\t%.0f\n" % (op, event, seconds * 1e6))
+
+    sh = Shell(shell, cwd, prompt)
+    try:
+        sh.expect(sh.prompt)
+        # Interleave the operations, so that drift affects all alike
+        for _ in range(rounds):
+            for name, op in operations:
+                op(sh, record)
+    except Timeout as e:
+        sys.stderr.write("%s: timed out; last output: %r\n" % (sys.argv[0], e.args[0]))
+        sys.exit(1)
+    finally:
+        sh.close()
+        if scratch:
+            shutil.rmtree(scratch)
+
+    report(samples)
+
+if __name__ == "__main__":
+    main()
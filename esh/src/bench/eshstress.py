@@ -0,0 +1,377 @@
+#!/usr/bin/env python3
+#
+# eshstress.py - job control under load, to find where esh falls over.
+#
+# Drives esh through a pty, as bench/eshlatency.py does, in these
+# scenarios:
+#
+#   bgjobs      N concurrent 'sleep 1000 &' jobs (default 10000); then
+#               'jobs'; then every sleep is killed from outside at once
+#               and the shell, idle at its prompt, reaps them
+#   storm       M background jobs (default 100), stopped and continued
+#               in rounds: 'stop' on each, 'bg' on each, then 'fg' and
+#               Ctrl-Z and 'bg' on each
+#   pipeline    one pipeline of S stages (default 1000), /bin/echo X
+#               into S - 1 /bin/cat
+#   masskill    K background jobs (default 1000), each then killed with
+#               the 'kill' builtin, as fast as the shell takes them
+#
+# and records:
+#
+#   - latency of each command, submit to prompt, as p50, p99 and max;
+#     for launches also the p50 of the first and last tenth, to show
+#     how the cost grows with the number of jobs
+#   - reaping: from the kill to the moment the last child has been
+#     waited for, polled in /proc
+#   - settling: from the last 'stop' or 'bg' until 'jobs' agrees
+#   - the shell's resident and peak memory (VmRSS, VmHWM) before and
+#     after, and its growth per job
+#   - whether 'jobs' lists exactly the jobs there should be, with the
+#     right status, and nothing once they are gone
+#
+# Output is one line per scenario and metric, tab-separated, after a
+# '#' header:
+#
+#   scenario param metric value
+#
+# A check's value is 'ok' or 'fail'; the details of a failure go to
+# standard error and the exit status is 1.
+#
+# usage: eshstress.py [-j jobs] [-m storm jobs] [-r storm rounds]
+#                     [-p stages] [-k kills] [-s shell] [-d dir] [scenario...]
+#
+import getopt
+import os
+import re
+import shutil
+import signal
+import sys
+import tempfile
+import time
+
+sys.dont_write_bytecode = True
+from eshlatency import eshoutput, Shell, Timeout, submit, percentile
+
+SLEEP = "sleep 1000"
+
+failed = False
+
+# Every sleep started, to clean up after a scenario that failed
+started = set()
+
+def emit(scenario, param, metric, value):
+    if isinstance(value, float):
+        value = "%.0f" % value
+    print("%s\t%s\t%s\t%s" % (scenario, param, metric, value))
+    sys.stdout.flush()
+
+def check(scenario, param, name, ok, detail=""):
+    global failed
+    emit(scenario, param, "check_" + name, "ok" if ok else "fail")
+    if not ok:
+        failed = True
+        sys.stderr.write("%s %s: %s: %s\n" % (scenario, param, name, detail))
+
+def emit_latencies(scenario, param, name, seconds):
+    """p50, p99 and max of 'seconds', in us"""
+    if not seconds:
+        return
+    values = sorted(seconds)
+    emit(scenario, param, name + "_p50_us", percentile(values, 0.5) * 1e6)
+    emit(scenario, param, name + "_p99_us", percentile(values, 0.99) * 1e6)
+    emit(scenario, param, name + "_max_us", values[-1] * 1e6)
+
+# --- THE SHELL ---
+
+def run(sh, text):
+    """Submit 'text' and wait for the prompt.
+    Returns the seconds it took and the output."""
+    start = submit(sh, text)
+    return sh.expect(sh.prompt) - start, sh.buf
+
+def memory(sh):
+    """VmRSS and VmHWM of the shell, in kB"""
+    fields = {}
+    with open("/proc/%d/status" % sh.pid) as f:
+        for line in f:
+            name, _, value = line.partition(":")
+            fields[name] = value.split()[0] if value.split() else "0"
+    return int(fields.get("VmRSS", 0)), int(fields.get("VmHWM", 0))
+
+def jobs_table(sh):
+    """Run 'jobs'; returns the seconds it took and {jid: status}.
+    A notification printed with it counts as a line for its job."""
+    seconds, out = run(sh, eshoutput.builtin_commands['jobs'])
+    table = {}
+    for jid, status, cmdline in re.findall(eshoutput.job_status_regex.encode(), out):
+        table[int(jid)] = status.decode()
+    return seconds, table
+
+def settle(sh, expected, timeout=10.0):
+    """Run 'jobs' until it reports 'expected' ({jid: status});
+    returns the seconds that took, and the last table"""
+    start = time.monotonic()
+    while True:
+        _, table = jobs_table(sh)
+        if table == expected or time.monotonic() - start > timeout:
+            return time.monotonic() - start, table
+
+def notices(out):
+    """The jids of the job status lines in 'out'"""
+    return set(int(jid) for jid, status, cmdline
+               in re.findall(eshoutput.job_status_regex.encode(), out))
+
+def start_jobs(sh, n):
+    """Start 'n' background sleeps.
+    Returns {jid: pid} and the submit-to-prompt time of each."""
+    jobs, seconds = {}, []
+    bgjob = re.compile(eshoutput.bgjob_regex.encode())
+    for _ in range(n):
+        took, out = run(sh, SLEEP + " &")
+        m = bgjob.search(out)
+        if m is None:
+            raise Timeout(out[-200:])
+        jobs[int(m.group(1))] = int(m.group(2))
+        started.add(int(m.group(2)))
+        seconds.append(took)
+    return jobs, seconds
+
+def process_state(pid):
+    """The state letter of process 'pid', or None once it is reaped"""
+    try:
+        with open("/proc/%d/stat" % pid) as f:
+            return f.read().rsplit(")", 1)[1].split()[0]
+    except (IOError, IndexError):
+        return None
+
+def wait_reaped(pids, timeout=60.0):
+    """Poll until every process in 'pids' is reaped.
+    Returns the seconds until all are dead and until all are reaped."""
+    start = time.monotonic()
+    alive, unreaped = set(pids), set(pids)
+    dead_at = None
+    while unreaped and time.monotonic() - start < timeout:
+        for pid in list(unreaped):
+            state = process_state(pid)
+            if state is None:
+                unreaped.discard(pid)
+            if state in (None, "Z"):
+                alive.discard(pid)
+        if not alive and dead_at is None:
+            dead_at = time.monotonic() - start
+        time.sleep(0.001)
+    reaped_at = time.monotonic() - start if not unreaped else None
+    return dead_at, reaped_at, unreaped
+
+def report_memory(sh, scenario, param, before, njobs):
+    rss, hwm = memory(sh)
+    emit(scenario, param, "rss_kb", rss)
+    emit(scenario, param, "hwm_kb", hwm)
+    emit(scenario, param, "rss_growth_kb", rss - before[0])
+    if njobs:
+        emit(scenario, param, "growth_per_job_bytes", (hwm - before[1]) * 1024.0 / njobs)
+
+def report_reaping(scenario, param, pids, start):
+    dead_at, reaped_at, unreaped = wait_reaped(pids)
+    if dead_at is not None:
+        emit(scenario, param, "all_dead_ms", (dead_at + start) * 1e3)
+    check(scenario, param, "reaped", reaped_at is not None,
+          "%d children never reaped" % len(unreaped))
+    if reaped_at is not None:
+        emit(scenario, param, "reap_ms", (reaped_at + start) * 1e3)
+        if dead_at is not None:
+            emit(scenario, param, "reap_after_death_ms", (reaped_at - dead_at) * 1e3)
+
+def check_gone(sh, scenario, param, jobs, notified=set()):
+    """Every job in 'jobs' is reported once gone, then no longer
+    listed.  'notified' are the jobs already reported."""
+    notified = notified | notices(run(sh, "")[1])
+    _, table = jobs_table(sh)
+    notified |= set(table) & set(jobs)
+    _, table = jobs_table(sh)
+    check(scenario, param, "notified", notified == set(jobs),
+          "no notice for %d jobs" % len(set(jobs) - notified))
+    check(scenario, param, "jobs_empty", table == {},
+          "%d jobs still listed" % len(table))
+
+# --- SCENARIOS ---
+
+def bgjobs(sh, n):
+    before = memory(sh)
+    jobs, launches = start_jobs(sh, n)
+    emit_latencies("bgjobs", n, "launch", launches)
+    tenth = max(1, n // 10)
+    emit("bgjobs", n, "launch_first10_p50_us", percentile(sorted(launches[:tenth]), 0.5) * 1e6)
+    emit("bgjobs", n, "launch_last10_p50_us", percentile(sorted(launches[-tenth:]), 0.5) * 1e6)
+    report_memory(sh, "bgjobs", n, before, n)
+
+    took, table = jobs_table(sh)
+    emit("bgjobs", n, "jobs_us", took * 1e6)
+    expected = dict((jid, eshoutput.jobs_status_msg['running']) for jid in jobs)
+    check("bgjobs", n, "jobs_listed", table == expected,
+          "%d listed, %d expected" % (len(table), len(expected)))
+
+    # Killed from outside, so that the shell only reaps
+    start = time.monotonic()
+    for pid in jobs.values():
+        os.kill(pid, signal.SIGKILL)
+    report_reaping("bgjobs", n, jobs.values(), time.monotonic() - start)
+    check_gone(sh, "bgjobs", n, jobs)
+    report_memory(sh, "bgjobs", n, before, 0)
+
+def storm(sh, m, rounds):
+    param = "%dx%d" % (m, rounds)
+    running = eshoutput.jobs_status_msg['running']
+    stopped = eshoutput.jobs_status_msg['stopped']
+    before = memory(sh)
+    jobs, _ = start_jobs(sh, m)
+
+    latency = {"stop": [], "bg": [], "fg": [], "ctrl-z": []}
+    settled = {"stopped": [], "running": []}
+    consistent = True
+    for _ in range(rounds):
+        for jid in jobs:
+            latency["stop"].append(run(sh, eshoutput.builtin_commands['stop'] % jid)[0])
+        took, table = settle(sh, dict((jid, stopped) for jid in jobs))
+        settled["stopped"].append(took)
+        consistent &= all(table.get(jid) == stopped for jid in jobs)
+
+        for jid in jobs:
+            latency["bg"].append(run(sh, eshoutput.builtin_commands['bg'] % jid)[0])
+        took, table = settle(sh, dict((jid, running) for jid in jobs))
+        settled["running"].append(took)
+        consistent &= all(table.get(jid) == running for jid in jobs)
+
+        for jid in jobs:
+            start = submit(sh, eshoutput.builtin_commands['fg'] % jid)
+            latency["fg"].append(sh.output() - start)
+            start = sh.key("\x1a")
+            sh.expect(stopped)
+            latency["ctrl-z"].append(sh.expect(sh.prompt) - start)
+            run(sh, eshoutput.builtin_commands['bg'] % jid)
+
+    for name in ("stop", "bg", "fg", "ctrl-z"):
+        emit_latencies("storm", param, name, latency[name])
+    emit_latencies("storm", param, "settle_stopped", settled["stopped"])
+    emit_latencies("storm", param, "settle_running", settled["running"])
+    check("storm", param, "jobs_consistent", consistent, "'jobs' disagreed after settling")
+    _, table = settle(sh, dict((jid, running) for jid in jobs))
+    check("storm", param, "jobs_listed", table == dict((jid, running) for jid in jobs),
+          "%r" % table)
+    report_memory(sh, "storm", param, before, m)
+
+    start = time.monotonic()
+    for pid in jobs.values():
+        os.kill(pid, signal.SIGKILL)
+    report_reaping("storm", param, jobs.values(), time.monotonic() - start)
+    check_gone(sh, "storm", param, jobs)
+
+def quiet(sh, seconds):
+    """Read until the shell has been silent for 'seconds'"""
+    while True:
+        try:
+            sh.read(time.monotonic() + seconds)
+        except Timeout:
+            return
+
+def pipeline(sh, stages):
+    before = memory(sh)
+    line = " | ".join(["/bin/echo X"] + ["/bin/cat"] * (stages - 1))
+
+    # Readline takes a while to echo a long line; that is not timed
+    sh.type("")
+    os.write(sh.fd, line.encode())
+    quiet(sh, 0.5)
+
+    start = sh.key("\r")
+    output = sh.expect(re.compile(rb"(?m)^\r?X\r?$")) - start
+    took = sh.expect(sh.prompt) - start
+    emit("pipeline", stages, "output_us", output * 1e6)
+    emit("pipeline", stages, "prompt_us", took * 1e6)
+    report_memory(sh, "pipeline", stages, before, 0)
+    _, table = jobs_table(sh)
+    check("pipeline", stages, "jobs_empty", table == {}, "%r" % table)
+
+def masskill(sh, k):
+    before = memory(sh)
+    jobs, _ = start_jobs(sh, k)
+    pids = list(jobs.values())
+
+    kills, notified = [], set()
+    start = time.monotonic()
+    for jid in jobs:
+        took, out = run(sh, eshoutput.builtin_commands['kill'] % jid)
+        kills.append(took)
+        notified |= notices(out)
+    emit("masskill", k, "kill_all_ms", (time.monotonic() - start) * 1e3)
+    emit_latencies("masskill", k, "kill", kills)
+    report_reaping("masskill", k, pids, time.monotonic() - start)
+    check_gone(sh, "masskill", k, jobs, notified)
+    report_memory(sh, "masskill", k, before, k)
+
+# --- DRIVER ---
+
+def usage():
+    sys.stderr.write("usage: %s [-j jobs] [-m storm jobs] [-r storm rounds] [-p stages]\n"
+                     "       [-k kills] [-s shell] [-d dir] [scenario...]\n"
+                     "scenarios: bgjobs storm pipeline masskill\n" % sys.argv[0])
+    sys.exit(2)
+
+def main():
+    try:
+        opts, args = getopt.getopt(sys.argv[1:], "j:m:r:p:k:s:d:h")
+    except getopt.GetoptError:
+        usage()
+
+    sizes = {"j": 10000, "m": 100, "r": 5, "p": 1000, "k": 1000}
+    shell = os.path.join(os.path.dirname(os.path.dirname(os.path.abspath(__file__))),
+                         eshoutput.shell)
+    cwd = None
+    for opt, value in opts:
+        if opt in ("-j", "-m", "-r", "-p", "-k"):
+            sizes[opt[1]] = int(value)
+        elif opt == "-s":
+            shell = os.path.abspath(value)
+        elif opt == "-d":
+            cwd = os.path.abspath(value)
+        else:
+            usage()
+
+    scenarios = [
+        ("bgjobs", lambda sh: bgjobs(sh, sizes["j"])),
+        ("storm", lambda sh: storm(sh, sizes["m"], sizes["r"])),
+        ("pipeline", lambda sh: pipeline(sh, sizes["p"])),
+        ("masskill", lambda sh: masskill(sh, sizes["k"])),
+    ]
+    scenarios = [(name, f) for name, f in scenarios
+                 if not args or any(name.startswith(a) for a in args)]
+    if not scenarios:
+        usage()
+
+    scratch = None
+    if cwd is None:
+        cwd = scratch = tempfile.mkdtemp(prefix="eshstress.")
+
+    print("# eshstress: scenario\tparam\tmetric\tvalue")
+    for name, scenario in scenarios:
+        # A fresh shell each, so that one's leftovers do not weigh on the next
+        sh = Shell(shell, cwd, eshoutput.prompt)
+        try:
+            sh.expect(sh.prompt)
+            scenario(sh)
+        except Timeout as e:
+            check(name, "-", "completed", False, "timed out; last output: %r" % e.args[0])
+        finally:
+            sh.close()
+            for pid in started:
+                try:
+                    os.kill(pid, signal.SIGKILL)
+                except OSError:
+                    pass
+            started.clear()
+    if scratch:
+        shutil.rmtree(scratch)
+    sys.exit(1 if failed else 0)
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,14 @@
+#ifndef __ESH_FLEX_SCANNER_H
+#define __ESH_FLEX_SCANNER_H
+
+/*
+ * The flex scanner esh-scanner.c replaced, for comparison in
+ * esh-bench.  Built from bench/flex-scanner.l, so 'make bench' needs
+ * lex; esh itself does not.
+ */
+
+/* Scan the NUL-terminated 'line' to its end, freeing each word.
+ * Returns the total length of the words. */
+long esh_flex_scan(char *line);
+
+#endif //__ESH_FLEX_SCANNER_H
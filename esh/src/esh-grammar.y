@@ -7,7 +7,9 @@
  * This is based on an assignment I did in 1993 as an undergraduate
  * student at Technische Universitaet Berlin.
  *
- * Known bugs: leaks memory when parse errors occur.
+ * All memory for a command line, including its words, comes from a
+ * single arena that is released in one call, also when the parse
+ * is aborted.
  */
 %{
 #include <stdio.h>
@@ -26,25 +28,47 @@ int yylex(void);
 #define AMBOUT  "Ambiguous output redirect."
 
 #include "esh.h"
+#include "arena.h"
+#include "esh-scanner.h"
 
-#define obstack_chunk_alloc malloc
-#define obstack_chunk_free free
+/* arena of the command line currently being parsed */
+static struct arena * parse_arena;
 
 struct cmd_helper {
-    struct obstack words;   /* an obstack of char * to collect argv */
+    char **words;           /* argv being collected, in parse_arena */
+    int nwords;             /* number of words in 'words' */
+    int capacity;           /* number of slots in 'words' */
     char *iored_input;
     char *iored_output;
     bool append_to_output;
 };
 
+/* Append a word to cmd_helper's argv, growing it inside the arena.
+ * One slot is always kept free for the terminating NULL. */
+static void
+add_word(struct cmd_helper *cmd, char *word)
+{
+    if (cmd->nwords + 1 >= cmd->capacity) {
+        int capacity = cmd->capacity ? 2 * cmd->capacity : 8;
+        char **words = arena_alloc(parse_arena, capacity * sizeof *words);
+        if (cmd->nwords)
+            memcpy(words, cmd->words, cmd->nwords * sizeof *words);
+        cmd->words = words;
+        cmd->capacity = capacity;
+    }
+    cmd->words[cmd->nwords++] = word;
+}
+
 /* Initialize cmd_helper and, optionally, set first argv */
 static void
 init_cmd(struct cmd_helper *cmd, char *firstcmd, 
          char *iored_input, char *iored_output, bool append_to_output)
 {
-    obstack_init(&cmd->words);
+    cmd->words = NULL;
+    cmd->nwords = 0;
+    cmd->capacity = 0;
     if (firstcmd)
-        obstack_ptr_grow(&cmd->words, firstcmd);
+        add_word(cmd, firstcmd);
 
     cmd->iored_output = iored_output;
     cmd->iored_input = iored_input;
@@ -60,19 +84,12 @@ static void p_error(char *msg);
 static struct esh_command * 
 make_esh_command(struct cmd_helper *cmd)
 {
-    obstack_ptr_grow(&cmd->words, NULL);
-
-    int sz = obstack_object_size(&cmd->words);
-    char **argv = malloc(sz);
-    memcpy(argv, obstack_finish(&cmd->words), sz);
-    obstack_free(&cmd->words, NULL);
-
-    if (*argv == NULL) {
-        free(argv);
+    if (cmd->nwords == 0)
         return NULL; 
-    }
 
-    return esh_command_create(argv,
+    cmd->words[cmd->nwords] = NULL;
+    return esh_command_create(parse_arena,
+                              cmd->words,
                               cmd->iored_input,
                               cmd->iored_output,
                               cmd->append_to_output);
@@ -81,9 +98,6 @@ make_esh_command(struct cmd_helper *cmd)
 /* Called by parser when command line is complete */
 static void cmdline_complete(struct esh_command_line *);
 
-/* work-around for bug in flex 2.31 and later */
-static void yyunput (int c,char *buf_ptr  ) __attribute__((unused));
-
 %}
 
 /* LALR stack types */
@@ -107,10 +121,10 @@ static void yyunput (int c,char *buf_ptr  ) __attribute__((unused));
 %%
 cmd_line: cmd_list { cmdline_complete($1); }
 
-cmd_list:	/* Null Command */ { $$ = esh_command_line_create_empty(); }
+cmd_list:	/* Null Command */ { $$ = esh_command_line_create_empty(parse_arena); }
 |		pipeline { 
             esh_pipeline_finish($1);
-            $$ = esh_command_line_create($1);
+            $$ = esh_command_line_create(parse_arena, $1);
         } 
 |		cmd_list ';'
 |		cmd_list '&' {
@@ -140,7 +154,7 @@ cmd_list:	/* Null Command */ { $$ = esh_command_line_create_empty(); }
 pipeline: command {
             struct esh_command * pcmd = make_esh_command(&$1);
             if (pcmd == NULL) { p_error(INVNUL); YYABORT; }
-            $$ = esh_pipeline_create(pcmd);
+            $$ = esh_pipeline_create(parse_arena, pcmd);
 		}
 |		pipeline '|' command {
 		    /* Error: 'ls >x | wc' */
@@ -169,17 +183,15 @@ command:   WORD {
 |		output
 |		command WORD {
             $$ = $1;
-            obstack_ptr_grow(&$$.words, $2);
+            add_word(&$$, $2);
 		}
 |		command input {
-            obstack_free(&$2.words, NULL);
             /* Error: ambiguous redirect 'a <b <c' */
             if($1.iored_input)   { p_error(AMBINP); YYABORT; }
             $$ = $1; 
             $$.iored_input = $2.iored_input;
 		}
 |		command output {
-            obstack_free(&$2.words, NULL);
             /* Error: ambiguous redirect 'a >b >c' */
             if ($1.iored_output) { p_error(AMBOUT); YYABORT; }
             $$ = $1; 
@@ -203,15 +215,32 @@ output:	'>' WORD {
 |		GREATER_GREATER error { p_error(MISRED); YYABORT; }
 
 %%
-static char * inputline;    /* currently processed input line */
-#define YY_INPUT(buf,result,max_size) \
-    { \
-        result = *inputline ? (buf[0] = *inputline++, 1) : YY_NULL; \
-    }
+static struct esh_scanner scanner;  /* scans the currently processed line */
 
-#define YY_NO_UNPUT
-#define YY_NO_INPUT
-#include "lex.yy.c"
+/* 
+ * Return next token to the parser.
+ * Words are views into the arena copy of the line, NUL-terminated
+ * in place by the scanner, and are handed over without copying.
+ */
+int
+yylex(void)
+{
+    struct esh_token tok;
+    int kind = esh_scanner_next(&scanner, &tok);
+
+    switch (kind) {
+    case ESH_TOKEN_WORD:
+        yylval.word = tok.text;
+        return WORD;
+    case ESH_TOKEN_GREATER_GREATER:
+        return GREATER_GREATER;
+    case ESH_TOKEN_EOF:
+        return 0;
+    default:
+        /* single-character token; its byte may hold a word's NUL */
+        return kind;
+    }
+}
 
 static void
 p_error(char *msg) 
@@ -234,14 +263,40 @@ static void cmdline_complete(struct esh_command_line *cline)
 
 /* 
  * parse a commandline.
+ * The result and everything it refers to live in one arena,
+ * which esh_command_line_free() releases.
  */
 struct esh_command_line *
 esh_parse_command_line(char * line)
 {
-    inputline = line;
+    return esh_parse_command_line_sized(line, 0);
+}
+
+/* 
+ * parse a commandline into an arena whose first chunk holds 'size'
+ * bytes, or the default if 'size' is 0.
+ */
+struct esh_command_line *
+esh_parse_command_line_sized(char * line, size_t size)
+{
     commandline = NULL;
+    parse_arena = size ? arena_create_sized(size) : arena_create();
+
+    /* one copy of the line; words are terminated inside it */
+    size_t len = strlen(line);
+    char * text = arena_strndup(parse_arena, line, len);
+    esh_scanner_init(&scanner, text, len, true);
 
     int error = yyparse();
 
-    return error ? NULL : commandline;
+    if (error) {
+        /* partial results are discarded along with the arena */
+        arena_destroy(parse_arena);
+        parse_arena = NULL;
+        return NULL;
+    }
+
+    commandline->arena = parse_arena;
+    parse_arena = NULL;
+    return commandline;
 }
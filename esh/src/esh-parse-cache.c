@@ -0,0 +1,272 @@
+/*
+ * esh-parse-cache.c
+ * Memoizing parse cache.  See esh-parse-cache.h.
+ *
+ * A cached line keeps a copy of the arena its parse was built in,
+ * and the offsets, from the start of the arena, of every pointer the
+ * parser stored in it: list links, argv, words, redirects and back
+ * pointers.  All of them point into the arena itself.  A hit copies
+ * the arena with arena_copy() and moves each of those pointers by
+ * the distance between the two copies.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "esh.h"
+#include "hash.h"
+#include "arena.h"
+#include "esh-parse-cache.h"
+
+#define DEFAULT_CAPACITY    256
+
+struct parse_cache_entry {
+    struct hash_elem elem;      /* Link element for 'cache' */
+    struct list_elem lru_elem;  /* Link element for 'lru', most recent first */
+    unsigned hash;              /* hash of the raw line */
+    size_t len;                 /* length of the raw line */
+    char *line;                 /* the raw line, after 'slots' */
+    struct arena *image;        /* copy of the arena of its parse */
+    size_t cmdline_off;         /* where the command line is in 'image' */
+    uint32_t nslots;
+    uint32_t slots[];           /* offsets of the pointers in 'image' */
+};
+
+static struct hash cache;
+static struct list lru;
+static bool cache_ready;
+static int capacity = DEFAULT_CAPACITY;
+static unsigned long hits, misses;
+
+static unsigned
+entry_hash(const struct hash_elem *e, void *aux)
+{
+    return hash_entry(e, struct parse_cache_entry, elem)->hash;
+}
+
+static bool
+entry_less(const struct hash_elem *a_, const struct hash_elem *b_, void *aux)
+{
+    struct parse_cache_entry *a = hash_entry(a_, struct parse_cache_entry, elem);
+    struct parse_cache_entry *b = hash_entry(b_, struct parse_cache_entry, elem);
+
+    if (a->hash != b->hash)
+        return a->hash < b->hash;
+    if (a->len != b->len)
+        return a->len < b->len;
+    return memcmp(a->line, b->line, a->len) < 0;
+}
+
+static void
+cache_init(void)
+{
+    hash_init(&cache, entry_hash, entry_less, NULL);
+    list_init(&lru);
+    cache_ready = true;
+}
+
+/* The pointers of a parse, as offsets from the start of its arena.
+ * Counts them if 'slots' is NULL. */
+struct slot_list {
+    char *base;
+    uint32_t *slots;
+    uint32_t n;
+};
+
+/* Note the pointer at 'slot', unless it is NULL */
+static void
+note(struct slot_list *l, void *slot)
+{
+    if (*(void **) slot == NULL)
+        return;
+    if (l->slots)
+        l->slots[l->n] = (char *) slot - l->base;
+    l->n++;
+}
+
+static void
+note_list(struct slot_list *l, struct list *list)
+{
+    note(l, &list->head.prev);
+    note(l, &list->head.next);
+    note(l, &list->tail.prev);
+    note(l, &list->tail.next);
+}
+
+/* Note every pointer the parser sets in 'cmdline'.  Fields it leaves
+ * uninitialized, such as a pipeline's title, must not be noted. */
+static void
+note_command_line(struct slot_list *l, struct esh_command_line *cmdline)
+{
+    struct list_elem *p, *c;
+
+    note_list(l, &cmdline->pipes);
+    note(l, &cmdline->arena);
+    for (p = list_begin(&cmdline->pipes); p != list_end(&cmdline->pipes); p = list_next(p)) {
+        struct esh_pipeline *pipe = list_entry(p, struct esh_pipeline, elem);
+        note_list(l, &pipe->commands);
+        note_list(l, &pipe->done);
+        note(l, &pipe->elem.prev);
+        note(l, &pipe->elem.next);
+        note(l, &pipe->iored_input);
+        note(l, &pipe->iored_output);
+        note(l, &pipe->arena);
+        for (c = list_begin(&pipe->commands); c != list_end(&pipe->commands); c = list_next(c)) {
+            struct esh_command *cmd = list_entry(c, struct esh_command, elem);
+            char **w;
+            note(l, &cmd->argv);
+            for (w = cmd->argv; *w; w++)
+                note(l, w);
+            note(l, &cmd->iored_input);
+            note(l, &cmd->iored_output);
+            note(l, &cmd->elem.prev);
+            note(l, &cmd->elem.next);
+            note(l, &cmd->pipeline);
+            note(l, &cmd->path);
+        }
+    }
+}
+
+/* Point the noted pointers of 'copy', a copy of arena 'from', into
+ * 'copy' */
+static void
+relocate(struct arena *copy, struct arena *from, const uint32_t *slots, uint32_t n)
+{
+    uint32_t i;
+    for (i = 0; i < n; i++) {
+        char **slot = (char **) ((char *) copy + slots[i]);
+        *slot = (char *) copy + (*slot - (char *) from);
+    }
+}
+
+/* Build a cache entry holding 'line' and a copy of its parse
+ * 'cmdline', whose arena must have one chunk */
+static struct parse_cache_entry *
+entry_create(const char *line, size_t len, unsigned hash,
+             struct esh_command_line *cmdline)
+{
+    struct arena *image = arena_copy(cmdline->arena);
+    if (image == NULL)
+        return NULL;
+
+    struct slot_list l = { .base = (char *) cmdline->arena };
+    note_command_line(&l, cmdline);
+
+    struct parse_cache_entry *entry = malloc(sizeof *entry + l.n * sizeof *l.slots + len + 1);
+    if (entry == NULL) {
+        arena_destroy(image);
+        return NULL;
+    }
+
+    l.slots = entry->slots;
+    l.n = 0;
+    note_command_line(&l, cmdline);
+    relocate(image, cmdline->arena, entry->slots, l.n);
+
+    entry->hash = hash;
+    entry->len = len;
+    entry->line = (char *) (entry->slots + l.n);
+    memcpy(entry->line, line, len + 1);
+    entry->image = image;
+    entry->cmdline_off = (char *) cmdline - (char *) cmdline->arena;
+    entry->nslots = l.n;
+    return entry;
+}
+
+/* A fresh command line from a cache entry */
+static struct esh_command_line *
+entry_clone(struct parse_cache_entry *entry)
+{
+    struct arena *arena = arena_copy(entry->image);
+    relocate(arena, entry->image, entry->slots, entry->nslots);
+    return (struct esh_command_line *) ((char *) arena + entry->cmdline_off);
+}
+
+/* Drop least recently used entries until at most 'max' remain */
+static void
+evict(int max)
+{
+    while (hash_size(&cache) > (size_t) max) {
+        struct parse_cache_entry *victim;
+        victim = list_entry(list_pop_back(&lru), struct parse_cache_entry, lru_elem);
+        hash_delete(&cache, &victim->elem);
+        arena_destroy(victim->image);
+        free(victim);
+    }
+}
+
+/* Parse 'line', consulting the cache first */
+struct esh_command_line *
+esh_parse_command_line_cached(char *line)
+{
+    if (capacity == 0)
+        return esh_parse_command_line(line);
+
+    if (!cache_ready)
+        cache_init();
+
+    struct parse_cache_entry key;
+    key.len = strlen(line);
+    key.line = line;
+    key.hash = hash_bytes(line, key.len);
+
+    struct hash_elem *e = hash_find(&cache, &key.elem);
+    if (e) {
+        struct parse_cache_entry *entry = hash_entry(e, struct parse_cache_entry, elem);
+        list_remove(&entry->lru_elem);
+        list_push_front(&lru, &entry->lru_elem);
+        hits++;
+        return entry_clone(entry);
+    }
+
+    misses++;
+    struct esh_command_line *cmdline = esh_parse_command_line(line);
+
+    /* Lines that fail to parse are not cached, so that the error
+     * is reported every time. */
+    if (cmdline == NULL)
+        return NULL;
+
+    /* A long line is parsed again into one chunk, for arena_copy() */
+    if (arena_chunk_count(cmdline->arena) > 1) {
+        size_t size = arena_allocated(cmdline->arena);
+        esh_command_line_free(cmdline);
+        cmdline = esh_parse_command_line_sized(line, size);
+    }
+
+    struct parse_cache_entry *entry = entry_create(line, key.len, key.hash, cmdline);
+    if (entry) {
+        hash_insert(&cache, &entry->elem);
+        list_push_front(&lru, &entry->lru_elem);
+        evict(capacity);
+    }
+    return cmdline;
+}
+
+/* Set the maximum number of cached lines */
+void
+esh_parse_cache_set_capacity(int max)
+{
+    capacity = max < 0 ? 0 : max;
+    if (cache_ready)
+        evict(capacity);
+}
+
+/* Forget all cached lines */
+void
+esh_parse_cache_clear(void)
+{
+    if (cache_ready)
+        evict(0);
+}
+
+/* Hit and miss counters */
+void
+esh_parse_cache_get_stats(struct esh_parse_cache_stats *stats)
+{
+    stats->hits = hits;
+    stats->misses = misses;
+    stats->entries = cache_ready ? hash_size(&cache) : 0;
+    stats->capacity = capacity;
+}
@@ -0,0 +1,39 @@
+#ifndef __ESH_PARSE_CACHE_H
+#define __ESH_PARSE_CACHE_H
+
+/*
+ * Memoizing parse cache.
+ *
+ * Interactive and driver-fed sessions repeat the same command lines
+ * over and over.  The cache keeps a bounded LRU of recently parsed
+ * lines, keyed by a hash of the raw line, each as a private copy of
+ * the arena its parse was built in.  A hit copies that arena with
+ * one allocation and one memcpy and adjusts the pointers in it,
+ * without running the parser or building the command line again.
+ */
+#include <stdbool.h>
+
+struct esh_command_line;
+
+/* Parse 'line', consulting the cache first.
+ * The result is owned by the caller, just as with
+ * esh_parse_command_line(). */
+struct esh_command_line * esh_parse_command_line_cached(char *line);
+
+/* Set the maximum number of cached lines; 0 disables the cache */
+void esh_parse_cache_set_capacity(int capacity);
+
+/* Forget all cached lines */
+void esh_parse_cache_clear(void);
+
+/* Hit and miss counters */
+struct esh_parse_cache_stats {
+    unsigned long hits;
+    unsigned long misses;
+    int entries;
+    int capacity;
+};
+
+void esh_parse_cache_get_stats(struct esh_parse_cache_stats *stats);
+
+#endif //__ESH_PARSE_CACHE_H
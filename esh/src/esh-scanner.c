@@ -0,0 +1,178 @@
+/*
+ * esh-scanner.c
+ * Tokenizer for esh command lines.  See esh-scanner.h.
+ *
+ * The token set is the one the flex scanner had:
+ *
+ *      [ \t]*                  skipped
+ *      ">>"                    ESH_TOKEN_GREATER_GREATER
+ *      [|&;<>\n]               the character itself
+ *      [^|&;<>\n\t ]+          ESH_TOKEN_WORD
+ */
+#include <stdint.h>
+#include <string.h>
+
+#include "esh-scanner.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define ESH_SCANNER_X86 1
+#endif
+
+/* Characters that end a word */
+static const unsigned char word_delim[256] = {
+    ['|'] = 1, ['&'] = 1, [';'] = 1, ['<'] = 1, ['>'] = 1,
+    ['\n'] = 1, ['\t'] = 1, [' '] = 1
+};
+
+static char *
+word_end_scalar(char *p, char *end)
+{
+    while (p < end && !word_delim[(unsigned char) *p])
+        p++;
+    return p;
+}
+
+#ifdef ESH_SCANNER_X86
+/* Compare 16 bytes against all eight delimiters; return the mask of matches */
+#define DELIM_MASK_128(v) _mm_movemask_epi8(                                \
+    _mm_or_si128(                                                           \
+      _mm_or_si128(                                                         \
+        _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('|')),                 \
+                     _mm_cmpeq_epi8(v, _mm_set1_epi8('&'))),                \
+        _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(';')),                 \
+                     _mm_cmpeq_epi8(v, _mm_set1_epi8('<')))),               \
+      _mm_or_si128(                                                         \
+        _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('>')),                 \
+                     _mm_cmpeq_epi8(v, _mm_set1_epi8('\n'))),               \
+        _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\t')),                \
+                     _mm_cmpeq_epi8(v, _mm_set1_epi8(' '))))))
+
+__attribute__((target("sse2")))
+static char *
+word_end_sse2(char *p, char *end)
+{
+    while (end - p >= 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *) p);
+        unsigned mask = DELIM_MASK_128(v);
+        if (mask)
+            return p + __builtin_ctz(mask);
+        p += 16;
+    }
+    return word_end_scalar(p, end);
+}
+
+__attribute__((target("avx2")))
+static char *
+word_end_avx2(char *p, char *end)
+{
+    while (end - p >= 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *) p);
+        __m256i m = _mm256_or_si256(
+            _mm256_or_si256(
+                _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('|')),
+                                _mm256_cmpeq_epi8(v, _mm256_set1_epi8('&'))),
+                _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(';')),
+                                _mm256_cmpeq_epi8(v, _mm256_set1_epi8('<')))),
+            _mm256_or_si256(
+                _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('>')),
+                                _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n'))),
+                _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\t')),
+                                _mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')))));
+        unsigned mask = _mm256_movemask_epi8(m);
+        if (mask)
+            return p + __builtin_ctz(mask);
+        p += 32;
+    }
+    return word_end_sse2(p, end);
+}
+#endif
+
+static char * word_end_resolve(char *p, char *end);
+
+/* Implementation picked on first use */
+static char * (* word_end)(char *, char *) = word_end_resolve;
+
+static char *
+word_end_resolve(char *p, char *end)
+{
+    word_end = word_end_scalar;
+#ifdef ESH_SCANNER_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        word_end = word_end_avx2;
+    else if (__builtin_cpu_supports("sse2"))
+        word_end = word_end_sse2;
+#endif
+    return word_end(p, end);
+}
+
+/* Return a pointer to the first metacharacter or blank in [p, end) */
+char *
+esh_scan_word_end(char *p, char *end)
+{
+    return word_end(p, end);
+}
+
+/* Prepare to scan the 'len' bytes at 'buf' */
+void
+esh_scanner_init(struct esh_scanner *s, char *buf, size_t len, bool terminate)
+{
+    s->pos = buf;
+    s->end = buf + len;
+    s->terminate = terminate;
+    s->held = '\0';
+}
+
+/* Current character, which may have been overwritten by a word's NUL */
+static inline char
+current(struct esh_scanner *s)
+{
+    return s->held ? s->held : *s->pos;
+}
+
+/* Return the kind of the next token and store its view in 'tok' */
+int
+esh_scanner_next(struct esh_scanner *s, struct esh_token *tok)
+{
+    char c;
+
+    /* skip blanks */
+    for (;;) {
+        if (s->pos >= s->end) {
+            tok->text = s->end;
+            tok->len = 0;
+            return ESH_TOKEN_EOF;
+        }
+        c = current(s);
+        if (c != ' ' && c != '\t')
+            break;
+        s->held = '\0';
+        s->pos++;
+    }
+
+    s->held = '\0';
+    tok->text = s->pos;
+
+    if (word_delim[(unsigned char) c]) {
+        if (c == '>' && s->pos + 1 < s->end && s->pos[1] == '>') {
+            tok->len = 2;
+            s->pos += 2;
+            return ESH_TOKEN_GREATER_GREATER;
+        }
+        tok->len = 1;
+        s->pos++;
+        return c;
+    }
+
+    char *q = word_end(s->pos, s->end);
+    tok->len = q - s->pos;
+    s->pos = q;
+
+    if (s->terminate) {
+        if (q < s->end)
+            s->held = *q;
+        *q = '\0';
+    }
+    return ESH_TOKEN_WORD;
+}
@@ -0,0 +1,48 @@
+#ifndef __ESH_SCANNER_H
+#define __ESH_SCANNER_H
+
+/*
+ * Tokenizer for esh command lines.
+ *
+ * Replaces the flex scanner, which was fed one character per
+ * YY_INPUT call and strdup'd every word.  Word boundaries are found
+ * by searching for the metacharacters |&;<> and blanks 16 or 32
+ * bytes at a time with SSE2/AVX2, with a table-driven scalar
+ * fallback.  Tokens are (pointer, length) views into the scanned
+ * buffer; no token is ever copied.
+ */
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Token kinds besides the single-character tokens | & ; < > \n */
+#define ESH_TOKEN_EOF               0
+#define ESH_TOKEN_WORD              256
+#define ESH_TOKEN_GREATER_GREATER   257
+
+/* A token: a view into the scanned buffer */
+struct esh_token {
+    char *text;
+    size_t len;
+};
+
+struct esh_scanner {
+    char *pos;              /* next byte to examine */
+    char *end;              /* end of buffer */
+    bool terminate;         /* NUL-terminate words in place */
+    char held;              /* delimiter overwritten by the last word's NUL */
+};
+
+/* Prepare to scan the 'len' bytes at 'buf'.
+ * If 'terminate' is set, each word is NUL-terminated in place, so
+ * that its text can be used as a C string without copying.  This
+ * requires 'buf' to be writable and to have a byte at buf[len]. */
+void esh_scanner_init(struct esh_scanner *s, char *buf, size_t len, bool terminate);
+
+/* Return the kind of the next token and store its view in 'tok' */
+int esh_scanner_next(struct esh_scanner *s, struct esh_token *tok);
+
+/* Return a pointer to the first metacharacter or blank in
+ * [p, end), or 'end' if there is none.  Exposed for benchmarks. */
+char * esh_scan_word_end(char *p, char *end);
+
+#endif //__ESH_SCANNER_H
@@ -0,0 +1,169 @@
+/*
+ * esh-script.c
+ * Script file execution.  See esh-script.h.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "esh-sys-utils.h"
+#include "esh-script.h"
+
+/* Size of the blocks read when a script cannot be mapped */
+#define SCRIPT_BLOCK_SIZE   (64 * 1024)
+
+/* Line buffer, reused for every line */
+static char *linebuf;
+static size_t linebuf_size;
+
+/* Copy a line into the line buffer, NUL-terminate it and evaluate it */
+static void
+eval_line(const char *line, size_t len, esh_line_func eval)
+{
+    const char *p = line;
+    while (p < line + len && (*p == ' ' || *p == '\t'))
+        p++;
+    if (p < line + len && *p == '#')
+        return;
+
+    if (len + 1 > linebuf_size) {
+        linebuf_size = len + 1 > 2 * linebuf_size ? len + 1 : 2 * linebuf_size;
+        linebuf = realloc(linebuf, linebuf_size);
+        if (linebuf == NULL)
+            esh_sys_fatal_error("script line buffer: ");
+    }
+    memcpy(linebuf, line, len);
+    linebuf[len] = '\0';
+    eval(linebuf);
+}
+
+/* Split [buf, buf + len) into lines.  Returns the number of bytes
+ * consumed; a trailing partial line is only consumed if 'final'. */
+static size_t
+eval_lines(const char *buf, size_t len, bool final, esh_line_func eval)
+{
+    const char *p = buf, *end = buf + len;
+
+    for (;;) {
+        const char *nl = memchr(p, '\n', end - p);
+        if (nl == NULL)
+            break;
+        eval_line(p, nl - p, eval);
+        p = nl + 1;
+    }
+
+    if (final && p < end) {
+        eval_line(p, end - p, eval);
+        p = end;
+    }
+    return p - buf;
+}
+
+/* Read the script in large blocks */
+static void
+run_streaming(int fd, esh_line_func eval)
+{
+    size_t size = SCRIPT_BLOCK_SIZE, used = 0;
+    char *buf = malloc(size);
+    if (buf == NULL)
+        esh_sys_fatal_error("script buffer: ");
+
+    for (;;) {
+        /* a line longer than the buffer makes it grow */
+        if (used == size) {
+            size *= 2;
+            buf = realloc(buf, size);
+            if (buf == NULL)
+                esh_sys_fatal_error("script buffer: ");
+        }
+
+        ssize_t n = read(fd, buf + used, size - used);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            esh_sys_error("reading script: ");
+            break;
+        }
+        if (n == 0)
+            break;
+
+        used += n;
+        size_t consumed = eval_lines(buf, used, false, eval);
+        memmove(buf, buf + consumed, used - consumed);
+        used -= consumed;
+    }
+
+    eval_lines(buf, used, true, eval);
+    free(buf);
+}
+
+/* Run the lines of a mapped file whose descriptor the commands
+ * inherit, e.g. 'esh < script'.  The file offset is kept just past
+ * the line being run, as if the shell had read only that far, so a
+ * command reading its standard input gets the rest of the file, and
+ * whatever it consumes is not run. */
+static void
+run_mapped_shared(int fd, const char *map, off_t size, esh_line_func eval)
+{
+    off_t pos = lseek(fd, 0, SEEK_CUR);
+
+    while (pos >= 0 && pos < size) {
+        const char *line = map + pos;
+        const char *nl = memchr(line, '\n', size - pos);
+        size_t len = nl ? (size_t) (nl - line) : (size_t) (size - pos);
+        off_t next = pos + len + (nl != NULL);
+
+        lseek(fd, next, SEEK_SET);
+        eval_line(line, len, eval);
+
+        pos = lseek(fd, 0, SEEK_CUR);
+        if (pos < next)
+            pos = next;
+    }
+}
+
+/* Run every line read from 'fd' through 'eval' */
+void
+esh_script_run_fd(int fd, esh_line_func eval)
+{
+    struct stat st;
+
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            madvise(map, st.st_size, MADV_SEQUENTIAL);
+            if (fcntl(fd, F_GETFD) & FD_CLOEXEC)
+                eval_lines(map, st.st_size, true, eval);
+            else
+                run_mapped_shared(fd, map, st.st_size, eval);
+            munmap(map, st.st_size);
+            return;
+        }
+    }
+    run_streaming(fd, eval);
+}
+
+/* Run every line of 'text' through 'eval' */
+void
+esh_script_run_string(const char *text, esh_line_func eval)
+{
+    eval_lines(text, strlen(text), true, eval);
+}
+
+/* Run every line of file 'path' through 'eval' */
+bool
+esh_script_run_file(const char *path, esh_line_func eval)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return false;
+
+    esh_script_run_fd(fd, eval);
+    close(fd);
+    return true;
+}
@@ -0,0 +1,36 @@
+#ifndef __ESH_SCRIPT_H
+#define __ESH_SCRIPT_H
+
+/*
+ * Script file execution.
+ *
+ * A script is split into lines that are handed to the evaluator
+ * directly, without readline and without building prompts.
+ * Regular files are memory-mapped; anything that cannot be mapped
+ * (pipes, terminals, /dev/stdin) is read in large blocks.
+ *
+ * When the commands inherit the script's descriptor (esh < file), a
+ * mapped script keeps the file offset in step with the line being
+ * run, so commands that read standard input see the following lines.
+ * A piped script is read ahead and its commands do not.
+ */
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Evaluate one line.  'line' is NUL-terminated, does not include
+ * the newline, and is only valid for the duration of the call. */
+typedef void (* esh_line_func)(char *line);
+
+/* Run every line of file 'path' through 'eval'.
+ * Lines whose first non-blank character is '#' are skipped, which
+ * also skips a '#!' interpreter line.
+ * Returns false if the file could not be opened. */
+bool esh_script_run_file(const char *path, esh_line_func eval);
+
+/* Like esh_script_run_file, reading from an open file descriptor */
+void esh_script_run_fd(int fd, esh_line_func eval);
+
+/* Like esh_script_run_file, for the lines of string 'text' (esh -c) */
+void esh_script_run_string(const char *text, esh_line_func eval);
+
+#endif //__ESH_SCRIPT_H
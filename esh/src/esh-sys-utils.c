@@ -20,13 +20,13 @@
 
 #include "esh-sys-utils.h"
 
-#ifdef __clang__
-#pragma clang diagnostic push
-#pragma clang diagnostic ignored "-Wunused-const-variable"
+#ifdef __GNUC__
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-const-variable"
 #endif
 static const char rcsid [] = "$Id: esh-sys-utils.c,v 1.6 2015/02/04 00:01:13 cs3214 Exp $";
-#ifdef __clang__
-#pragma clang diagnostic pop
+#ifdef __GNUC__
+#pragma GCC diagnostic pop
 #endif
 
 /* Utility function for esh_sys_fatal_error and esh_sys_error */
@@ -77,24 +77,36 @@ static int terminal_fd = -1;           /* the controlling terminal */
 static struct termios saved_tty_state;  /* the state of the terminal when shell
                                            was started. */
 
-/* Initialize tty support.  Return pointer to saved initial terminal state */
+/* Initialize tty support.  Return pointer to saved initial terminal state,
+ * or NULL if there is no controlling terminal. */
 struct termios *
-esh_sys_tty_init(void)
+esh_sys_tty_try_init(void)
 {
-    char *tty;
     assert(terminal_fd == -1 || !!!"esh_sys_tty_init already called");
 
-    terminal_fd = open(tty = ctermid(NULL), O_RDWR);
+    terminal_fd = open(ctermid(NULL), O_RDWR | O_CLOEXEC);
     if (terminal_fd == -1)
-        esh_sys_fatal_error("opening controlling terminal %s failed: ", tty);
-
-    if (esh_set_cloexec(terminal_fd))
-        esh_sys_fatal_error("cannot mark terminal fd FD_CLOEXEC");
+        return NULL;
 
-    esh_sys_tty_save(&saved_tty_state);
+    if (tcgetattr(terminal_fd, &saved_tty_state) == -1) {
+        close(terminal_fd);
+        terminal_fd = -1;
+        return NULL;
+    }
     return &saved_tty_state;
 }
 
+/* Initialize tty support.  Return pointer to saved initial terminal state */
+struct termios *
+esh_sys_tty_init(void)
+{
+    struct termios *state = esh_sys_tty_try_init();
+    if (state == NULL)
+        esh_sys_fatal_error("opening controlling terminal %s failed: ", ctermid(NULL));
+
+    return state;
+}
+
 /* Save current terminal settings.
  * This function is used when a job is suspended.*/
 void 
@@ -32,6 +32,10 @@ int esh_sys_tty_getfd(void);
  */
 struct termios * esh_sys_tty_init(void);
 
+/* Like esh_sys_tty_init, but return NULL instead of exiting if the
+ * shell has no controlling terminal (cron, containers, setsid). */
+struct termios * esh_sys_tty_try_init(void);
+
 /* Save current terminal settings.
  * This function is used when a job is suspended.*/
 void esh_sys_tty_save(struct termios *saved_tty_state);
@@ -0,0 +1,126 @@
+/*
+ * esh-utils-builtin.c
+ * Builtin command registry.  See esh-utils-builtin.h.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "esh.h"
+#include "hash.h"
+#include "esh-utils-builtin.h"
+
+/* A registered builtin */
+struct builtin_entry {
+    struct hash_elem elem;      /* Link element for 'builtins' */
+    char *name;
+    unsigned hash;              /* hash_string(name) */
+    esh_builtin_func func;
+    void *aux;
+};
+
+static struct hash builtins;
+static bool builtins_ready;
+static unsigned generation;      /* of the set of names */
+
+static unsigned
+builtin_entry_hash(const struct hash_elem *e, void *aux)
+{
+    return hash_entry(e, struct builtin_entry, elem)->hash;
+}
+
+static bool
+builtin_entry_less(const struct hash_elem *a, const struct hash_elem *b, void *aux)
+{
+    struct builtin_entry *ba = hash_entry(a, struct builtin_entry, elem);
+    struct builtin_entry *bb = hash_entry(b, struct builtin_entry, elem);
+    if (ba->hash != bb->hash)
+        return ba->hash < bb->hash;
+    return strcmp(ba->name, bb->name) < 0;
+}
+
+static struct builtin_entry *
+builtin_entry_find(const char *name)
+{
+    if (!builtins_ready)
+        return NULL;
+
+    struct builtin_entry key = { .name = (char *) name, .hash = hash_string(name) };
+    struct hash_elem *e = hash_find(&builtins, &key.elem);
+    return e ? hash_entry(e, struct builtin_entry, elem) : NULL;
+}
+
+/* Register 'func' as the handler for command 'name' */
+void
+esh_builtin_register(const char *name, esh_builtin_func func, void *aux)
+{
+    if (!builtins_ready) {
+        hash_init(&builtins, builtin_entry_hash, builtin_entry_less, NULL);
+        builtins_ready = true;
+    }
+
+    struct builtin_entry *b = builtin_entry_find(name);
+    if (b == NULL) {
+        b = malloc(sizeof *b);
+        if (b == NULL)
+            return;
+        b->name = strdup(name);
+        b->hash = hash_string(name);
+        hash_insert(&builtins, &b->elem);
+        generation++;
+    }
+    b->func = func;
+    b->aux = aux;
+}
+
+/* Remove the handler for 'name', if any */
+void
+esh_builtin_unregister(const char *name)
+{
+    struct builtin_entry *b = builtin_entry_find(name);
+    if (b == NULL)
+        return;
+
+    hash_delete(&builtins, &b->elem);
+    free(b->name);
+    free(b);
+    generation++;
+}
+
+/* True if 'name' is a registered builtin */
+bool
+esh_builtin_exists(const char *name)
+{
+    return builtin_entry_find(name) != NULL;
+}
+
+/* The registered names */
+const char **
+esh_builtin_names(void)
+{
+    size_t n = 0;
+    const char **names = malloc(((builtins_ready ? hash_size(&builtins) : 0) + 1) * sizeof *names);
+    if (builtins_ready) {
+        struct hash_iterator i;
+        hash_first(&i, &builtins);
+        while (hash_next(&i))
+            names[n++] = hash_entry(hash_cur(&i), struct builtin_entry, elem)->name;
+    }
+    names[n] = NULL;
+    return names;
+}
+
+/* A number that changes whenever a name is added or removed */
+unsigned
+esh_builtin_generation(void)
+{
+    return generation;
+}
+
+/* Run 'cmd' if argv[0] is a registered builtin */
+bool
+esh_builtin_run(struct esh_command *cmd)
+{
+    struct builtin_entry *b = builtin_entry_find(cmd->argv[0]);
+    return b && b->func(cmd, b->aux);
+}
@@ -0,0 +1,43 @@
+#ifndef __ESH_UTILS_BUILTIN_H
+#define __ESH_UTILS_BUILTIN_H
+
+/*
+ * Builtin command registry.
+ *
+ * Maps a command name to the function that runs it, so dispatching a
+ * command costs one hash lookup however many builtins and plugins
+ * there are.  The shell registers its own builtins at startup; the
+ * plugin loader registers the names plugins declare in
+ * 'builtin_names'.  A later registration of a name replaces an
+ * earlier one, so plugins can override shell builtins.
+ */
+#include <stdbool.h>
+
+struct esh_command;
+
+/* Run builtin 'cmd'.  'aux' is the value given at registration.
+ * Returns false if the handler declined the command after all, in
+ * which case it is run as a program. */
+typedef bool (* esh_builtin_func)(struct esh_command *cmd, void *aux);
+
+/* Register 'func' as the handler for command 'name' */
+void esh_builtin_register(const char *name, esh_builtin_func func, void *aux);
+
+/* Remove the handler for 'name', if any */
+void esh_builtin_unregister(const char *name);
+
+/* True if 'name' is a registered builtin */
+bool esh_builtin_exists(const char *name);
+
+/* The registered names, in a malloc'd NULL-terminated array whose
+ * strings belong to the registry */
+const char ** esh_builtin_names(void);
+
+/* A number that changes whenever a name is added or removed */
+unsigned esh_builtin_generation(void);
+
+/* Run 'cmd' if argv[0] is a registered builtin.
+ * Returns true if it was handled. */
+bool esh_builtin_run(struct esh_command *cmd);
+
+#endif //__ESH_UTILS_BUILTIN_H
@@ -0,0 +1,241 @@
+/*
+ * esh-utils-complete.c
+ * Command name completion.  See esh-utils-complete.h.
+ */
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <readline/readline.h>
+
+#include "esh.h"
+#include "esh-utils-builtin.h"
+#include "esh-utils-complete.h"
+#include "esh-utils-path.h"
+
+/* The executables in a directory on PATH */
+struct listing {
+    char **names;               /* NULL until read */
+    size_t nnames;
+};
+
+static struct esh_path_dirs path;
+static struct listing *listings;    /* one per directory of 'path' */
+static int nlistings;
+
+static char **builtins;         /* copies of the registered names */
+static unsigned builtins_generation;
+
+/* Every command, sorted, without duplicates.  The names belong to
+ * 'listings' and 'builtins'. */
+static const char **commands;
+static size_t ncommands;
+static bool commands_ready;
+
+static void
+free_names(char **names, size_t n)
+{
+    size_t i;
+    for (i = 0; i < n; i++)
+        free(names[i]);
+    free(names);
+}
+
+/* Read the executables of directory 'd' into 'l' */
+static void
+list_dir(const struct esh_path_dir *d, struct listing *l)
+{
+    free_names(l->names, l->nnames);
+    l->names = NULL;
+    l->nnames = 0;
+
+    DIR *dir = d->exists ? opendir(d->name) : NULL;
+    if (dir == NULL)
+        return;
+
+    size_t capacity = 0;
+    struct dirent *e;
+    while ((e = readdir(dir)) != NULL) {
+        struct stat st;
+        if (e->d_name[0] == '.' && (e->d_name[1] == '\0' || strcmp(e->d_name, "..") == 0))
+            continue;
+        if (fstatat(dirfd(dir), e->d_name, &st, 0) != 0 || !S_ISREG(st.st_mode)
+                || faccessat(dirfd(dir), e->d_name, X_OK, 0) != 0)
+            continue;
+        if (l->nnames == capacity) {
+            capacity = capacity ? 2 * capacity : 64;
+            l->names = realloc(l->names, capacity * sizeof *l->names);
+        }
+        l->names[l->nnames++] = strdup(e->d_name);
+    }
+    closedir(dir);
+}
+
+/* Split PATH again if it changed, with a listing to be read for
+ * each directory.  Returns true if it did. */
+static bool
+sync_path(void)
+{
+    if (!esh_path_dirs_sync(&path))
+        return false;
+
+    int i;
+    for (i = 0; i < nlistings; i++)
+        free_names(listings[i].names, listings[i].nnames);
+    free(listings);
+    listings = calloc(path.count, sizeof *listings);
+    nlistings = path.count;
+    return true;
+}
+
+/* Read directory 'i' again if it changed, or was not read yet.
+ * Returns true if it did. */
+static bool
+revalidate_dir(int i)
+{
+    struct listing *l = &listings[i];
+    if (!esh_path_dir_changed(&path.dirs[i]) && l->names)
+        return false;
+
+    list_dir(&path.dirs[i], l);
+    if (l->names == NULL)
+        l->names = malloc(sizeof *l->names);    /* read, and empty */
+    return true;
+}
+
+/* Copy the builtin names if the registry changed.
+ * Returns true if it did. */
+static bool
+sync_builtins(void)
+{
+    if (builtins && builtins_generation == esh_builtin_generation())
+        return false;
+
+    char **n;
+    for (n = builtins; n && *n; n++)
+        free(*n);
+    free(builtins);
+
+    const char **names = esh_builtin_names();
+    size_t count = 0, i;
+    while (names[count])
+        count++;
+    builtins = malloc((count + 1) * sizeof *builtins);
+    for (i = 0; i <= count; i++)
+        builtins[i] = names[i] ? strdup(names[i]) : NULL;
+    free(names);
+    builtins_generation = esh_builtin_generation();
+    return true;
+}
+
+static int
+compare_names(const void *a, const void *b)
+{
+    return strcmp(*(const char * const *) a, *(const char * const *) b);
+}
+
+/* Rebuild 'commands' from the directories and builtins */
+static void
+build_commands(void)
+{
+    size_t n = 0;
+    int i;
+    char **b;
+    for (i = 0; i < nlistings; i++)
+        n += listings[i].nnames;
+    for (b = builtins; *b; b++)
+        n++;
+
+    free(commands);
+    commands = malloc((n + 1) * sizeof *commands);
+    ncommands = 0;
+    for (i = 0; i < nlistings; i++) {
+        memcpy(commands + ncommands, listings[i].names, listings[i].nnames * sizeof *commands);
+        ncommands += listings[i].nnames;
+    }
+    for (b = builtins; *b; b++)
+        commands[ncommands++] = *b;
+
+    qsort(commands, ncommands, sizeof *commands, compare_names);
+    size_t k, distinct = 0;
+    for (k = 0; k < ncommands; k++)
+        if (distinct == 0 || strcmp(commands[distinct - 1], commands[k]) != 0)
+            commands[distinct++] = commands[k];
+    ncommands = distinct;
+}
+
+/* The commands starting with 'prefix' */
+size_t
+esh_complete_commands(const char *prefix, const char * const **first)
+{
+    bool changed = sync_path();
+    int i;
+    for (i = 0; i < nlistings; i++)
+        changed |= revalidate_dir(i);
+    changed |= sync_builtins();
+    if (changed || !commands_ready) {
+        build_commands();
+        commands_ready = true;
+    }
+
+    // The first name not before 'prefix', then those it starts
+    size_t len = strlen(prefix), lo = 0, hi = ncommands;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (strcmp(commands[mid], prefix) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    size_t end = lo;
+    while (end < ncommands && strncmp(commands[end], prefix, len) == 0)
+        end++;
+
+    *first = commands + lo;
+    return end - lo;
+}
+
+/* --- LINE EDITING --- */
+
+static char *
+command_generator(const char *text, int state)
+{
+    static const char * const *first;
+    static size_t count, next;
+
+    if (state == 0) {
+        count = esh_complete_commands(text, &first);
+        next = 0;
+    }
+    return next < count ? strdup(first[next++]) : NULL;
+}
+
+/* Is the word at 'start' in the line a command name? */
+static bool
+command_position(int start)
+{
+    int i = start - 1;
+    while (i >= 0 && (rl_line_buffer[i] == ' ' || rl_line_buffer[i] == '\t'))
+        i--;
+    return i < 0 || strchr("|;&(", rl_line_buffer[i]) != NULL;
+}
+
+/* Commands in command position; NULL lets readline complete files */
+static char **
+complete(const char *text, int start, int end)
+{
+    if (strchr(text, '/') || !command_position(start))
+        return NULL;
+    return rl_completion_matches(text, command_generator);
+}
+
+/* Make the line editor complete command names */
+void
+esh_complete_bind(void)
+{
+    rl_attempted_completion_function = complete;
+}
@@ -0,0 +1,31 @@
+#ifndef __ESH_UTILS_COMPLETE_H
+#define __ESH_UTILS_COMPLETE_H
+
+/*
+ * Command name completion.
+ *
+ * The commands are kept in one sorted array of names: the executables
+ * in the PATH directories and the names in the builtin registry,
+ * which includes those plugins declare.  Completing a prefix is a
+ * binary search in it.  Each directory's listing is read again only
+ * when the directory's mtime changes; PATH is split and the mtimes
+ * are checked by the code the 'hash' cache uses (esh-utils-path.h).
+ * The array is rebuilt when a listing, PATH or the set of builtins
+ * changes.
+ *
+ * esh_complete_bind() has the line editor complete command names in
+ * command position: the first word, and the first after '|', ';',
+ * '&' or '('.  Other words, and words with a '/', are completed as
+ * file names, as before.
+ */
+#include <stddef.h>
+
+/* The commands starting with 'prefix'.  *first is set to the first
+ * of them, in sorted order; returns how many there are.  The names
+ * are valid until the next call. */
+size_t esh_complete_commands(const char *prefix, const char * const **first);
+
+/* Make the line editor complete command names */
+void esh_complete_bind(void);
+
+#endif //__ESH_UTILS_COMPLETE_H
@@ -0,0 +1,245 @@
+/*
+ * esh-utils-filter.c
+ * In-process stream filters.  See esh-utils-filter.h.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include "esh.h"
+#include "hash.h"
+#include "esh-sys-utils.h"
+#include "esh-utils-filter.h"
+
+/* --- REGISTRY --- */
+
+/* A registered filter */
+struct filter_entry {
+    struct hash_elem elem;      /* Link element for 'filters' */
+    char *name;
+    unsigned hash;              /* hash_string(name) */
+    esh_filter_resolver resolve;
+    void *aux;
+};
+
+static struct hash filters;
+static bool filters_ready;
+
+static unsigned
+filter_entry_hash(const struct hash_elem *e, void *aux)
+{
+    return hash_entry(e, struct filter_entry, elem)->hash;
+}
+
+static bool
+filter_entry_less(const struct hash_elem *a, const struct hash_elem *b, void *aux)
+{
+    struct filter_entry *fa = hash_entry(a, struct filter_entry, elem);
+    struct filter_entry *fb = hash_entry(b, struct filter_entry, elem);
+    if (fa->hash != fb->hash)
+        return fa->hash < fb->hash;
+    return strcmp(fa->name, fb->name) < 0;
+}
+
+static struct filter_entry *
+filter_entry_find(const char *name)
+{
+    if (!filters_ready)
+        return NULL;
+
+    struct filter_entry key = { .name = (char *) name, .hash = hash_string(name) };
+    struct hash_elem *e = hash_find(&filters, &key.elem);
+    return e ? hash_entry(e, struct filter_entry, elem) : NULL;
+}
+
+/* Register filter 'name' */
+void
+esh_filter_register(const char *name, esh_filter_resolver resolve, void *aux)
+{
+    if (!filters_ready) {
+        hash_init(&filters, filter_entry_hash, filter_entry_less, NULL);
+        filters_ready = true;
+    }
+
+    struct filter_entry *f = filter_entry_find(name);
+    if (f == NULL) {
+        f = malloc(sizeof *f);
+        if (f == NULL)
+            return;
+        f->name = strdup(name);
+        f->hash = hash_string(name);
+        hash_insert(&filters, &f->elem);
+    }
+    f->resolve = resolve;
+    f->aux = aux;
+}
+
+/* Remove filter 'name', if registered */
+void
+esh_filter_unregister(const char *name)
+{
+    struct filter_entry *f = filter_entry_find(name);
+    if (f == NULL)
+        return;
+
+    hash_delete(&filters, &f->elem);
+    free(f->name);
+    free(f);
+}
+
+/* True if 'name' is a registered filter */
+bool
+esh_filter_exists(const char *name)
+{
+    return filter_entry_find(name) != NULL;
+}
+
+/* --- RUNNING --- */
+
+/* A filter stage running on a thread.  Only 'status', 'usage' and
+ * 'done' are written by the thread; everything else belongs to the
+ * main thread. */
+struct filter_run {
+    struct list_elem elem;      /* Link element for 'runs' */
+    pthread_t thread;
+    struct esh_command *cmd;
+    esh_filter_func func;
+    int in_fd, out_fd;
+    bool last;
+    int status;                 /* exit status returned by the filter */
+    struct rusage usage;        /* the thread's, once the filter returned */
+    bool done;                  /* set, atomically, after 'status' */
+};
+
+static struct list runs = { { NULL, &runs.tail }, { &runs.head, NULL } };
+
+static void *
+filter_thread(void *arg)
+{
+    struct filter_run *run = arg;
+
+    // A reader that goes away must show up as EPIPE, not kill the shell.
+    // The SIGPIPE stays pending on this thread and ends with it.
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &mask, NULL);
+
+    run->status = run->func(run->in_fd, run->out_fd, run->cmd->argv);
+    close(run->in_fd);
+    close(run->out_fd);
+    getrusage(RUSAGE_THREAD, &run->usage);
+
+    __atomic_store_n(&run->done, true, __ATOMIC_RELEASE);
+    kill(getpid(), SIGCHLD);
+    return NULL;
+}
+
+/* The descriptor the filter reads from or writes to: the redirection
+ * 'file' if any, else 'fd' or, if -1, the shell's 'std_fd' */
+static int
+stage_fd(const char *file, int flags, int fd, int std_fd)
+{
+    if (file)
+        return open(file, flags | O_CLOEXEC, 0666);
+    return fcntl(fd == -1 ? std_fd : fd, F_DUPFD_CLOEXEC, 0);
+}
+
+/* Start 'cmd', whose argv[0] is a filter, on a thread */
+bool
+esh_filter_start(struct esh_command *cmd, int in_fd, int out_fd, bool last)
+{
+    struct filter_entry *f = filter_entry_find(cmd->argv[0]);
+    esh_filter_func func = f ? f->resolve(f->name, f->aux) : NULL;
+    if (func == NULL) {
+        fprintf(stderr, "esh: %s: filter not available\n", cmd->argv[0]);
+        return false;
+    }
+
+    struct filter_run *run = calloc(1, sizeof *run);
+    if (run == NULL)
+        return false;
+    run->cmd = cmd;
+    run->func = func;
+    run->last = last;
+
+    run->in_fd = stage_fd(cmd->iored_input, O_RDONLY, in_fd, STDIN_FILENO);
+    if (run->in_fd < 0) {
+        esh_sys_error("esh: %s: ", cmd->iored_input ? cmd->iored_input : "stdin");
+        free(run);
+        return false;
+    }
+
+    int flags = O_CREAT | O_WRONLY | (cmd->append_to_output ? O_APPEND : O_TRUNC);
+    run->out_fd = stage_fd(cmd->iored_output, flags, out_fd, STDOUT_FILENO);
+    if (run->out_fd < 0) {
+        esh_sys_error("esh: %s: ", cmd->iored_output ? cmd->iored_output : "stdout");
+        close(run->in_fd);
+        free(run);
+        return false;
+    }
+
+    int rc = pthread_create(&run->thread, NULL, filter_thread, run);
+    if (rc != 0) {
+        fprintf(stderr, "esh: %s: %s\n", cmd->argv[0], strerror(rc));
+        close(run->in_fd);
+        close(run->out_fd);
+        free(run);
+        return false;
+    }
+    list_push_back(&runs, &run->elem);
+    return true;
+}
+
+/* True if a filter stage running 'func' has not returned yet */
+bool
+esh_filter_running(esh_filter_func func)
+{
+    struct list_elem *e;
+    for (e = list_begin(&runs); e != list_end(&runs); e = list_next(e)) {
+        struct filter_run *run = list_entry(e, struct filter_run, elem);
+        if (run->func == func && !__atomic_load_n(&run->done, __ATOMIC_ACQUIRE))
+            return true;
+    }
+    return false;
+}
+
+/* Return a finished filter stage of 'job', or of any job */
+struct esh_command *
+esh_filter_reap(struct esh_pipeline *job, bool block, int *status, bool *last,
+                struct rusage *usage)
+{
+    struct filter_run *found = NULL;
+    struct list_elem *e;
+    for (e = list_begin(&runs); e != list_end(&runs); e = list_next(e)) {
+        struct filter_run *run = list_entry(e, struct filter_run, elem);
+        if (job && run->cmd->pipeline != job)
+            continue;
+        if (__atomic_load_n(&run->done, __ATOMIC_ACQUIRE)) {
+            found = run;
+            break;
+        }
+        if (block && found == NULL)
+            found = run;
+    }
+    if (found == NULL)
+        return NULL;
+
+    pthread_join(found->thread, NULL);
+    list_remove(&found->elem);
+
+    struct esh_command *cmd = found->cmd;
+    *status = W_EXITCODE(found->status & 0xff, 0);
+    *last = found->last;
+    *usage = found->usage;
+    free(found);
+    return cmd;
+}
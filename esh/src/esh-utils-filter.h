@@ -0,0 +1,60 @@
+#ifndef __ESH_UTILS_FILTER_H
+#define __ESH_UTILS_FILTER_H
+
+/*
+ * In-process stream filters.
+ *
+ * Plugins declare filters in 'filter_names' and implement them in
+ * 'run_filter' (see esh.h).  A pipeline stage naming a filter is not
+ * forked: it runs on a thread of the shell, reading and writing the
+ * stage's pipe ends directly.  Such a stage has no process, so its
+ * command's pid is 0; signals sent to a job only reach its other
+ * stages.
+ *
+ * When a filter returns, its thread raises SIGCHLD at the shell, so
+ * finished filters are noticed wherever finished children are, and
+ * esh_filter_reap() hands them over like waitpid() would.
+ */
+#include <stdbool.h>
+#include <sys/resource.h>
+
+struct esh_command;
+struct esh_pipeline;
+
+/* A filter, see run_filter in struct esh_plugin */
+typedef int (* esh_filter_func)(int in_fd, int out_fd, char **argv);
+
+/* Called, in the shell's main thread, when filter 'name' is about to
+ * run.  Returns its function, or NULL if it is not available after all.
+ * 'aux' is the value given at registration. */
+typedef esh_filter_func (* esh_filter_resolver)(const char *name, void *aux);
+
+/* Register filter 'name' */
+void esh_filter_register(const char *name, esh_filter_resolver resolve, void *aux);
+
+/* Remove filter 'name', if registered */
+void esh_filter_unregister(const char *name);
+
+/* True if 'name' is a registered filter */
+bool esh_filter_exists(const char *name);
+
+/* Start 'cmd', whose argv[0] is a filter, on a thread.
+ * 'in_fd' and 'out_fd' are as for esh_spawn_command; they and the
+ * command's redirections are duplicated for the thread, so the caller
+ * keeps its descriptors.  'last' says whether this is the last stage
+ * of its pipeline.  Returns false if the filter could not be started. */
+bool esh_filter_start(struct esh_command *cmd, int in_fd, int out_fd, bool last);
+
+/* True if a filter stage running 'func' has not returned yet */
+bool esh_filter_running(esh_filter_func func);
+
+/* Return a filter stage of 'job', or of any job if 'job' is NULL,
+ * that has finished, after joining its thread.  *status is set to a
+ * waitpid(2)-style status, *last to whether it was the last stage and
+ * *usage to what its thread used.
+ * If 'block', waits for one of the job's filters to finish.
+ * Returns NULL if there is none. */
+struct esh_command * esh_filter_reap(struct esh_pipeline *job, bool block,
+                                     int *status, bool *last, struct rusage *usage);
+
+#endif //__ESH_UTILS_FILTER_H
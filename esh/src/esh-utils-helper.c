@@ -1,590 +1,1062 @@
-/*
- * esh-utils.c
- * A set of utility routines to manage esh objects.
- *
- * Developed by Godmar Back for CS 3214 Fall 2009
- * Virginia Tech.
- *
- * credit: Definitions of functions and implementations are excerpt from https://www.gnu.org/
- */
-#include <assert.h>
-#include <stdio.h>
-#include <sys/types.h>
-#include <dirent.h>
-#include <dlfcn.h>
-#include <limits.h>
-#include <unistd.h>
-#include <sys/wait.h>
-#include <sys/stat.h>
-#include <fcntl.h>
-
-#include "esh.h"
-#include "esh-utils-helper.h"
-#include "esh-sys-utils.h"
-#include "esh-utils-jobs.h"
-
-
-#ifdef __clang__
-#pragma clang diagnostic push
-#pragma clang diagnostic ignored "-Wunused-const-variable"
-#endif
-static const char rcsid [] = "$Id: esh-utils.c,v 1.5 2011/03/29 15:46:28 cs3214 Exp $";
-#ifdef __clang__
-#pragma clang diagnostic pop
-#endif
-
-//#define DEBUG 0
-//#define DEBUG_JOBS
-//#define DEBUG_PIPE
-//#define DEBUG_PID
-//#define DEBUG_SIGNAL 0
-
-/**
- * Assign ownership of the terminal to process group
- * pgid, restoring its terminal state if provided.
- *
- * Before printing a new prompt, the shell should
- * invoke this function with its own process group
- * id (obtained on startup via getpgrp()) and a
- * same terminal state (obtained on startup via
- * esh_sys_tty_init()).
- */
-static void
-give_terminal_to(pid_t pgid, struct termios *pg_tty_state)
-{
-    #ifdef DEBUG
-        printf("\nIn give_terminal_to");
-    #endif
-    
-    esh_signal_block(SIGTTOU);
-    int rc = tcsetpgrp(esh_sys_tty_getfd(), pgid);
-    if (rc == -1)
-        esh_sys_fatal_error("tcsetpgrp: ");
-
-    if (pg_tty_state)
-        esh_sys_tty_restore(pg_tty_state);
-    esh_signal_unblock(SIGTTOU);
-    
-    #ifdef DEBUG
-        printf("\nDone give_terminal_to\n\n");
-    #endif
-}
-
-/* 
- *
- */
-static void
-child_status_change(pid_t child_pid, int status) {
-    #ifdef DEBUG
-        printf("In child_status_change\n");
-    #endif 
-    
-    if (child_pid < 0) {
-        esh_sys_fatal_error("Error: Child PID not yet assigned");
-    }
-    
-    struct list_elem * list_elem_job_list;
-    for (list_elem_job_list = list_begin(&jobs_list); list_elem_job_list != list_end(&jobs_list); list_elem_job_list = list_next(list_elem_job_list)) {
-        struct esh_pipeline * pipeline = list_entry(list_elem_job_list, struct esh_pipeline, elem);
-        struct list_elem * list_elem_commands;
-        
-        pid_t comp = pipeline -> pgid;
-        bool is_multi = false;
-        if (list_size(&pipeline -> commands) > 2) {
-            is_multi = true;
-        }
-        for (list_elem_commands = list_begin(&pipeline -> commands); list_elem_commands != list_end(&pipeline -> commands); list_elem_commands = list_next(list_elem_commands)) {
-            if (is_multi) {
-                struct esh_command * command = list_entry(list_elem_commands, struct esh_command, elem);
-                comp = command -> pid;
-            }
-            
-            if (comp == child_pid) {
-                 // Stopped by Ctrl + Z
-                if (WIFSTOPPED(status)) {
-                    #ifdef DEBUG_SIGNAL
-                        printf("Signal: Processed is interrupted and is Stopped\n");
-                    #endif
-                    pipeline -> status = STOPPED;
-                    esh_sys_tty_save(&pipeline -> saved_tty_state);
-                    size_t size_i = 0;
-                    size_t pipeline_size = list_size (&pipeline -> commands);
-                    for (; size_i < pipeline_size; size_i++) {
-                        printf("[%d]  Stopped        ", pipeline -> jid);
-                        print_job(pipeline);
-                    }
-                    give_terminal_to(getpgrp(), terminal);                    
-                }
-                else if (WIFCONTINUED(status)) {
-                    #ifdef DEBUG_SIGNAL
-                        printf("Signal: Processed is Continued\n");
-                    #endif
-                }
-                // KILLED by kill command [TERMINATED]
-                else if (WTERMSIG(status)) {
-                    #ifdef DEBUG_SIGNAL
-                        printf("Signal: Processed is interrupted and is terminated\n");
-                    #endif
-                    pipeline -> status = TERMINATED;
-                    list_remove(list_elem_commands);
-                    give_terminal_to(getpgrp(), terminal);
-                }
-                // Exited normally [DONE]
-                else if (WIFEXITED(status)) {
-                    #ifdef DEBUG_SIGNAL
-                        printf("Signal: Process is terminated normally\n");
-                    #endif
-                    pipeline -> status = DONE;
-                    list_remove(list_elem_commands);
-                }
-            }
-            
-            if (list_empty(&pipeline -> commands)) {
-                list_remove(list_elem_job_list);
-            }
-        }
-    }
-    #ifdef DEBUG
-        printf("Done child_status_change\n");
-    #endif 
- }
- 
- /*
- * SIGCHLD handler.
- * Call waitpid() to learn about any child processes that
- * have exited or changed status (been stopped, needed the
- * terminal, etc.)
- * Just record the information by updating the job list
- * data structures.  Since the call may be spurious (e.g.
- * an already pending SIGCHLD is delivered even though
- * a foreground process was already reaped), ignore when
- * waitpid returns -1.
- * Use a loop with WNOHANG since only a single SIGCHLD 
- * signal may be delivered for multiple children that have 
- * exited.
- */
-static void
-sigchld_handler(int sig, siginfo_t *info, void *_ctxt)
-{
-    #ifdef DEBUG
-        printf("In sigchld_handler\n");
-    #endif
-    pid_t child;
-    int status;
-    assert(sig == SIGCHLD);
-    while ((child = waitpid(-1, &status, WUNTRACED|WNOHANG)) > 0) {
-        child_status_change(child, status);
-    }
-    #ifdef DEBUG
-        printf("Done sigchld_handler\n");
-    #endif
-}
- 
-/* 
- * Wait for all processes in this pipeline to complete, or for
- * the pipeline's process group to no longer be the foreground 
- * process group. 
- * You should call this function from a) where you wait for
- * jobs started without the &; and b) where you implement the
- * 'fg' command.
- * 
- * Implement child_status_change such that it records the 
- * information obtained from waitpid() for pid 'child.'
- * If a child has exited or terminated (but not stopped!)
- * it should be removed from the list of commands of its
- * pipeline data structure so that an empty list is obtained
- * if all processes that are part of a pipeline have 
- * terminated.  If you use a different approach to keep
- * track of commands, adjust the code accordingly.
- */
-static void 
-wait_for_job(struct esh_pipeline * pipeline)
-{
-    #ifdef DEBUG
-        printf("\nIn wait_for_job\n");
-    #endif 
-    
-    assert(esh_signal_is_blocked(SIGCHLD));
-
-    while (pipeline -> status == FOREGROUND && !list_empty(&pipeline->commands)) {
-        int status;
-
-        pid_t child_pid = waitpid(-1, &status, WUNTRACED);
-        if (child_pid != -1) {
-            //give_terminal_to(getpgrp(), terminal);
-            child_status_change(child_pid, status);
-        }
-    }
-    #ifdef DEBUG
-        printf("\nDone wait_for_job\n\n");
-    #endif
-}
-
-static bool
-is_esh_command_built_in(struct esh_command * esh_cmd, struct esh_pipeline * pipeline, struct esh_command_line *cmdline) {
-    
-    char * built_in[] = {"jobs", "fg", "bg", "kill", "stop", "exit", NULL};
-    int i = 0;
-    char * cmd = NULL;
-    bool is_built_in = true;        // Initialize is_built_in                                    
-    
-    char * command = esh_cmd -> argv[0];
-    while (built_in[i]) {
-        if (strcmp(built_in[i], command) == 0) {
-            cmd = built_in[i];
-            break;
-        }
-        i++;
-    }
-    
-    if (cmd == NULL) {
-        return false;
-    }
-    else if (strcmp(cmd, "jobs") == 0) {
-        esh_command_jobs(cmdline);
-    }
-    else if (strcmp(cmd, "exit") == 0) {
-        #ifdef DEBUG
-            printf("Exiting\n");
-        #endif
-        list_pop_front(&cmdline -> pipes);
-        exit(0);
-    }
-    else {
-        
-        // Argument for the command
-        char * char_jid;
-        int jid;
-        if ((char_jid = esh_cmd -> argv[1]) != NULL) {
-            jid = atoi(char_jid);
-        }
-        else {
-            jid = job_id;
-        }
-        
-        struct esh_pipeline * found_job = find_job(jid);
-        
-        if (strcmp(cmd, "fg") == 0) {
-            if (found_job != NULL) {
-                esh_signal_block(SIGCHLD);                              // 1. Block the signal
-                found_job -> status = FOREGROUND;                       // 2. Set the status = FOREGROUND
-                give_terminal_to(found_job -> pgid, terminal);          // 3. Give terminal access to the found_job
-                if(kill(-found_job -> pgid, SIGCONT) < 0) {             // 4. Send SIGCONT signal to continue the process
-                    esh_sys_fatal_error("Error ['fg']: SIGCONT");
-                }
-                
-                print_job(found_job);
-                wait_for_job(found_job);                                // 5. Wait for the job to terminate
-                give_terminal_to(shell_pid, terminal);                  // 6. Terminal Back to Shell
-                
-                esh_signal_unblock(SIGCHLD);                            // 7. Unblock signal
-            }
-            else {
-                printf("esh:    fg: current: no such job\n");
-            }
-        }
-        else if (strcmp(cmd, "bg") == 0) {
-            if (found_job != NULL) {
-                found_job -> status = BACKGROUND;                       // Similar to fg but without giving terminal access and waiting for job                          
-                if (kill(-found_job -> pgid, SIGCONT) < 0) {            // Send SIGCONT signal to continue the process from STOPPED
-                    esh_sys_fatal_error("Error ['bg']: SIGCONT");
-                }
-            }
-            else {
-                printf("esh:    bg: current: no such job\n");
-            }
-        }
-        else if (strcmp(cmd, "kill") == 0) {
-            if (found_job != NULL) {
-                if (kill(-found_job -> pgid, SIGKILL) < 0) {
-                    esh_sys_fatal_error("Error ['kill']: SIGKILL");
-                }
-            }
-            else {
-                printf("esh:    kill: current: no such job\n");
-            }
-        }
-        else if (strcmp(cmd, "stop") == 0) {
-            if (found_job != NULL) {
-                if (kill(-found_job -> pgid, SIGSTOP) < 0) {
-                    esh_sys_fatal_error("Error ['stop']: SIGSTOP");
-                }
-            }
-            else {
-                printf("esh:    stop: current: no such job\n");
-            }
-        }
-        list_pop_front(&cmdline -> pipes);
-    }
-    
-    return is_built_in;
-}
-
-/* --------- CMD --------- */
-/* Print esh_command structure to stdout */
-// i.e. : 1.    Command: ls
-// In the Child Process
-// 
-void
-esh_command_helper(struct esh_command * cmd, struct esh_pipeline * pipeline)
-{
-    // --------- Setting PID and PGID ------------- //
-    pid_t child_pid = getpid();           // Child pid
-    cmd -> pid = child_pid;               // Each process PID = getpid();
-    
-    #ifdef DEBUG_PID
-        printf("Child PID is: [%d]\n", cmd -> pid);
-        printf("PGID is: [%d]\n",      pipeline -> pgid);
-    #endif
-    if (pipeline -> pgid == -1) {
-        pipeline -> pgid = child_pid;
-    }
-    
-    if (setpgid(child_pid, pipeline -> pgid) < 0) {
-        esh_sys_fatal_error("Error [Parent]: Cannot set pgid\n");
-    }
-
-    // --------- Foreground and Background -------- //
-    if (pipeline -> bg_job) {        
-        pipeline -> status = BACKGROUND;
-    }
-    else {        
-        pipeline -> status = FOREGROUND;
-        give_terminal_to(pipeline -> pgid, terminal);
-    }
-    
-    
-    // ---------- Input and Output ----------- //
-    //  O_RDONLY:   Read-Only
-    //  O_WRONLY:   Write-Only
-    //  O_RDWR:     Read/Write
-    //  O_APPEND:   Append mode
-    //  O_CREAT:    If file does not exits, it will be created
-    //  O_TRUNC:    If the file already exists and is a regular file and the
-    //              access mode allows writing (i.e., is O_RDWR or O_WRONLY) it
-    //              will be truncated to length 0.
-    
-    if (cmd -> iored_output) {
-        // Symbol (>)
-       // printf("  stdout %ss to %s\n", 
-       // cmd -> append_to_output ? "append" : "write",
-       // cmd -> iored_output);
-       
-       int out;
-       //FILE* file;
-       // credit: http://www.cs.loyola.edu/~jglenn/702/S2005/Examples/dup2.html
-       if (cmd -> append_to_output) {
-           // file = fopen(cmd->iored_output, "a");
-           // out = fileno(file);
-           out = open(cmd -> iored_output, 
-                      O_APPEND | O_CREAT | O_WRONLY, 
-                      0666);
-       }
-       else {
-           // file = fopen(cmd->iored_output, "wb");
-           // out = fileno(file);
-           out = open(cmd -> iored_output, 
-                      O_TRUNC | O_CREAT | O_WRONLY, 
-                      0666);
-       }
-       
-       if (dup2(out, STDOUT_FILENO) < 0) {                          // replace standard output with output file
-            esh_sys_fatal_error("Error: dup2(out, STDOUT_FILENO)");
-       }
-       //fclose(file);
-       close(out);
-    }
-
-    // credit: http://www.cs.loyola.edu/~jglenn/702/S2005/Examples/dup2.html
-    if (cmd -> iored_input) {
-        // Symbol (< or <<)
-        //printf("  stdin reads from %s\n", cmd->iored_input);
-        
-        
-        int in = open(cmd -> iored_input, O_RDONLY);
-        if (dup2(in, STDIN_FILENO) < 0) {                           // replace standard input with input file
-            esh_sys_fatal_error("Error: dup2(in, STDIN_FILENO)");
-        }
-        close(in);
-    }
-    
-    // ------------- Execute Command ------------ //
-    if (execvp(cmd -> argv[0], cmd -> argv) < 0) {
-        esh_sys_fatal_error("execvp error\n");
-    }
-}
-
-/* --------- PIPELINE --------- */ 
-/* Print esh_pipeline structure to stdout */
-void
-esh_pipeline_helper(struct esh_pipeline * pipeline, struct esh_command_line * cmdline)
-{
-    /* ------- INITIALIZATION ---------- */
-        
-    esh_signal_sethandler(SIGCHLD, sigchld_handler);
-    pipeline -> is_piped = (list_size(&pipeline -> commands) > 1) ? true : false;
-    
-    struct list_elem * e = list_begin (&pipeline -> commands);
-    struct esh_command * esh_cmd = list_entry(e, struct esh_command, elem);
-    
-    /* -------- PLUG_IN ---------- */    
-    struct list_elem * e_plug = list_begin(&esh_plugin_list);
-    bool is_invalid_command = true;
-    for (; e_plug != list_end(&esh_plugin_list); e_plug = list_next(e_plug)) {
-        struct esh_plugin * plugin = list_entry(e_plug, struct esh_plugin, elem);
-        //if the command is a plugin then process
-        is_plugin = true;
-        if(plugin -> process_builtin == NULL) {
-            if (is_invalid_command) {
-                printf("\tInvalid command\n");
-            }
-            else {
-                is_invalid_command = true;
-            }
-            continue;
-        }
-        
-        if(plugin -> process_builtin(esh_cmd)) {
-            is_invalid_command = false;
-            continue;
-        }
-    }
-    
-    // Iterates through the command separated by "|"
-    if (!is_plugin && !is_esh_command_built_in(esh_cmd, pipeline, cmdline)) {
-        
-        int command_i = 0;
-        /* ------------- JOB HANDLING --------------- */
-        job_id++;
-        // Handling Job_Id for pipelines
-        if (list_empty(&jobs_list)) {
-            job_id = 1;
-        }
-        
-        /* ------------- PID, PGID, JID --------------- */
-        // Initialize pipeline pgid
-        pipeline -> jid = job_id;
-        pipeline -> pgid = -1;
-        pid_t pid;
-        
-        /* -------------------- Pipes ----------------- */
-        // Credit: http://www.cs.loyola.edu/~jglenn/702/S2005/Examples/dup2.html
-        //
-        //      0                  1
-        //      R ----- PIPE ----- W
-        //
-        // Example commands with pipes: 
-        //      cat scores | grep Villanova
-        // pipes[0] = [read]    cat-> grep
-        // pipes[1] = [write]   cat-> grep 
-        
-        // Create pipe of size of commands in a pipeline
-        int pipe_1[2], pipe_2[2];
-        
-        for (; e != list_end(&pipeline -> commands); e = list_next (e)) {
-            struct esh_command * command = list_entry(e, struct esh_command, elem);
-            
-            // while the command is not the last command in the pipe
-            // continuously create a new pipe to connect from the first 
-            // pipe to the last pipe
-            if (pipeline -> is_piped && list_next(e) != list_tail(&pipeline -> commands)) {
-                pipe(pipe_2);
-            }
-            
-            // Block Child Process Signal to prevent race running condition
-            esh_signal_block(SIGCHLD);
-            
-            pid = fork();
-            if (pid == 0) {
-                //  In the Child Process
-                
-                // Piping Process
-                if (pipeline -> is_piped) {
-                    if (e != list_begin(&pipeline -> commands)) {
-                        // If the command is the the first command in the pipe
-                        dup2(pipe_1[0], 0);
-                        close(pipe_1[1]);
-                        close(pipe_1[0]);
-                    }
-                    
-                    // While the command is not the last command, you dup2 -> 1, STDOUT
-                    if (list_next(e) != list_tail(&pipeline -> commands)) {
-                        // If the command is the the first command in the pipe
-                        dup2(pipe_2[1], 1);
-                        close(pipe_2[0]);
-                        close(pipe_2[1]);
-                    }
-                }
-                 
-                esh_command_helper(command, pipeline);
-            }
-            else if (pid < 0) {
-                // Fork Failed
-                esh_sys_fatal_error("Fork Error\n");
-            }
-            else {
-                /* --------- PARENT PROCESS ----------- */
-                // --------- Setting PID and PGID ------------- //
-                if (pipeline -> is_piped) {
-                    if (e != list_begin(&pipeline->commands)) {
-                        close(pipe_1[0]);
-                        close(pipe_1[1]);
-                    }
-                    
-                    // While command is not the last command in pipe continue update the pipe so that 
-                    // output of the previous command gets transferred to the input of the next command
-                    if (list_next(e) != list_tail(&pipeline -> commands)) {
-                        pipe_1[0] = pipe_2[0];
-                        pipe_1[1] = pipe_2[1];
-                    }
-                    
-                    if (list_next(e) == list_tail(&pipeline -> commands)) {
-                        close(pipe_1[0]);
-                        close(pipe_1[1]);
-                        close(pipe_2[0]);
-                        close(pipe_2[1]);
-                    }
-                }
-                
-                pipeline -> status = FOREGROUND;
-                esh_cmd -> pid = pid;
-            
-                if (pipeline -> pgid == -1) {
-                    pipeline -> pgid = pid;             // Child PID set to parent PID
-                }
-                
-                if (setpgid(esh_cmd -> pid, pipeline -> pgid) < 0) {
-                    esh_sys_fatal_error("Error [Parent]: Cannot set pgid\n");
-                }
-                
-                command_i++;
-            }
-        }
-
-        if (pipeline -> bg_job) {
-            pipeline -> status = BACKGROUND;
-            printf("[%d] %d\n", pipeline -> jid, pipeline ->pgid);
-        }
-        
-        struct list_elem * elem = list_pop_front(&cmdline -> pipes);
-        list_push_back(&jobs_list, elem);
-        
-        if (!pipeline -> bg_job) {
-            wait_for_job(pipeline);
-        }
-        give_terminal_to(shell_pid, terminal);
-        esh_signal_unblock(SIGCHLD);
-    }
-}
-
-/* --------- CMD LINE --------- */
-/* Print esh_command_line structure to stdout */
-void 
-esh_command_line_helper(struct esh_command_line * cmdline)
-{
-    is_plugin = false;
-    while (!list_empty(&cmdline->pipes) && !is_plugin) {
-        struct esh_pipeline * pipeline = list_entry(list_begin(&cmdline -> pipes), struct esh_pipeline, elem);
-        esh_pipeline_helper(pipeline, cmdline);
-    }
+/*
+ * esh-utils.c
+ * A set of utility routines to manage esh objects.
+ *
+ * Developed by Godmar Back for CS 3214 Fall 2009
+ * Virginia Tech.
+ *
+ * credit: Definitions of functions and implementations are excerpt from https://www.gnu.org/
+ */
+#define _GNU_SOURCE
+#include <assert.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include <dirent.h>
+#include <dlfcn.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/signalfd.h>
+
+#include "esh.h"
+#include "esh-utils-helper.h"
+#include "esh-sys-utils.h"
+#include "esh-utils-jobs.h"
+#include "esh-utils-spawn.h"
+#include "esh-utils-path.h"
+#include "esh-utils-plugin.h"
+#include "esh-utils-builtin.h"
+#include "esh-utils-filter.h"
+#include "esh-utils-simple.h"
+#include "esh-utils-optimize.h"
+#include "esh-utils-slots.h"
+#include "esh-utils-usage.h"
+#include "esh-utils-stats.h"
+#include "esh-utils-history.h"
+#include "arena.h"
+
+
+#ifdef __GNUC__
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-const-variable"
+#endif
+static const char rcsid [] = "$Id: esh-utils.c,v 1.5 2011/03/29 15:46:28 cs3214 Exp $";
+#ifdef __GNUC__
+#pragma GCC diagnostic pop
+#endif
+
+
+//#define DEBUG 0
+//#define DEBUG_JOBS
+//#define DEBUG_PIPE
+//#define DEBUG_PID
+//#define DEBUG_SIGNAL 0
+
+/**
+ * Assign ownership of the terminal to process group
+ * pgid, restoring its terminal state if provided.
+ *
+ * Before printing a new prompt, the shell should
+ * invoke this function with its own process group
+ * id (obtained on startup via getpgrp()) and a
+ * same terminal state (obtained on startup via
+ * esh_sys_tty_init()).
+ */
+static void
+give_terminal_to(pid_t pgid, struct termios *pg_tty_state)
+{
+    #ifdef DEBUG
+        printf("\nIn give_terminal_to");
+    #endif
+    
+    // Without job control, the terminal (if any) is never ours to give
+    if (!esh_interactive)
+        return;
+    
+    esh_signal_block(SIGTTOU);
+    int rc = tcsetpgrp(esh_sys_tty_getfd(), pgid);
+    if (rc == -1)
+        esh_sys_fatal_error("tcsetpgrp: ");
+
+    if (pg_tty_state)
+        esh_sys_tty_restore(pg_tty_state);
+    esh_signal_unblock(SIGTTOU);
+    
+    #ifdef DEBUG
+        printf("\nDone give_terminal_to\n\n");
+    #endif
+}
+
+/* Jobs that have been removed from jobs_list by child_status_change.
+ * Whoever waited for them may still look at them, so their
+ * job-lifetime arenas are released by release_reaped_jobs() before
+ * the next command line runs. */
+static struct list reaped_jobs = { { NULL, &reaped_jobs.tail }, { &reaped_jobs.head, NULL } };
+
+/* Release the memory of reaped jobs */
+static void
+release_reaped_jobs(void)
+{
+    while (!list_empty(&reaped_jobs)) {
+        struct esh_pipeline * job = list_entry(list_pop_front(&reaped_jobs), struct esh_pipeline, elem);
+        esh_pipeline_free(job);
+    }
+}
+
+/* SIGCHLD is blocked in the shell at all times and read from this
+ * signalfd; see esh_sigchld_init() */
+static int sigchld_fd = -1;
+
+/* Notifications about background jobs, batched until the next prompt */
+static char * notify_buf;
+static size_t notify_len;
+static FILE * notify_stream;
+
+/* Exit status of a child, as reported by $? in sh(1) */
+static int
+exit_status_of(int status)
+{
+    if (WIFEXITED(status))
+        return WEXITSTATUS(status);
+    if (WIFSIGNALED(status))
+        return 128 + WTERMSIG(status);
+    if (WIFSTOPPED(status))
+        return 128 + WSTOPSIG(status);
+    return 0;
+}
+
+/* Send 'sig' to every process of 'job'.
+ * Without job control a job's processes share the shell's process
+ * group, so they are signalled one by one. */
+static int
+signal_job(struct esh_pipeline * job, int sig)
+{
+    // A job of in-process filters only has no processes to signal
+    if (job -> pgid == -1)
+        return 0;
+    if (esh_interactive)
+        return kill(-job -> pgid, sig);
+    
+    struct list_elem * e;
+    for (e = list_begin(&job -> commands); e != list_end(&job -> commands); e = list_next(e)) {
+        struct esh_command * command = list_entry(e, struct esh_command, elem);
+        if (command -> pid > 0 && kill(command -> pid, sig) < 0 && errno != ESRCH)
+            return -1;
+    }
+    return 0;
+}
+
+/* Queue a notification for esh_job_notifications_flush().
+ * Without job control, nobody is shown notifications. */
+static FILE *
+notify(void)
+{
+    if (notify_stream == NULL)
+        notify_stream = open_memstream(&notify_buf, &notify_len);
+    return notify_stream;
+}
+
+/* Keep what 'command', whose process is gone, used */
+static void
+record_usage(struct esh_command * command, const struct rusage * usage)
+{
+    command -> usage = *usage;
+    esh_usage_add(&command -> pipeline -> usage, usage);
+    clock_gettime(CLOCK_MONOTONIC, &command -> ended);
+}
+
+/* 'pipeline', which had status 'old_status', has no processes left.
+ * Only a compact record of a finished job stays around. */
+static void
+job_over(struct esh_pipeline * pipeline, enum job_status old_status)
+{
+    // Background jobs are reported with the next prompt
+    bool notified = old_status != FOREGROUND && esh_interactive;
+    if (notified) {
+        fprintf(notify(), "[%d]\t%s        (%s)\n", pipeline -> jid,
+                pipeline -> status == DONE ? "Done" : "Terminated", pipeline -> title);
+    }
+    if (pipeline -> timed && !list_empty(&pipeline -> done)) {
+        esh_usage_report(notified ? notify() : stderr, pipeline);
+    }
+    esh_job_remove(pipeline);
+    list_push_back(&reaped_jobs, &pipeline -> elem);
+}
+
+/* 
+ * Record a status change of 'command' as reported by wait4(), or
+ * by esh_filter_reap() for an in-process filter.  'last_stage' tells
+ * whether its status is the pipeline's; 'usage' is what the process
+ * used if it is gone.
+ * Runs in the shell's event loop or from wait_for_job, never in a
+ * signal handler.
+ */
+static void
+command_status_change(struct esh_command * command, int status, bool last_stage,
+                      const struct rusage * usage) {
+    #ifdef DEBUG
+        printf("In command_status_change\n");
+    #endif 
+    
+    struct esh_pipeline * pipeline = command -> pipeline;
+    enum job_status old_status = pipeline -> status;
+    
+    struct esh_plugin ** plugins = esh_plugin_hook_list(ESH_HOOK_STATUS_CHANGE);
+    for (; *plugins; plugins++) {
+        (*plugins) -> command_status_change(command, status);
+    }
+    
+    if (last_stage && !WIFCONTINUED(status)) {
+        pipeline -> exit_status = exit_status_of(status);
+    }
+    
+     // Stopped by Ctrl + Z
+    if (WIFSTOPPED(status)) {
+        #ifdef DEBUG_SIGNAL
+            printf("Signal: Processed is interrupted and is Stopped\n");
+        #endif
+        // Every stage of the job reports its stop; announce
+        // the job only once
+        if (pipeline -> status != STOPPED) {
+            esh_job_set_status(pipeline, STOPPED);
+            if (esh_interactive) {
+                esh_sys_tty_save(&pipeline -> saved_tty_state);
+            }
+            // A background job that stops is reported with the
+            // next prompt, a foreground job right away
+            FILE * out = old_status == FOREGROUND ? stdout : notify();
+            fprintf(out, "[%d]  Stopped        ", pipeline -> jid);
+            print_job(out, pipeline);
+            give_terminal_to(getpgrp(), terminal);
+        }
+    }
+    else if (WIFCONTINUED(status)) {
+        #ifdef DEBUG_SIGNAL
+            printf("Signal: Processed is Continued\n");
+        #endif
+    }
+    // KILLED by kill command [TERMINATED]
+    else if (WTERMSIG(status)) {
+        #ifdef DEBUG_SIGNAL
+            printf("Signal: Processed is interrupted and is terminated\n");
+        #endif
+        // The job is over only once its last stage is gone
+        record_usage(command, usage);
+        esh_job_remove_command(command);
+        if (list_empty(&pipeline -> commands)) {
+            esh_job_set_status(pipeline, TERMINATED);
+            give_terminal_to(getpgrp(), terminal);
+        }
+    }
+    // Exited normally [DONE]
+    else if (WIFEXITED(status)) {
+        #ifdef DEBUG_SIGNAL
+            printf("Signal: Process is terminated normally\n");
+        #endif
+        record_usage(command, usage);
+        esh_job_remove_command(command);
+        if (list_empty(&pipeline -> commands)) {
+            esh_job_set_status(pipeline, DONE);
+        }
+    }
+    
+    if (list_empty(&pipeline -> commands)) {
+        job_over(pipeline, old_status);
+    }
+    
+    // A background job that finished or stopped frees its slot
+    if (old_status == BACKGROUND && pipeline -> status != BACKGROUND) {
+        esh_start_queued_jobs();
+    }
+    #ifdef DEBUG
+        printf("Done command_status_change\n");
+    #endif 
+ }
+
+/* Record a status change of child 'child_pid' reported by wait4() */
+static void
+child_status_change(pid_t child_pid, int status, const struct rusage * usage) {
+    if (child_pid < 0) {
+        esh_sys_fatal_error("Error: Child PID not yet assigned");
+    }
+    
+    // The parent indexes every stage's pid at launch, so match on
+    // the command itself rather than on the process group
+    struct esh_command * command = find_command(child_pid);
+    if (command != NULL) {
+        command_status_change(command, status, child_pid == command -> pipeline -> last_pid, usage);
+    }
+}
+ 
+/* Route SIGCHLD to a signalfd.
+ * SIGCHLD stays blocked in the shell from now on; children unblock
+ * it before they exec.  Returns the descriptor, which becomes
+ * readable when children need reaping by esh_reap_children(). */
+int
+esh_sigchld_init(void)
+{
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    if (sigprocmask(SIG_BLOCK, &mask, NULL) < 0)
+        esh_sys_fatal_error("sigprocmask: ");
+    
+    sigchld_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (sigchld_fd < 0)
+        esh_sys_fatal_error("signalfd: ");
+    return sigchld_fd;
+}
+
+/* The signalfd made by esh_sigchld_init(), or -1 */
+int
+esh_sigchld_fd(void)
+{
+    return sigchld_fd;
+}
+
+/*
+ * Reap every child that has exited or changed status (been stopped,
+ * needed the terminal, etc.) and record it by updating the job list
+ * data structures.  Use a loop with WNOHANG since one SIGCHLD may
+ * stand for several children.
+ */
+void
+esh_reap_children(void)
+{
+    // Pending SIGCHLDs are all accounted for by the loop below
+    struct signalfd_siginfo info[16];
+    while (sigchld_fd != -1 && read(sigchld_fd, info, sizeof info) > 0)
+        continue;
+    
+    pid_t child;
+    int status;
+    struct rusage usage;
+    while ((child = wait4(-1, &status, WUNTRACED|WNOHANG, &usage)) > 0) {
+        child_status_change(child, status, &usage);
+    }
+    
+    struct esh_command * filter;
+    bool last;
+    while ((filter = esh_filter_reap(NULL, false, &status, &last, &usage)) != NULL) {
+        command_status_change(filter, status, last, &usage);
+    }
+}
+
+/* Print the notifications batched since the last call */
+void
+esh_job_notifications_flush(void)
+{
+    if (notify_stream == NULL)
+        return;
+    
+    fclose(notify_stream);
+    notify_stream = NULL;
+    fwrite(notify_buf, 1, notify_len, stdout);
+    fflush(stdout);
+    free(notify_buf);
+    notify_buf = NULL;
+}
+ 
+/* Once a stage has been started, close the shell's copies of the
+ * ends of the pipe into it, 'pipe_1', and make the pipe out of it,
+ * 'pipe_2', the next stage's pipe in.  Pipe ends the shell does not
+ * hold are -1, so that no descriptor is closed twice: by then its
+ * number may belong to one a filter thread, a prompt worker or a
+ * plugin has just opened. */
+static void
+close_stage_pipes(int pipe_1[2], int pipe_2[2])
+{
+    if (pipe_1[0] != -1) {
+        close(pipe_1[0]);
+        close(pipe_1[1]);
+    }
+    
+    // The output of this stage is the input of the next
+    pipe_1[0] = pipe_2[0];
+    pipe_1[1] = pipe_2[1];
+    pipe_2[0] = pipe_2[1] = -1;
+}
+
+/* 
+ * Wait for all processes in this pipeline to complete, or for
+ * the pipeline's process group to no longer be the foreground 
+ * process group. 
+ * You should call this function from a) where you wait for
+ * jobs started without the &; and b) where you implement the
+ * 'fg' command.
+ * 
+ * Implement child_status_change such that it records the 
+ * information obtained from waitpid() for pid 'child.'
+ * If a child has exited or terminated (but not stopped!)
+ * it should be removed from the list of commands of its
+ * pipeline data structure so that an empty list is obtained
+ * if all processes that are part of a pipeline have 
+ * terminated.  If you use a different approach to keep
+ * track of commands, adjust the code accordingly.
+ */
+static void 
+wait_for_job(struct esh_pipeline * pipeline)
+{
+    #ifdef DEBUG
+        printf("\nIn wait_for_job\n");
+    #endif 
+    
+    while (pipeline -> status == FOREGROUND && !list_empty(&pipeline->commands)) {
+        // Every child and every filter that finishes raises SIGCHLD,
+        // so wait on the signalfd rather than for this job alone:
+        // background jobs are reaped meanwhile, and queued jobs start
+        // as soon as their slots free up, not once this job is done.
+        struct pollfd p = { .fd = sigchld_fd, .events = POLLIN };
+        if (poll(&p, 1, esh_slots_retry_ms()) < 0 && errno != EINTR) {
+            break;
+        }
+        esh_reap_children();
+        esh_start_queued_jobs();
+    }
+    #ifdef DEBUG
+        printf("\nDone wait_for_job\n\n");
+    #endif
+}
+
+/* --------- LAUNCH --------- */
+/* Start the stages of 'pipeline', connected by pipes.  Stages that
+ * cannot be started are dropped; returns false if none could be. */
+static bool
+launch_job(struct esh_pipeline * pipeline)
+{
+    struct list_elem * e = list_begin (&pipeline -> commands);
+    int command_i = 0;
+    
+    /* ------------- PID, PGID --------------- */
+    pipeline -> pgid = -1;
+    pipeline -> last_pid = -1;
+    pipeline -> exit_status = 0;
+    clock_gettime(CLOCK_MONOTONIC, &pipeline -> started);
+    pid_t pid;
+    
+    /* -------------------- Pipes ----------------- */
+    // Credit: http://www.cs.loyola.edu/~jglenn/702/S2005/Examples/dup2.html
+    //
+    //      0                  1
+    //      R ----- PIPE ----- W
+    //
+    // Example commands with pipes: 
+    //      cat scores | grep Villanova
+    // pipes[0] = [read]    cat-> grep
+    // pipes[1] = [write]   cat-> grep 
+    
+    // The pipe into the current stage and the pipe out of it, -1
+    // where there is none
+    int pipe_1[2] = { -1, -1 }, pipe_2[2] = { -1, -1 };
+    
+    // stdout is fully buffered when it is not a terminal; flush it
+    // so the shell's output is not reordered with the children's
+    fflush(stdout);
+    
+    for (; e != list_end(&pipeline -> commands); e = list_next (e)) {
+        struct esh_command * command = list_entry(e, struct esh_command, elem);
+        
+        // while the command is not the last command in the pipe
+        // continuously create a new pipe to connect from the first 
+        // pipe to the last pipe
+        if (pipeline -> is_piped && list_next(e) != list_tail(&pipeline -> commands)) {
+            pipe2(pipe_2, O_CLOEXEC);
+        }
+        
+        // A stream filter from a plugin runs on a thread of the
+        // shell, there is no child to fork
+        if (esh_filter_exists(command -> argv[0])) {
+            int in_fd = pipe_1[0];
+            int out_fd = pipe_2[1];
+            bool last = list_next(e) == list_tail(&pipeline -> commands);
+            
+            bool started = esh_filter_start(command, in_fd, out_fd, last);
+            close_stage_pipes(pipe_1, pipe_2);
+            esh_job_set_status(pipeline, FOREGROUND);
+            command -> pid = 0;
+            if (!started) {
+                if (last) {
+                    pipeline -> exit_status = 1;
+                }
+                list_remove(e);
+            }
+            continue;
+        }
+        
+        // A simple builtin is always forked, the child runs it
+        uint64_t launch_start = esh_stats_now();
+        if (esh_launch_mode == ESH_LAUNCH_SPAWN && !esh_simple_exists(command -> argv[0])) {
+            // posix_spawn: no copy of the shell, the pgid, pipe and
+            // redirect setup is done through spawn file actions
+            int in_fd = pipe_1[0];
+            int out_fd = pipe_2[1];
+            
+            pid = esh_spawn_command(command, pipeline, in_fd, out_fd);
+        }
+        else {
+            pid = fork();
+        }
+        
+        if (pid != 0) {
+            esh_stats_record(ESH_STATS_LAUNCH, launch_start);
+        }
+        
+        if (pid == 0) {
+            //  In the Child Process
+            
+            // Piping Process
+            if (pipeline -> is_piped) {
+                if (pipe_1[0] != -1) {
+                    // If the command is not the first command in the pipe
+                    dup2(pipe_1[0], 0);
+                    close(pipe_1[1]);
+                    close(pipe_1[0]);
+                }
+                
+                // While the command is not the last command, you dup2 -> 1, STDOUT
+                if (pipe_2[1] != -1) {
+                    // If the command is the the first command in the pipe
+                    dup2(pipe_2[1], 1);
+                    close(pipe_2[0]);
+                    close(pipe_2[1]);
+                }
+            }
+             
+            esh_command_helper(command, pipeline);
+        }
+        else if (pid < 0 && (esh_launch_mode == ESH_LAUNCH_FORK || esh_simple_exists(command -> argv[0]))) {
+            // Fork Failed
+            esh_sys_fatal_error("Fork Error\n");
+        }
+        else {
+            /* --------- PARENT PROCESS ----------- */
+            // --------- Setting PID and PGID ------------- //
+            close_stage_pipes(pipe_1, pipe_2);
+            
+            esh_job_set_status(pipeline, FOREGROUND);
+            command -> pid = pid;
+            
+            if (list_next(e) == list_tail(&pipeline -> commands)) {
+                pipeline -> last_pid = pid;
+                if (pid < 0) {
+                    pipeline -> exit_status = 127;
+                }
+            }
+            
+            if (pid < 0) {
+                // Spawn failed, the error was already reported.
+                // The stage's pipe ends were closed above, so the
+                // neighbouring stages see EOF/EPIPE.  Drop the stage
+                // so wait_for_job does not wait for it.
+                list_remove(e);
+                continue;
+            }
+        
+            if (pipeline -> pgid == -1) {
+                pipeline -> pgid = pid;             // Child PID set to parent PID
+            }
+            
+            // A forked child may already have exec'd after calling
+            // setpgid itself, in which case EACCES is expected.
+            if (esh_interactive && setpgid(command -> pid, pipeline -> pgid) < 0 && errno != EACCES) {
+                esh_sys_fatal_error("Error [Parent]: Cannot set pgid\n");
+            }
+            
+            command_i++;
+        }
+    }
+    
+    return !list_empty(&pipeline -> commands);
+}
+
+/* --------- JOB SLOTS --------- */
+// See esh-utils-slots.h.  A queued job is in jobs_list and has a job
+// id, but no processes, so it is not in the pgid and pid indexes yet.
+
+/* Keep 'pipeline', a background job without a slot, for later */
+static void
+queue_job(struct esh_pipeline * pipeline)
+{
+    esh_job_set_status(pipeline, QUEUED);
+    pipeline -> pgid = -1;
+    pipeline -> last_pid = -1;
+    pipeline -> exit_status = 0;
+    
+    struct list_elem * e;
+    for (e = list_begin(&pipeline -> commands); e != list_end(&pipeline -> commands); e = list_next(e)) {
+        list_entry(e, struct esh_command, elem) -> pid = 0;
+    }
+    
+    esh_job_add(pipeline);
+    printf("[%d] queued\n", pipeline -> jid);
+}
+
+/* Start queued job 'job', in the background unless its bg_job has
+ * been cleared.  Returns false if none of its stages could be
+ * started; the job is over then. */
+static bool
+start_queued_job(struct esh_pipeline * job)
+{
+    if (!launch_job(job)) {
+        esh_job_set_status(job, DONE);
+        job -> exit_status = 127;
+        job_over(job, QUEUED);
+        return false;
+    }
+    
+    esh_job_set_status(job, job -> bg_job ? BACKGROUND : FOREGROUND);
+    esh_job_index(job);
+    
+    struct esh_plugin ** plugins = esh_plugin_hook_list(ESH_HOOK_FORKED);
+    for (; *plugins; plugins++) {
+        (*plugins) -> pipeline_forked(job);
+    }
+    return true;
+}
+
+/* Start queued jobs, oldest first, while there are free slots */
+void
+esh_start_queued_jobs(void)
+{
+    // A forked copy of the shell, see esh-utils-parallel.h, has a
+    // copy of the queue, but the jobs are not its to start
+    if (esh_job_count(QUEUED) == 0 || getpid() != shell_pid) {
+        return;
+    }
+    
+    struct list_elem * e = list_begin(&jobs_list);
+    while (esh_job_count(QUEUED) > 0 && e != list_end(&jobs_list)) {
+        struct esh_pipeline * job = list_entry(e, struct esh_pipeline, elem);
+        e = list_next(e);                   // 'job' may leave jobs_list
+        if (job -> status != QUEUED) {
+            continue;
+        }
+        if (!esh_slots_admit()) {
+            break;
+        }
+        start_queued_job(job);
+    }
+}
+
+/* Run the queued jobs as slots free up.  A non-interactive shell
+ * calls this before it exits, so that no job is left unstarted. */
+void
+esh_wait_queued_jobs(void)
+{
+    for (;;) {
+        esh_start_queued_jobs();
+        if (esh_job_count(QUEUED) == 0 || getpid() != shell_pid) {
+            break;
+        }
+        
+        struct pollfd p = { .fd = sigchld_fd, .events = POLLIN };
+        poll(&p, 1, esh_slots_retry_ms());
+        esh_reap_children();
+    }
+}
+
+/* --------- BUILT-INS --------- */
+// Each builtin is registered by name in the builtin registry, see
+// esh_register_builtins() below.
+
+static bool
+builtin_jobs(struct esh_command * esh_cmd, void * aux)
+{
+    esh_command_jobs(esh_cmd);
+    return true;
+}
+
+static bool
+builtin_hash(struct esh_command * esh_cmd, void * aux)
+{
+    esh_command_hash(esh_cmd);
+    return true;
+}
+
+static bool
+builtin_exit(struct esh_command * esh_cmd, void * aux)
+{
+    #ifdef DEBUG
+        printf("Exiting\n");
+    #endif
+    exit(esh_cmd -> argv[1] ? atoi(esh_cmd -> argv[1]) : esh_last_status);
+}
+
+/* The job named by the argument of fg, bg, kill and stop, or the
+ * most recent one.  Reports an error if there is no such job. */
+static struct esh_pipeline *
+builtin_job_arg(struct esh_command * esh_cmd)
+{
+    // Argument for the command
+    char * char_jid;
+    int jid;
+    if ((char_jid = esh_cmd -> argv[1]) != NULL) {
+        jid = atoi(char_jid);
+    }
+    else {
+        jid = job_id;
+    }
+    
+    struct esh_pipeline * found_job = find_job(jid);
+    if (found_job == NULL) {
+        if (find_finished_job(jid)) {
+            printf("esh:    %s: job has terminated\n", esh_cmd -> argv[0]);
+        }
+        else {
+            printf("esh:    %s: current: no such job\n", esh_cmd -> argv[0]);
+        }
+        esh_last_status = 1;
+    }
+    return found_job;
+}
+
+static bool
+builtin_fg(struct esh_command * esh_cmd, void * aux)
+{
+    struct esh_pipeline * found_job = builtin_job_arg(esh_cmd);
+    if (found_job != NULL && found_job -> status == QUEUED) {
+        // Started right away, whether or not there is a slot
+        found_job -> bg_job = false;
+        if (!start_queued_job(found_job)) {
+            esh_last_status = 127;
+            return true;
+        }
+    }
+    if (found_job != NULL) {
+        esh_job_set_status(found_job, FOREGROUND);              // 1. Set the status = FOREGROUND
+        if (found_job -> pgid != -1)                            // 2. Give terminal access to the found_job
+            give_terminal_to(found_job -> pgid, terminal);
+        if(signal_job(found_job, SIGCONT) < 0) {                // 3. Send SIGCONT signal to continue the process
+            esh_sys_fatal_error("Error ['fg']: SIGCONT");
+        }
+        
+        print_job(stdout, found_job);
+        wait_for_job(found_job);                                // 4. Wait for the job to terminate
+        esh_last_status = found_job -> exit_status;
+        give_terminal_to(shell_pid, terminal);                  // 5. Terminal Back to Shell
+    }
+    return true;
+}
+
+static bool
+builtin_bg(struct esh_command * esh_cmd, void * aux)
+{
+    struct esh_pipeline * found_job = builtin_job_arg(esh_cmd);
+    if (found_job != NULL && found_job -> status != QUEUED && found_job -> status != BACKGROUND
+            && (esh_job_count(QUEUED) > 0 || !esh_slots_admit())) {
+        // A stopped job resumed in the background takes a slot too,
+        // and queued jobs are first in line for it
+        printf("esh:    bg: [%d]: no free job slot\n", found_job -> jid);
+        esh_last_status = 1;
+        return true;
+    }
+    if (found_job != NULL && found_job -> status != QUEUED) {   // a queued job waits for its slot
+        esh_job_set_status(found_job, BACKGROUND);              // Similar to fg but without giving terminal access and waiting for job                          
+        if (signal_job(found_job, SIGCONT) < 0) {               // Send SIGCONT signal to continue the process from STOPPED
+            esh_sys_fatal_error("Error ['bg']: SIGCONT");
+        }
+    }
+    return true;
+}
+
+static bool
+builtin_kill(struct esh_command * esh_cmd, void * aux)
+{
+    struct esh_pipeline * found_job = builtin_job_arg(esh_cmd);
+    if (found_job != NULL && found_job -> status == QUEUED) {
+        // Never started, nothing to signal
+        esh_job_set_status(found_job, TERMINATED);
+        found_job -> exit_status = 128 + SIGKILL;
+        job_over(found_job, QUEUED);
+    }
+    else if (found_job != NULL) {
+        if (signal_job(found_job, SIGKILL) < 0) {
+            esh_sys_fatal_error("Error ['kill']: SIGKILL");
+        }
+    }
+    return true;
+}
+
+static bool
+builtin_stop(struct esh_command * esh_cmd, void * aux)
+{
+    struct esh_pipeline * found_job = builtin_job_arg(esh_cmd);
+    if (found_job != NULL) {
+        if (signal_job(found_job, SIGSTOP) < 0) {
+            esh_sys_fatal_error("Error ['stop']: SIGSTOP");
+        }
+    }
+    return true;
+}
+
+/* Register the shell's own builtins */
+void
+esh_register_builtins(void)
+{
+    esh_builtin_register("jobs", builtin_jobs, NULL);
+    esh_builtin_register("fg",   builtin_fg,   NULL);
+    esh_builtin_register("bg",   builtin_bg,   NULL);
+    esh_builtin_register("kill", builtin_kill, NULL);
+    esh_builtin_register("stop", builtin_stop, NULL);
+    esh_builtin_register("exit", builtin_exit, NULL);
+    esh_builtin_register("hash", builtin_hash, NULL);
+    esh_simple_register();
+    esh_optimize_register();
+    esh_slots_register();
+    esh_usage_register();
+    esh_stats_register();
+    esh_plugin_register();
+    esh_history_register();
+}
+
+/* Run 'esh_cmd' if it is a builtin, either the shell's or a plugin's.
+ * Returns true if it was handled. */
+static bool
+is_esh_command_built_in(struct esh_command * esh_cmd)
+{
+    // Handlers report failure through esh_last_status themselves
+    int status = esh_last_status;
+    esh_last_status = 0;
+    
+    // One registry lookup, then the plugins that see every command
+    if (esh_builtin_run(esh_cmd) || esh_plugin_process_builtin(esh_cmd)) {
+        return true;
+    }
+    esh_last_status = status;
+    return false;
+}
+
+/* --------- CMD --------- */
+/* Print esh_command structure to stdout */
+// i.e. : 1.    Command: ls
+// In the Child Process
+// 
+void
+esh_command_helper(struct esh_command * cmd, struct esh_pipeline * pipeline)
+{
+    // --------- Setting PID and PGID ------------- //
+    pid_t child_pid = getpid();           // Child pid
+    cmd -> pid = child_pid;               // Each process PID = getpid();
+    esh_signal_unblock(SIGCHLD);          // The shell keeps it blocked, see esh_sigchld_init
+    
+    #ifdef DEBUG_PID
+        printf("Child PID is: [%d]\n", cmd -> pid);
+        printf("PGID is: [%d]\n",      pipeline -> pgid);
+    #endif
+    if (pipeline -> pgid == -1) {
+        pipeline -> pgid = child_pid;
+    }
+    
+    // Process groups are only needed for job control
+    if (esh_interactive && setpgid(child_pid, pipeline -> pgid) < 0) {
+        esh_sys_fatal_error("Error [Parent]: Cannot set pgid\n");
+    }
+
+    // --------- Foreground and Background -------- //
+    if (pipeline -> bg_job) {        
+        esh_job_set_status(pipeline, BACKGROUND);
+    }
+    else {        
+        esh_job_set_status(pipeline, FOREGROUND);
+        give_terminal_to(pipeline -> pgid, terminal);
+    }
+    
+    
+    // ---------- Input and Output ----------- //
+    //  O_RDONLY:   Read-Only
+    //  O_WRONLY:   Write-Only
+    //  O_RDWR:     Read/Write
+    //  O_APPEND:   Append mode
+    //  O_CREAT:    If file does not exits, it will be created
+    //  O_TRUNC:    If the file already exists and is a regular file and the
+    //              access mode allows writing (i.e., is O_RDWR or O_WRONLY) it
+    //              will be truncated to length 0.
+    
+    if (cmd -> iored_output) {
+        // Symbol (>)
+       // printf("  stdout %ss to %s\n", 
+       // cmd -> append_to_output ? "append" : "write",
+       // cmd -> iored_output);
+       
+       int out;
+       //FILE* file;
+       // credit: http://www.cs.loyola.edu/~jglenn/702/S2005/Examples/dup2.html
+       if (cmd -> append_to_output) {
+           // file = fopen(cmd->iored_output, "a");
+           // out = fileno(file);
+           out = open(cmd -> iored_output, 
+                      O_APPEND | O_CREAT | O_WRONLY, 
+                      0666);
+       }
+       else {
+           // file = fopen(cmd->iored_output, "wb");
+           // out = fileno(file);
+           out = open(cmd -> iored_output, 
+                      O_TRUNC | O_CREAT | O_WRONLY, 
+                      0666);
+       }
+       
+       if (dup2(out, STDOUT_FILENO) < 0) {                          // replace standard output with output file
+            esh_sys_fatal_error("Error: dup2(out, STDOUT_FILENO)");
+       }
+       //fclose(file);
+       close(out);
+    }
+
+    // credit: http://www.cs.loyola.edu/~jglenn/702/S2005/Examples/dup2.html
+    if (cmd -> iored_input) {
+        // Symbol (< or <<)
+        //printf("  stdin reads from %s\n", cmd->iored_input);
+        
+        
+        int in = open(cmd -> iored_input, O_RDONLY);
+        if (dup2(in, STDIN_FILENO) < 0) {                           // replace standard input with input file
+            esh_sys_fatal_error("Error: dup2(in, STDIN_FILENO)");
+        }
+        close(in);
+    }
+    
+    // ------------- Execute Command ------------ //
+    // A simple builtin as a pipeline stage needs no program
+    if (esh_simple_exists(cmd -> argv[0])) {
+        int status = esh_simple_run(cmd -> argv);
+        fflush(stdout);
+        _exit(status);
+    }
+    
+    // The parent already resolved argv[0] through the PATH cache
+    if (execv(cmd -> path, cmd -> argv) < 0) {
+        esh_sys_fatal_error("%s: ", cmd -> argv[0]);
+    }
+}
+
+/* --------- PIPELINE --------- */ 
+/* Print esh_pipeline structure to stdout */
+void
+esh_pipeline_helper(struct esh_pipeline * pipeline, struct esh_command_line * cmdline)
+{
+    /* ------- INITIALIZATION ---------- */
+    uint64_t start = esh_stats_now();
+        
+    pipeline -> is_piped = list_begin(&pipeline -> commands) != list_back(&pipeline -> commands);
+    
+    struct list_elem * e = list_begin (&pipeline -> commands);
+    struct esh_command * esh_cmd = list_entry(e, struct esh_command, elem);
+    
+    /* -------- BUILT-INS AND PLUG_INS ---------- */    
+    bool built_in = is_esh_command_built_in(esh_cmd);
+    esh_stats_record(ESH_STATS_DISPATCH, start);
+    if (built_in) {
+        list_pop_front(&cmdline -> pipes);
+    }
+    /* -------- REWRITE RULES ---------- */
+    // A plugin's process_pipeline may run the pipeline itself
+    else if (esh_pipeline_optimize(pipeline)) {
+        list_pop_front(&cmdline -> pipes);
+    }
+    // Iterates through the command separated by "|"
+    else {
+        // Stages may have been removed
+        pipeline -> is_piped = list_begin(&pipeline -> commands) != list_back(&pipeline -> commands);
+        e = list_begin (&pipeline -> commands);
+        
+        /* ------------- PATH LOOKUP --------------- */
+        // Resolve every stage in the parent; an unknown command
+        // rejects the whole pipeline before anything is forked
+        for (; e != list_end(&pipeline -> commands); e = list_next (e)) {
+            struct esh_command * command = list_entry(e, struct esh_command, elem);
+            if (esh_filter_exists(command -> argv[0]) || esh_simple_exists(command -> argv[0])) {
+                continue;                   // runs without a program, see below
+            }
+            const char * path = esh_path_lookup(command -> argv[0]);
+            if (path == NULL) {
+                fprintf(stderr, "esh: %s: command not found\n", command -> argv[0]);
+                esh_last_status = 127;
+                list_pop_front(&cmdline -> pipes);
+                return;
+            }
+            // The cache owns 'path' and may drop it on the next lookup
+            command -> path = arena_strdup(cmdline -> arena, path);
+        }
+        
+        // The job outlives this command line, so it moves into an
+        // arena of its own that is released once the job is reaped
+        list_pop_front(&cmdline -> pipes);
+        pipeline = esh_pipeline_copy(pipeline);
+        
+        /* ------------- JOB HANDLING --------------- */
+        job_id++;
+        // Handling Job_Id for pipelines
+        if (list_empty(&jobs_list)) {
+            job_id = 1;
+        }
+        
+        pipeline -> jid = job_id;
+        
+        /* ------------- JOB SLOTS --------------- */
+        // Over the limit, a background job waits in jobs_list until
+        // esh_start_queued_jobs() gives it a slot
+        if (pipeline -> bg_job && (esh_job_count(QUEUED) > 0 || !esh_slots_admit())) {
+            queue_job(pipeline);
+            esh_last_status = 0;
+            return;
+        }
+        
+        if (!launch_job(pipeline)) {
+            // Nothing could be started, so there is no job to track
+            esh_last_status = 127;
+            esh_pipeline_free(pipeline);
+            return;
+        }
+        esh_stats_record(ESH_STATS_EXEC, start);
+
+        if (pipeline -> bg_job) {
+            esh_job_set_status(pipeline, BACKGROUND);
+            if (pipeline -> pgid == -1) {
+                printf("[%d]\n", pipeline -> jid);      // in-process filters only
+            }
+            else {
+                printf("[%d] %d\n", pipeline -> jid, pipeline ->pgid);
+            }
+        }
+        
+        esh_job_add(pipeline);
+        
+        struct esh_plugin ** plugins = esh_plugin_hook_list(ESH_HOOK_FORKED);
+        for (; *plugins; plugins++) {
+            (*plugins) -> pipeline_forked(pipeline);
+        }
+        
+        if (!pipeline -> bg_job) {
+            uint64_t wait_start = esh_stats_now();
+            wait_for_job(pipeline);
+            esh_stats_record(ESH_STATS_WAIT, wait_start);
+            esh_last_status = pipeline -> exit_status;
+        }
+        else {
+            esh_last_status = 0;
+        }
+        give_terminal_to(shell_pid, terminal);
+    }
+}
+
+/* --------- CMD LINE --------- */
+/* Print esh_command_line structure to stdout */
+void 
+esh_command_line_helper(struct esh_command_line * cmdline)
+{
+    esh_reap_children();
+    release_reaped_jobs();
+    
+    while (!list_empty(&cmdline->pipes)) {
+        // Jobs that finished during the previous pipeline of the line
+        // free their slots before the next one asks for one
+        esh_reap_children();
+        struct esh_pipeline * pipeline = list_entry(list_begin(&cmdline -> pipes), struct esh_pipeline, elem);
+        esh_pipeline_helper(pipeline, cmdline);
+    }
 }
\ No newline at end of file
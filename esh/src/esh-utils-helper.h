@@ -1,25 +1,52 @@
-#ifndef __ESH_UTILS_HELPER_H
-#define __ESH_UTILS_HELPER_H
-
-/*
- * helper functions for esh-utils
- */
-#include <stdbool.h>
-#include <signal.h>
-#include <stdio.h>
-#include <sys/types.h>
-#include <dirent.h>
-#include <dlfcn.h>
-#include <limits.h>
-
-void
-esh_command_helper(struct esh_command *cmd, struct esh_pipeline *pipeline);//, struct termios * terminal);
-
-void
-esh_pipeline_helper(struct esh_pipeline *pipeline, struct esh_command_line * cmdline);//, struct list * p_jobs_list, int * p_job_id, pid_t shell_pid);//, struct termios * terminal);
-
-void 
-esh_command_line_helper(struct esh_command_line *cmdline);//, struct list * p_jobs_list, int * p_job_id, pid_t shell_pid); //, struct termios * terminal);
-
-bool is_plugin;
+#ifndef __ESH_UTILS_HELPER_H
+#define __ESH_UTILS_HELPER_H
+
+/*
+ * helper functions for esh-utils
+ */
+#include <stdbool.h>
+#include <signal.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include <dirent.h>
+#include <dlfcn.h>
+#include <limits.h>
+
+void
+esh_command_helper(struct esh_command *cmd, struct esh_pipeline *pipeline);//, struct termios * terminal);
+
+void
+esh_pipeline_helper(struct esh_pipeline *pipeline, struct esh_command_line * cmdline);//, struct list * p_jobs_list, int * p_job_id, pid_t shell_pid);//, struct termios * terminal);
+
+void 
+esh_command_line_helper(struct esh_command_line *cmdline);//, struct list * p_jobs_list, int * p_job_id, pid_t shell_pid); //, struct termios * terminal);
+
+/* Block SIGCHLD and return a signalfd that becomes readable when
+ * children need reaping */
+int esh_sigchld_init(void);
+
+/* The signalfd made by esh_sigchld_init(), or -1 */
+int esh_sigchld_fd(void);
+
+/* Reap children that changed status and update the jobs */
+void esh_reap_children(void);
+
+/* Start queued background jobs while there are free job slots,
+ * see esh-utils-slots.h */
+void esh_start_queued_jobs(void);
+
+/* Start the remaining queued jobs as slots free up; returns once
+ * all have been started */
+void esh_wait_queued_jobs(void);
+
+/* Print notifications about background jobs that finished or
+ * stopped since the last call.  Called before each prompt. */
+void esh_job_notifications_flush(void);
+
+/* Register the shell's builtin commands (jobs, fg, bg, kill, stop,
+ * exit, hash, explain, jobslots, time, stats, plugin, history, and the
+ * simple builtins of esh-utils-simple.h)
+ * in the builtin registry.  Called again when plugins are unloaded,
+ * to restore the commands they overrode. */
+void esh_register_builtins(void);
 #endif //__ESH_UTILS_HELPER_H
\ No newline at end of file
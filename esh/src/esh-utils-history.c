@@ -0,0 +1,952 @@
+/*
+ * esh-utils-history.c
+ * Shared, indexed command history.  See esh-utils-history.h.
+ *
+ * The index file is, in native byte order:
+ *
+ *      struct index_header
+ *      uint64_t offsets[nentries]      where each line starts in the log
+ *      struct gram grams[ngrams]       by ascending 'gram'
+ *      uint32_t postings[npostings]    line numbers, ascending per gram
+ *
+ * It describes the first 'log_size' bytes of the log with the device
+ * and inode in the header; it is ignored if the log is not that file,
+ * or is shorter, or those bytes do not end a line.  It is also ignored,
+ * and rebuilt, if it was written in the other byte order or in another
+ * version of the format, or if it does not hold together: every offset
+ * and posting is checked before the index is used, so a damaged or
+ * crafted file cannot make a search read outside the log or the index.
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <readline/readline.h>
+
+#include "esh.h"
+#include "esh-utils-builtin.h"
+#include "esh-utils-history.h"
+
+#define INDEX_MAGIC     "eshhist"       /* with its NUL, 8 bytes */
+#define INDEX_BYTE_ORDER 0x01020304     /* reads 0x04030201 if swapped */
+#define INDEX_VERSION   2
+#define INDEX_SUFFIX    ".idx"
+#define TAIL_MAX        4096    /* unindexed lines before a rebuild */
+#define GRAM_SPACE      (1 << 24)
+#define DEFAULT_LIST    20      /* lines 'history' lists */
+
+struct index_header {
+    char magic[8];
+    uint32_t byte_order;        /* INDEX_BYTE_ORDER */
+    uint32_t version;           /* INDEX_VERSION */
+    uint64_t dev, ino;          /* of the log */
+    uint64_t log_size;          /* bytes of the log indexed */
+    uint64_t nentries;
+    uint64_t ngrams;
+    uint64_t npostings;
+};
+
+struct gram {
+    uint32_t gram;              /* three bytes, the first in bits 16-23 */
+    uint32_t count;
+    uint64_t start;             /* of its lines in 'postings' */
+};
+
+/* A mapped index file */
+struct index {
+    void *map;
+    size_t map_size;
+    const struct index_header *h;
+    const uint64_t *offsets;
+    const struct gram *grams;
+    const uint32_t *postings;
+};
+
+static char *log_path;          /* NULL until set; "" for no history */
+static int log_fd = -1;         /* O_APPEND, for appending and mapping */
+static char *last_added;
+
+static bool loaded;
+static const char *log_map;
+static size_t log_mapped;       /* bytes mapped */
+static size_t log_size;         /* bytes up to the end of the last line */
+
+static struct index idx;        /* lines 0 .. nindexed-1, if any */
+static long nindexed;
+static uint64_t *tail;          /* offsets of the lines after those */
+static long ntail, tail_capacity;
+static long nentries;           /* nindexed + ntail */
+
+/* The index thread.  'built' is set, under 'build_lock', when it has
+ * written a new index file. */
+static pthread_mutex_t build_lock = PTHREAD_MUTEX_INITIALIZER;
+static bool building, built;
+
+static void index_unmap(struct index *x);
+
+/* Use 'path' for the history; NULL for the default, "" for none.
+ * Whatever was read of another file is dropped. */
+void
+esh_history_set_file(const char *path)
+{
+    if (log_map)
+        munmap((void *) log_map, log_mapped);
+    log_map = NULL;
+    log_mapped = log_size = 0;
+    index_unmap(&idx);
+    nindexed = ntail = nentries = 0;
+    loaded = false;
+    if (log_fd != -1)
+        close(log_fd);
+    log_fd = -1;
+
+    free(log_path);
+    log_path = NULL;
+    if (path) {
+        log_path = strdup(path);
+    } else if (getenv("HOME")) {
+        log_path = malloc(strlen(getenv("HOME")) + sizeof "/.esh_history");
+        sprintf(log_path, "%s/.esh_history", getenv("HOME"));
+    }
+}
+
+static bool
+open_log(void)
+{
+    if (log_fd != -1)
+        return true;
+    if (log_path == NULL)
+        esh_history_set_file(NULL);
+    if (log_path == NULL || *log_path == '\0')
+        return false;
+
+    log_fd = open(log_path, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+    if (log_fd == -1) {
+        fprintf(stderr, "esh: history: %s: %s\n", log_path, strerror(errno));
+        *log_path = '\0';               /* do not complain again */
+        return false;
+    }
+    return true;
+}
+
+/* Append 'line', with its newline, in one write */
+void
+esh_history_add(const char *line)
+{
+    if (*line == '\0' || (last_added && strcmp(line, last_added) == 0))
+        return;
+    if (!open_log())
+        return;
+
+    size_t len = strlen(line);
+    char *buf = malloc(len + 1);
+    memcpy(buf, line, len);
+    buf[len] = '\n';
+    if (write(log_fd, buf, len + 1) != (ssize_t) (len + 1))
+        perror("esh: history");
+    free(buf);
+
+    free(last_added);
+    last_added = strdup(line);
+}
+
+/* --- READING --- */
+
+static uint64_t
+line_offset(long i)
+{
+    return i < nindexed ? idx.offsets[i] : tail[i - nindexed];
+}
+
+/* Line 'i', without its newline */
+static const char *
+line_at(long i, size_t *len)
+{
+    uint64_t start = line_offset(i);
+    uint64_t end = i + 1 < nentries ? line_offset(i + 1) : log_size;
+    *len = end - start - 1;
+    return log_map + start;
+}
+
+static void
+index_unmap(struct index *x)
+{
+    if (x->map)
+        munmap(x->map, x->map_size);
+    memset(x, 0, sizeof *x);
+}
+
+/* The size of the index file 'h' describes, in *size.  False if it
+ * does not fit in 64 bits. */
+static bool
+index_file_size(const struct index_header *h, uint64_t *size)
+{
+    uint64_t offsets, grams, postings;
+    return !__builtin_mul_overflow(h->nentries, sizeof (uint64_t), &offsets)
+        && !__builtin_mul_overflow(h->ngrams, sizeof (struct gram), &grams)
+        && !__builtin_mul_overflow(h->npostings, sizeof (uint32_t), &postings)
+        && !__builtin_add_overflow(sizeof *h, offsets, size)
+        && !__builtin_add_overflow(*size, grams, size)
+        && !__builtin_add_overflow(*size, postings, size);
+}
+
+/* Is 'h', the header of an index file of 'size' bytes, that of an index of
+ * the mapped log, file 'log_st'? */
+static bool
+index_header_valid(const struct index_header *h, size_t size, const struct stat *log_st)
+{
+    uint64_t expected;
+    return memcmp(h->magic, INDEX_MAGIC, sizeof h->magic) == 0
+        && h->byte_order == INDEX_BYTE_ORDER
+        && h->version == INDEX_VERSION
+        && index_file_size(h, &expected) && expected == size
+        && h->dev == log_st->st_dev && h->ino == log_st->st_ino
+        && h->log_size <= log_mapped
+        && (h->log_size == 0 ? h->nentries == 0 : log_map[h->log_size - 1] == '\n')
+        && h->nentries <= UINT32_MAX;
+}
+
+/* Do the tables of mapped index 'x' hold together?  Lines must start
+ * at ascending offsets within the indexed bytes, grams must ascend and
+ * their lines lie within 'postings', and every posting must be a line
+ * of the index. */
+static bool
+index_tables_valid(const struct index *x)
+{
+    const struct index_header *h = x->h;
+    uint64_t i;
+
+    for (i = 0; i < h->nentries; i++)
+        if (x->offsets[i] >= h->log_size || (i > 0 && x->offsets[i] <= x->offsets[i - 1]))
+            return false;
+    if (h->nentries > 0 && x->offsets[0] != 0)
+        return false;
+
+    for (i = 0; i < h->ngrams; i++) {
+        const struct gram *g = &x->grams[i];
+        if (g->start > h->npostings || g->count > h->npostings - g->start
+                || (i > 0 && g->gram <= x->grams[i - 1].gram))
+            return false;
+    }
+
+    for (i = 0; i < h->npostings; i++)
+        if (x->postings[i] >= h->nentries)
+            return false;
+    return true;
+}
+
+/* Map the index file into 'x' if it is valid for the mapped log */
+static bool
+index_map(struct index *x, const struct stat *log_st)
+{
+    char name[strlen(log_path) + sizeof INDEX_SUFFIX];
+    sprintf(name, "%s" INDEX_SUFFIX, log_path);
+
+    int fd = open(name, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return false;
+    struct stat st;
+    void *map = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size >= (off_t) sizeof (struct index_header))
+        map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return false;
+
+    const struct index_header *h = map;
+    if (!index_header_valid(h, st.st_size, log_st)) {
+        munmap(map, st.st_size);
+        return false;
+    }
+
+    x->map = map;
+    x->map_size = st.st_size;
+    x->h = h;
+    x->offsets = (const uint64_t *) (h + 1);
+    x->grams = (const struct gram *) (x->offsets + h->nentries);
+    x->postings = (const uint32_t *) (x->grams + h->ngrams);
+    if (!index_tables_valid(x)) {
+        index_unmap(x);
+        return false;
+    }
+    return true;
+}
+
+/* Add the complete lines past 'log_size' to the tail */
+static void
+scan_tail(void)
+{
+    const char *p = log_map + log_size, *end = log_map + log_mapped, *nl;
+    while (p < end && (nl = memchr(p, '\n', end - p)) != NULL) {
+        if (ntail == tail_capacity) {
+            tail_capacity = tail_capacity ? 2 * tail_capacity : 1024;
+            tail = realloc(tail, tail_capacity * sizeof *tail);
+        }
+        tail[ntail++] = p - log_map;
+        p = nl + 1;
+    }
+    log_size = p - log_map;
+    nentries = nindexed + ntail;
+}
+
+/* Use index 'x', which covers at least as much as the current one */
+static void
+use_index(struct index *x)
+{
+    index_unmap(&idx);
+    idx = *x;
+    nindexed = idx.h ? idx.h->nentries : 0;
+    log_size = idx.h ? idx.h->log_size : 0;
+    ntail = 0;
+    scan_tail();
+}
+
+/* Switch to the index file if it covers more of the log than ours */
+static void
+adopt_index_file(const struct stat *log_st)
+{
+    struct index x = { 0 };
+    if (!index_map(&x, log_st))
+        return;
+    if (x.h->nentries > (uint64_t) nindexed)
+        use_index(&x);
+    else
+        index_unmap(&x);
+}
+
+static void build_index(void);
+
+static void *
+build_thread(void *arg)
+{
+    build_index();
+
+    pthread_mutex_lock(&build_lock);
+    built = true;
+    pthread_mutex_unlock(&build_lock);
+    return NULL;
+}
+
+/* Start rebuilding the index if too many lines are not in it */
+static void
+maybe_rebuild(const struct stat *log_st)
+{
+    pthread_mutex_lock(&build_lock);
+    bool done = built, busy = building;
+    built = false;
+    if (done)
+        building = busy = false;
+    pthread_mutex_unlock(&build_lock);
+
+    if (done || (!busy && ntail > TAIL_MAX))
+        adopt_index_file(log_st);       /* ours, or another session's */
+    if (busy || ntail <= TAIL_MAX)
+        return;
+
+    // Signals are for the main thread, and for children it forks
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+
+    pthread_t thread;
+    building = pthread_create(&thread, NULL, build_thread, NULL) == 0;
+    if (building)
+        pthread_detach(thread);
+
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+}
+
+/* Bring the mapping up to date with the log, which other sessions
+ * may have appended to.  Returns false if there is no history. */
+static bool
+refresh(void)
+{
+    struct stat st;
+    if (!open_log() || fstat(log_fd, &st) != 0)
+        return false;
+
+    if ((size_t) st.st_size < log_size) {       /* truncated: start over */
+        index_unmap(&idx);
+        nindexed = ntail = nentries = 0;
+        log_size = 0;
+        loaded = false;
+    }
+
+    if ((size_t) st.st_size != log_mapped) {
+        if (log_map)
+            munmap((void *) log_map, log_mapped);
+        log_map = NULL;
+        log_mapped = 0;
+        if (st.st_size > 0) {
+            void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, log_fd, 0);
+            if (map == MAP_FAILED)
+                return false;
+            log_map = map;
+            log_mapped = st.st_size;
+        }
+    }
+
+    if (!loaded) {
+        struct index x = { 0 };
+        index_map(&x, &st);
+        use_index(&x);
+        loaded = true;
+    } else {
+        scan_tail();
+    }
+    maybe_rebuild(&st);
+    return true;
+}
+
+/* The number of lines in the history */
+long
+esh_history_count(void)
+{
+    refresh();
+    return nentries;
+}
+
+/* Line 'i' of the history */
+const char *
+esh_history_line(long i, size_t *len)
+{
+    if (!refresh() || i < 0 || i >= nentries) {
+        *len = 0;
+        return "";
+    }
+    return line_at(i, len);
+}
+
+/* --- SEARCHING --- */
+
+static uint32_t
+gram_at(const char *s)
+{
+    const unsigned char *u = (const unsigned char *) s;
+    return u[0] << 16 | u[1] << 8 | u[2];
+}
+
+static bool
+matches(long i, const char *text, size_t tlen, bool prefix)
+{
+    size_t len;
+    const char *line = line_at(i, &len);
+    if (prefix)
+        return len >= tlen && memcmp(line, text, tlen) == 0;
+    return memmem(line, len, text, tlen) != NULL;
+}
+
+/* The indexed gram of 'text' with the fewest lines.  NULL if one of
+ * its grams is in no line, and so is 'text'. */
+static const struct gram *
+rarest_gram(const char *text, size_t tlen)
+{
+    const struct gram *rarest = NULL;
+    size_t k;
+    for (k = 0; k + 3 <= tlen; k++) {
+        uint32_t g = gram_at(text + k);
+        long lo = 0, hi = (long) idx.h->ngrams - 1;
+        const struct gram *found = NULL;
+        while (lo <= hi) {
+            long mid = (lo + hi) / 2;
+            if (idx.grams[mid].gram == g) {
+                found = &idx.grams[mid];
+                break;
+            }
+            if (idx.grams[mid].gram < g)
+                lo = mid + 1;
+            else
+                hi = mid - 1;
+        }
+        if (found == NULL)
+            return NULL;
+        if (rarest == NULL || found->count < rarest->count)
+            rarest = found;
+    }
+    return rarest;
+}
+
+/* Search lines 'from' to 'to', inclusive, one by one */
+static long
+search_lines(const char *text, size_t tlen, bool prefix, long from, long to)
+{
+    long step = from <= to ? 1 : -1, i;
+    for (i = from; i != to + step; i += step)
+        if (matches(i, text, tlen, prefix))
+            return i;
+    return -1;
+}
+
+/* Search indexed lines 'from' to 'to', inclusive, through the lines
+ * of the rarest gram of 'text' */
+static long
+search_index(const char *text, size_t tlen, bool prefix, long from, long to)
+{
+    if (tlen < 3)
+        return search_lines(text, tlen, prefix, from, to);
+
+    const struct gram *g = rarest_gram(text, tlen);
+    if (g == NULL)
+        return -1;
+    const uint32_t *lines = idx.postings + g->start;
+
+    // The first posting > 'from' (or >= when going forwards)
+    bool backwards = from > to;
+    long lo = 0, hi = g->count;
+    while (lo < hi) {
+        long mid = (lo + hi) / 2;
+        if (backwards ? lines[mid] <= from : lines[mid] < from)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    long k;
+    if (backwards) {
+        for (k = lo - 1; k >= 0 && lines[k] >= to; k--)
+            if (matches(lines[k], text, tlen, prefix))
+                return lines[k];
+    } else {
+        for (k = lo; k < g->count && lines[k] <= to; k++)
+            if (matches(lines[k], text, tlen, prefix))
+                return lines[k];
+    }
+    return -1;
+}
+
+/* The nearest line from 'from' on, in direction 'dir', with 'text' */
+long
+esh_history_search(const char *text, long from, int dir, bool prefix)
+{
+    if (!refresh() || nentries == 0)
+        return -1;
+    if ((dir < 0 && from < 0) || (dir >= 0 && from >= nentries))
+        return -1;
+    size_t tlen = strlen(text);
+    if (from >= nentries)
+        from = nentries - 1;
+    if (from < 0)
+        from = 0;
+
+    long found = -1;
+    if (dir < 0) {
+        if (from >= nindexed)
+            found = search_lines(text, tlen, prefix, from, nindexed);
+        if (found < 0 && nindexed > 0)
+            found = search_index(text, tlen, prefix, from < nindexed ? from : nindexed - 1, 0);
+    } else {
+        if (from < nindexed)
+            found = search_index(text, tlen, prefix, from, nindexed - 1);
+        if (found < 0 && ntail > 0)
+            found = search_lines(text, tlen, prefix, from > nindexed ? from : nindexed, nentries - 1);
+    }
+    return found;
+}
+
+/* --- BUILDING THE INDEX --- */
+
+static int
+compare_gram(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *) a, y = *(const uint32_t *) b;
+    return x < y ? -1 : x > y;
+}
+
+/* The distinct grams of a line, sorted, in 'buf'.  Returns how many. */
+static size_t
+line_grams(const char *line, size_t len, uint32_t *buf)
+{
+    size_t n = 0, k;
+    for (k = 0; k + 3 <= len; k++)
+        buf[n++] = gram_at(line + k);
+    qsort(buf, n, sizeof *buf, compare_gram);
+
+    size_t distinct = 0;
+    for (k = 0; k < n; k++)
+        if (distinct == 0 || buf[distinct - 1] != buf[k])
+            buf[distinct++] = buf[k];
+    return distinct;
+}
+
+/* Index the complete lines of 'log', 'size' bytes of file 'st' */
+static bool
+write_index(const char *log, size_t size, const struct stat *st)
+{
+    struct index_header h = { .byte_order = INDEX_BYTE_ORDER, .version = INDEX_VERSION,
+                              .dev = st->st_dev, .ino = st->st_ino, .log_size = size };
+    memcpy(h.magic, INDEX_MAGIC, sizeof h.magic);
+
+    uint64_t *offsets = NULL;
+    size_t capacity = 0, longest = 0;
+    const char *p = log, *nl;
+    while (p < log + size && (nl = memchr(p, '\n', log + size - p)) != NULL) {
+        if (h.nentries == capacity) {
+            capacity = capacity ? 2 * capacity : 4096;
+            offsets = realloc(offsets, capacity * sizeof *offsets);
+        }
+        offsets[h.nentries++] = p - log;
+        if ((size_t) (nl - p) > longest)
+            longest = nl - p;
+        p = nl + 1;
+    }
+    h.log_size = p - log;
+
+    // Count the lines of each gram, then place them
+    uint32_t *counts = calloc(GRAM_SPACE, sizeof *counts);
+    uint32_t *grams = malloc((longest + 1) * sizeof *grams);
+    uint64_t i;
+    size_t n, k;
+    for (i = 0; i < h.nentries; i++) {
+        uint64_t end = i + 1 < h.nentries ? offsets[i + 1] : h.log_size;
+        n = line_grams(log + offsets[i], end - offsets[i] - 1, grams);
+        for (k = 0; k < n; k++)
+            counts[grams[k]]++;
+        h.npostings += n;
+    }
+
+    uint32_t g;
+    for (g = 0; g < GRAM_SPACE; g++)
+        h.ngrams += counts[g] != 0;
+    struct gram *table = malloc((h.ngrams + 1) * sizeof *table);
+    uint32_t *postings = malloc((h.npostings + 1) * sizeof *postings);
+    bool ok = table && postings && h.npostings <= UINT32_MAX && h.nentries <= UINT32_MAX;
+
+    // counts[g] becomes the next free slot of gram g in 'postings'
+    uint64_t start = 0, t = 0;
+    for (g = 0; ok && g < GRAM_SPACE; g++) {
+        if (counts[g] == 0)
+            continue;
+        table[t++] = (struct gram) { g, counts[g], start };
+        uint32_t count = counts[g];
+        counts[g] = start;
+        start += count;
+    }
+    for (i = 0; ok && i < h.nentries; i++) {
+        uint64_t end = i + 1 < h.nentries ? offsets[i + 1] : h.log_size;
+        n = line_grams(log + offsets[i], end - offsets[i] - 1, grams);
+        for (k = 0; k < n; k++)
+            postings[counts[grams[k]]++] = i;
+    }
+
+    char name[strlen(log_path) + sizeof INDEX_SUFFIX], tmpname[sizeof name + 16];
+    sprintf(name, "%s" INDEX_SUFFIX, log_path);
+    snprintf(tmpname, sizeof tmpname, "%s.%d", name, getpid());
+    FILE *f = ok ? fopen(tmpname, "we") : NULL;
+    if (f) {
+        fwrite(&h, sizeof h, 1, f);
+        fwrite(offsets, sizeof *offsets, h.nentries, f);
+        fwrite(table, sizeof *table, h.ngrams, f);
+        fwrite(postings, sizeof *postings, h.npostings, f);
+        ok = fclose(f) == 0 && rename(tmpname, name) == 0;
+        if (!ok)
+            unlink(tmpname);
+    }
+
+    free(offsets);
+    free(counts);
+    free(grams);
+    free(table);
+    free(postings);
+    return f && ok;
+}
+
+/* Index the log as it is now.  Runs on the index thread, so it maps
+ * the log for itself. */
+static void
+build_index(void)
+{
+    struct stat st;
+    if (fstat(log_fd, &st) != 0 || st.st_size == 0)
+        return;
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, log_fd, 0);
+    if (map == MAP_FAILED)
+        return;
+    write_index(map, st.st_size, &st);
+    munmap(map, st.st_size);
+}
+
+/* Rebuild the index now, rather than on a thread */
+void
+esh_history_build_index(void)
+{
+    struct stat st;
+    if (!refresh())
+        return;
+    build_index();
+    if (fstat(log_fd, &st) == 0)
+        adopt_index_file(&st);
+}
+
+/* --- LINE EDITING --- */
+
+/* Browsing with Up and Down: the line shown, nentries for the line
+ * being typed, which is kept in 'typed'.  Lines are matched against
+ * the text that was before the cursor when browsing started. */
+static long browse_at;
+static char *typed, *browse_prefix;
+static int typed_point;
+
+/* Incremental search: the text searched for, the line that matched,
+ * and the keymap in effect before */
+static Keymap search_map, search_saved_map;
+static char search_text[256], last_search[256];
+static size_t search_len;
+static long search_at, search_start;
+static bool search_failed;
+
+/* Show line 'i' in place of the line being edited */
+static void
+show_line(long i, int point)
+{
+    size_t len;
+    const char *line = line_at(i, &len);
+    char *copy = strndup(line, len);
+    rl_replace_line(copy, 0);
+    rl_point = point < 0 || point > rl_end ? rl_end : point;
+    free(copy);
+}
+
+/* Is line 'i' what is being edited already? */
+static bool
+showing(long i)
+{
+    size_t len;
+    const char *line = line_at(i, &len);
+    return len == (size_t) rl_end && memcmp(line, rl_line_buffer, len) == 0;
+}
+
+static int history_previous(int count, int key);
+static int history_next(int count, int key);
+
+static void
+browse_start(void)
+{
+    if (rl_last_func == history_previous || rl_last_func == history_next)
+        return;
+    free(typed);
+    free(browse_prefix);
+    typed = strdup(rl_line_buffer);
+    typed_point = rl_point;
+    browse_prefix = strndup(rl_line_buffer, rl_point);
+    browse_at = nentries;
+}
+
+static int
+history_previous(int count, int key)
+{
+    if (!refresh())
+        return rl_ding();
+    browse_start();
+
+    long i = browse_at;
+    while (count-- > 0) {
+        do
+            i = esh_history_search(browse_prefix, i - 1, -1, true);
+        while (i >= 0 && showing(i));
+        if (i < 0)
+            return rl_ding();
+        browse_at = i;
+        show_line(i, -1);
+    }
+    return 0;
+}
+
+static int
+history_next(int count, int key)
+{
+    if (!refresh())
+        return rl_ding();
+    browse_start();
+
+    long i = browse_at;
+    while (count-- > 0 && browse_at < nentries) {
+        do
+            i = esh_history_search(browse_prefix, i + 1, 1, true);
+        while (i >= 0 && showing(i));
+        if (i < 0) {
+            browse_at = nentries;
+            rl_replace_line(typed, 0);
+            rl_point = typed_point;
+            break;
+        }
+        browse_at = i;
+        show_line(i, -1);
+    }
+    return 0;
+}
+
+static void
+search_prompt(void)
+{
+    rl_message("(%sreverse-i-search)`%s': ", search_failed ? "failed " : "", search_text);
+}
+
+/* Find the text from line 'from' back, and show it if found */
+static void
+search_from(long from)
+{
+    long i = search_len ? esh_history_search(search_text, from, -1, false) : -1;
+    search_failed = search_len && i < 0;
+    if (i >= 0) {
+        size_t len;
+        const char *line = line_at(i, &len);
+        search_at = i;
+        show_line(i, (const char *) memmem(line, len, search_text, search_len) - line);
+    }
+    search_prompt();
+}
+
+static void
+search_end(void)
+{
+    rl_set_keymap(search_saved_map);
+    rl_clear_message();
+    if (search_len)
+        memcpy(last_search, search_text, search_len + 1);
+}
+
+static int
+search_begin(int count, int key)
+{
+    if (!refresh())
+        return rl_ding();
+    free(typed);
+    typed = strdup(rl_line_buffer);
+    typed_point = rl_point;
+
+    search_text[search_len = 0] = '\0';
+    search_at = search_start = nentries;
+    search_failed = false;
+    search_saved_map = rl_get_keymap();
+    rl_set_keymap(search_map);
+    search_prompt();
+    return 0;
+}
+
+static int
+search_insert(int count, int key)
+{
+    if (search_len + 1 < sizeof search_text) {
+        search_text[search_len++] = key;
+        search_text[search_len] = '\0';
+    }
+    search_from(search_at);             /* the line shown may still do */
+    return 0;
+}
+
+static int
+search_again(int count, int key)
+{
+    if (search_len == 0 && last_search[0]) {
+        search_len = strlen(last_search);
+        memcpy(search_text, last_search, search_len + 1);
+        search_from(search_at);
+    } else {
+        search_from(search_at - 1);
+    }
+    return 0;
+}
+
+static int
+search_rubout(int count, int key)
+{
+    if (search_len > 0)
+        search_text[--search_len] = '\0';
+    search_from(search_start - 1);
+    return 0;
+}
+
+/* C-g: back to the line as it was */
+static int
+search_abort(int count, int key)
+{
+    search_end();
+    rl_replace_line(typed, 0);
+    rl_point = typed_point;
+    return 0;
+}
+
+/* Any other key: keep the line found, and do what the key does */
+static int
+search_accept(int count, int key)
+{
+    search_end();
+    rl_execute_next(key);
+    return 0;
+}
+
+/* Bind the history keys of the line editor */
+void
+esh_history_bind(void)
+{
+    rl_add_defun("esh-history-previous", history_previous, CTRL('P'));
+    rl_add_defun("esh-history-next", history_next, CTRL('N'));
+    rl_add_defun("esh-history-search", search_begin, CTRL('R'));
+    rl_bind_keyseq("\\e[A", history_previous);
+    rl_bind_keyseq("\\e[B", history_next);
+    rl_bind_keyseq("\\eOA", history_previous);
+    rl_bind_keyseq("\\eOB", history_next);
+
+    search_map = rl_make_bare_keymap();
+    int c;
+    for (c = 0; c < 256; c++)
+        rl_bind_key_in_map(c, c >= ' ' && c != RUBOUT ? search_insert : search_accept, search_map);
+    rl_bind_key_in_map(CTRL('R'), search_again, search_map);
+    rl_bind_key_in_map(CTRL('H'), search_rubout, search_map);
+    rl_bind_key_in_map(RUBOUT, search_rubout, search_map);
+    rl_bind_key_in_map(CTRL('G'), search_abort, search_map);
+}
+
+/* --- HISTORY --- */
+
+/* history [-n count] [text]: the last lines, or those containing text */
+static bool
+builtin_history(struct esh_command *cmd, void *aux)
+{
+    long count = DEFAULT_LIST;
+    char **argv = cmd->argv + 1;
+    if (argv[0] && strcmp(argv[0], "-n") == 0) {
+        char *end = NULL;
+        count = argv[1] ? strtol(argv[1], &end, 10) : -1;
+        if (end == NULL || *end || count < 0) {
+            printf("esh:    history: usage: history [-n count] [text]\n");
+            esh_last_status = 2;
+            return true;
+        }
+        argv += 2;
+    }
+    if (argv[0] && argv[1]) {
+        printf("esh:    history: usage: history [-n count] [text]\n");
+        esh_last_status = 2;
+        return true;
+    }
+    const char *text = argv[0] ? argv[0] : "";
+
+    long n = 0, i = esh_history_count();
+    long *found = malloc((count < i ? count : i) * sizeof *found + 1);
+    while (n < count && (i = esh_history_search(text, i - 1, -1, false)) >= 0)
+        found[n++] = i;
+
+    while (n-- > 0) {
+        size_t len;
+        const char *line = line_at(found[n], &len);
+        printf("%6ld  %.*s\n", found[n] + 1, (int) len, line);
+    }
+    free(found);
+    return true;
+}
+
+/* Register the 'history' builtin */
+void
+esh_history_register(void)
+{
+    esh_builtin_register("history", builtin_history, NULL);
+}
@@ -0,0 +1,62 @@
+#ifndef __ESH_UTILS_HISTORY_H
+#define __ESH_UTILS_HISTORY_H
+
+/*
+ * Persistent command history, shared by concurrent sessions.
+ *
+ * The history is a log, one command line per line, in the file named
+ * by ESH_HISTFILE ($HOME/.esh_history by default; an empty name
+ * keeps no history).  Lines are only ever appended, each with one
+ * write() to a descriptor opened O_APPEND, so sessions add to it
+ * without locking; a line another session is still writing is not
+ * seen until its newline is.
+ *
+ * Reading maps the log.  Next to it, in ESH_HISTFILE.idx, is a
+ * trigram index of a prefix of the log: the offset of every line in
+ * that prefix and, for each three-byte sequence, the ascending list
+ * of the lines containing it.  A search for text of three bytes or
+ * more walks only the list of its rarest trigram and checks those
+ * lines; lines past the prefix are checked one by one.  When more than
+ * a few thousand of those have accumulated, the index is rebuilt on
+ * a thread and written with a rename, for every session to use.
+ * Shorter text is searched line by line, newest first; such text is
+ * usually found among the last few lines.
+ *
+ * Nothing is read until the history is first searched or browsed.
+ * esh_history_bind() takes over the line editor's history keys:
+ * Up and Down (C-p, C-n) step through the lines starting with the
+ * text before the cursor, and C-r searches backwards incrementally.
+ */
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Use 'path' for the history; NULL for the default, "" for none.
+ * Not to be called while the index is being rebuilt. */
+void esh_history_set_file(const char *path);
+
+/* Append 'line' to the history, unless it is empty or the same as
+ * the line added before */
+void esh_history_add(const char *line);
+
+/* The number of lines in the history */
+long esh_history_count(void);
+
+/* Line 'i' of the history, of *len bytes, not NUL-terminated.
+ * Valid until the next call of an esh_history function. */
+const char * esh_history_line(long i, size_t *len);
+
+/* The nearest line from line 'from' on, towards older lines if
+ * 'dir' < 0 and newer ones otherwise, that contains 'text', or that
+ * starts with it if 'prefix' is set.  Returns its number or -1. */
+long esh_history_search(const char *text, long from, int dir, bool prefix);
+
+/* Rebuild the index now, rather than on a thread */
+void esh_history_build_index(void);
+
+/* Bind the history keys of the line editor */
+void esh_history_bind(void);
+
+/* Register the 'history' builtin */
+void esh_history_register(void);
+
+#endif //__ESH_UTILS_HISTORY_H
@@ -1,141 +1,324 @@
-/*
- * esh-print.c
- * A set of print routines to manage esh objects.
- *
- * Developed by Dong Gyu Lee
- * Virginia Tech.
- *
- */
-#include <assert.h>
-#include <stdio.h>
-#include <sys/types.h>
-#include <dirent.h>
-#include <dlfcn.h>
-#include <limits.h>
-#include <unistd.h>
-#include <sys/wait.h>
-
-#include "esh.h"
-#include "esh-sys-utils.h"
-#include "esh-utils-jobs.h"
-
-#define DEBUG 0 
-struct
-esh_pipeline * find_job(int jid_look) {
-    struct list_elem * e;
-    for(e = list_begin(&jobs_list); e != list_end(&jobs_list); e = list_next(e)) {
-        
-        struct esh_pipeline * current_job = list_entry(e, struct esh_pipeline, elem);
-        if (jid_look == current_job -> jid) {
-            return current_job;
-        }
-    }
-    
-    return NULL;
-}
-
-
-static void 
-print_cmd(struct esh_command * cmd) {
-    char **p = cmd -> argv;
-    printf("%s %s", p[0], p[1]);
-}
-
-void esh_command_jobs(struct esh_command_line * cmdline) {
-    struct list_elem * e;
-    for (e = list_begin (&jobs_list); e != list_end (&jobs_list); e = list_next (e)) {
-        struct esh_pipeline * job = list_entry(e, struct esh_pipeline, elem);
-        if (job != NULL) {
-            // Use this instead of list_remove when you want to replicate
-            // Exactly like how shell is behaving
-            // When job status is DONE || TERMINATED, remove from jobs list after displaying "Done"
-            if (job -> status == DONE || job -> status == TERMINATED) {
-                list_remove(e);
-                break;
-            }
-            
-            // The most recent job is denoted as [job_id]+
-            // The second most recent job is denoted as [job_id]- 
-            // Rest jobs are denoted without any +/- symbols [job_id]
-            if (list_next(e) == list_end (&jobs_list)) {
-                printf("[%d]+\t%s        ", job -> jid, print_job_status(job -> status));
-            }
-            else if (list_next(list_next(e)) == list_end(&jobs_list)) {
-                printf("[%d]-\t%s        ", job -> jid, print_job_status(job -> status));
-            }
-            else {
-                printf("[%d]\t%s        ", job -> jid, print_job_status(job -> status));
-            }
-            
-            struct list_elem * e_job;
-            for (e_job = list_begin(&job -> commands); e_job != list_end (&job->commands); e_job = list_next (e_job)) {
-                if (e_job == list_begin(&job -> commands)) {
-                    printf("(");
-                }
-                struct esh_command * cmd = list_entry(e_job, struct esh_command, elem);
-                
-                // Prints the name of the job
-                print_cmd(cmd);
-                
-                if (list_next (e_job) != list_end (&job -> commands)) {
-                    printf(" | ");
-                }
-            }
-            printf(")\n");
-        }
-        else {
-            #ifdef DEBUG_JOBS
-                printf("No Jobs running\n");
-            #endif
-        }
-    }
-    // remove jobs command from pipeline
-    list_pop_front(&cmdline -> pipes);      
-}
-
-void 
-print_job(struct esh_pipeline * job) {
-    struct list_elem * e_job;
-    for (e_job = list_begin(&job -> commands); e_job != list_end (&job->commands); e_job = list_next (e_job)) {
-        if (e_job == list_begin(&job -> commands)) {
-            printf("(");
-        }
-        struct esh_command * cmd = list_entry(e_job, struct esh_command, elem);
-        
-        // Prints the name of the job
-        print_cmd(cmd);
-        
-        if (list_next (e_job) != list_end (&job -> commands)) {
-            printf(" | ");
-        }
-    }
-    printf(")\n");
-}
-
-const char *
-print_job_status(enum job_status status) {
-    static char * status_output[] = {"Running", "Foreground", "Stopped", "Needs Terminal"};
-    
-    switch(status) {
-        case BACKGROUND:
-            return status_output[0];
-            break;
-        case FOREGROUND:
-            return status_output[1];
-            break;
-        case STOPPED:
-            return status_output[2];
-            break;
-        case NEEDSTERMINAL:
-            return NULL; // status_output[3];
-            break;
-        case DONE:
-            return NULL; // status_output[4];
-            break;
-        default:
-            return NULL;
-            break;
-    }
-}
-
-
+/*
+ * esh-print.c
+ * A set of print routines to manage esh objects.
+ *
+ * Developed by Dong Gyu Lee
+ * Virginia Tech.
+ *
+ */
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <dirent.h>
+#include <dlfcn.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "esh.h"
+#include "esh-sys-utils.h"
+#include "esh-utils-jobs.h"
+#include "esh-utils-usage.h"
+
+#define DEBUG 0 
+
+/* Number of finished jobs remembered, see esh_job_record */
+#define FINISHED_JOBS 64
+
+/* ------ JOB TABLE ------ */
+// Indexes over jobs_list, so that reaping a child and looking up a
+// job cost one hash lookup each.  Children are reaped from the
+// SIGCHLD signalfd in the event loop (esh_reap_children), never in
+// a signal handler, so the indexes are only used by the main thread.
+static struct hash jobs_by_jid;
+static struct hash jobs_by_pgid;
+static struct hash commands_by_pid;
+static bool job_table_ready;
+
+/* Jobs in jobs_list by status, so that job slots need not count them */
+static int jobs_in_status[QUEUED + 1];
+
+static struct esh_job_record finished[FINISHED_JOBS];
+static unsigned finished_cnt;       /* total number recorded */
+
+static unsigned
+jid_hash(const struct hash_elem *e, void *aux)
+{
+    return hash_int(hash_entry(e, struct esh_pipeline, jid_elem) -> jid);
+}
+
+static bool
+jid_less(const struct hash_elem *a, const struct hash_elem *b, void *aux)
+{
+    return hash_entry(a, struct esh_pipeline, jid_elem) -> jid
+         < hash_entry(b, struct esh_pipeline, jid_elem) -> jid;
+}
+
+static unsigned
+pgid_hash(const struct hash_elem *e, void *aux)
+{
+    return hash_int(hash_entry(e, struct esh_pipeline, pgid_elem) -> pgid);
+}
+
+static bool
+pgid_less(const struct hash_elem *a, const struct hash_elem *b, void *aux)
+{
+    return hash_entry(a, struct esh_pipeline, pgid_elem) -> pgid
+         < hash_entry(b, struct esh_pipeline, pgid_elem) -> pgid;
+}
+
+static unsigned
+pid_hash(const struct hash_elem *e, void *aux)
+{
+    return hash_int(hash_entry(e, struct esh_command, pid_elem) -> pid);
+}
+
+static bool
+pid_less(const struct hash_elem *a, const struct hash_elem *b, void *aux)
+{
+    return hash_entry(a, struct esh_command, pid_elem) -> pid
+         < hash_entry(b, struct esh_command, pid_elem) -> pid;
+}
+
+static void
+job_table_init(void)
+{
+    hash_init(&jobs_by_jid, jid_hash, jid_less, NULL);
+    hash_init(&jobs_by_pgid, pgid_hash, pgid_less, NULL);
+    hash_init(&commands_by_pid, pid_hash, pid_less, NULL);
+    job_table_ready = true;
+}
+
+/* Append 'job' to jobs_list and index it and its commands.
+ * SIGCHLD must be blocked. */
+void
+esh_job_add(struct esh_pipeline * job)
+{
+    if (!job_table_ready)
+        job_table_init();
+    
+    list_push_back(&jobs_list, &job -> elem);
+    hash_insert(&jobs_by_jid, &job -> jid_elem);
+    jobs_in_status[job -> status]++;
+    esh_job_index(job);
+}
+
+/* Index 'job' by its pgid and the pids of its commands, once they
+ * are known.  SIGCHLD must be blocked. */
+void
+esh_job_index(struct esh_pipeline * job)
+{
+    // Jobs without a process group (queued jobs, in-process filters
+    // only) all share pgid -1 and are not in the pgid index
+    if (job -> pgid > 0)
+        hash_insert(&jobs_by_pgid, &job -> pgid_elem);
+    
+    struct list_elem * e;
+    for (e = list_begin(&job -> commands); e != list_end(&job -> commands); e = list_next(e)) {
+        struct esh_command * cmd = list_entry(e, struct esh_command, elem);
+        if (cmd -> pid > 0)             // in-process filters have no pid
+            hash_insert(&commands_by_pid, &cmd -> pid_elem);
+    }
+}
+
+/* Remove 'job' from jobs_list and the indexes, and remember it as
+ * finished. */
+void
+esh_job_remove(struct esh_pipeline * job)
+{
+    list_remove(&job -> elem);
+    hash_remove(&jobs_by_jid, &job -> jid_elem);
+    jobs_in_status[job -> status]--;
+    if (job -> pgid > 0)
+        hash_remove(&jobs_by_pgid, &job -> pgid_elem);
+    
+    struct list_elem * e;
+    for (e = list_begin(&job -> commands); e != list_end(&job -> commands); e = list_next(e)) {
+        struct esh_command * cmd = list_entry(e, struct esh_command, elem);
+        if (cmd -> pid > 0)
+            hash_remove(&commands_by_pid, &cmd -> pid_elem);
+    }
+    
+    struct esh_job_record * r = &finished[finished_cnt++ % FINISHED_JOBS];
+    r -> jid = job -> jid;
+    r -> pgid = job -> pgid;
+    r -> status = job -> status;
+    r -> exit_status = job -> exit_status;
+}
+
+/* Set the status of 'job', counting it if it is in jobs_list */
+void
+esh_job_set_status(struct esh_pipeline * job, enum job_status status)
+{
+    if (find_job(job -> jid) == job) {
+        jobs_in_status[job -> status]--;
+        jobs_in_status[status]++;
+    }
+    job -> status = status;
+}
+
+/* The number of jobs in jobs_list with status 'status' */
+int
+esh_job_count(enum job_status status)
+{
+    return jobs_in_status[status];
+}
+
+static bool
+stage_less(const struct list_elem *a, const struct list_elem *b, void *aux)
+{
+    return list_entry(a, struct esh_command, elem) -> stage
+         < list_entry(b, struct esh_command, elem) -> stage;
+}
+
+/* Move 'cmd', whose process is gone, from its pipeline's commands
+ * to its done commands, and remove it from the pid index */
+void
+esh_job_remove_command(struct esh_command * cmd)
+{
+    list_remove(&cmd -> elem);
+    list_insert_ordered(&cmd -> pipeline -> done, &cmd -> elem, stage_less, NULL);
+    if (cmd -> pid > 0)
+        hash_remove(&commands_by_pid, &cmd -> pid_elem);
+}
+
+/* The command whose process is 'pid', or NULL */
+struct esh_command *
+find_command(pid_t pid)
+{
+    if (!job_table_ready)
+        return NULL;
+    
+    struct esh_command key;
+    key.pid = pid;
+    struct hash_elem * e = hash_find(&commands_by_pid, &key.pid_elem);
+    return e ? hash_entry(e, struct esh_command, pid_elem) : NULL;
+}
+
+/* The job whose job id is 'jid_look', or NULL */
+struct
+esh_pipeline * find_job(int jid_look) {
+    if (!job_table_ready)
+        return NULL;
+    
+    struct esh_pipeline key;
+    key.jid = jid_look;
+    struct hash_elem * e = hash_find(&jobs_by_jid, &key.jid_elem);
+    return e ? hash_entry(e, struct esh_pipeline, jid_elem) : NULL;
+}
+
+/* The job whose process group is 'pgid', or NULL */
+struct esh_pipeline *
+find_job_by_pgid(pid_t pgid)
+{
+    if (!job_table_ready)
+        return NULL;
+    
+    struct esh_pipeline key;
+    key.pgid = pgid;
+    struct hash_elem * e = hash_find(&jobs_by_pgid, &key.pgid_elem);
+    return e ? hash_entry(e, struct esh_pipeline, pgid_elem) : NULL;
+}
+
+/* The most recently finished job with job id 'jid', if it is among
+ * the last FINISHED_JOBS to finish, or NULL */
+const struct esh_job_record *
+find_finished_job(int jid)
+{
+    unsigned i = finished_cnt;
+    unsigned oldest = finished_cnt > FINISHED_JOBS ? finished_cnt - FINISHED_JOBS : 0;
+    
+    while (i-- > oldest) {
+        if (finished[i % FINISHED_JOBS].jid == jid)
+            return &finished[i % FINISHED_JOBS];
+    }
+    return NULL;
+}
+
+/* List of jobs, for the shell object */
+struct list *
+esh_get_jobs(void)
+{
+    return &jobs_list;
+}
+
+
+void esh_command_jobs(struct esh_command * cmd) {
+    // jobs -l also lists each stage, see esh-utils-usage.h
+    bool long_format = cmd -> argv[1] != NULL && strcmp(cmd -> argv[1], "-l") == 0;
+    
+    struct list_elem * e;
+    for (e = list_begin (&jobs_list); e != list_end (&jobs_list); e = list_next (e)) {
+        struct esh_pipeline * job = list_entry(e, struct esh_pipeline, elem);
+        if (job != NULL) {
+            // Use this instead of list_remove when you want to replicate
+            // Exactly like how shell is behaving
+            // When job status is DONE || TERMINATED, remove from jobs list after displaying "Done"
+            if (job -> status == DONE || job -> status == TERMINATED) {
+                esh_job_remove(job);
+                esh_pipeline_free(job);
+                break;
+            }
+            
+            // The most recent job is denoted as [job_id]+
+            // The second most recent job is denoted as [job_id]- 
+            // Rest jobs are denoted without any +/- symbols [job_id]
+            if (list_next(e) == list_end (&jobs_list)) {
+                printf("[%d]+\t%s        ", job -> jid, print_job_status(job -> status));
+            }
+            else if (list_next(list_next(e)) == list_end(&jobs_list)) {
+                printf("[%d]-\t%s        ", job -> jid, print_job_status(job -> status));
+            }
+            else {
+                printf("[%d]\t%s        ", job -> jid, print_job_status(job -> status));
+            }
+            
+            print_job(stdout, job);
+            if (long_format) {
+                esh_usage_print_stages(stdout, job);
+            }
+        }
+        else {
+            #ifdef DEBUG_JOBS
+                printf("No Jobs running\n");
+            #endif
+        }
+    }
+}
+
+void 
+print_job(FILE * out, struct esh_pipeline * job) {
+    fprintf(out, "(%s)\n", job -> title);
+}
+
+const char *
+print_job_status(enum job_status status) {
+    static char * status_output[] = {"Running", "Foreground", "Stopped", "Needs Terminal", "Queued"};
+    
+    switch(status) {
+        case BACKGROUND:
+            return status_output[0];
+            break;
+        case FOREGROUND:
+            return status_output[1];
+            break;
+        case STOPPED:
+            return status_output[2];
+            break;
+        case NEEDSTERMINAL:
+            return NULL; // status_output[3];
+            break;
+        case DONE:
+            return NULL; // status_output[4];
+            break;
+        case QUEUED:
+            return status_output[4];
+            break;
+        default:
+            return NULL;
+            break;
+    }
+}
+
+
@@ -1,23 +1,66 @@
-#ifndef __ESH_UTILS_JOBS_H
-#define __ESH_UTILS_JOBS_H
-
-/*
- * helper functions for esh-utils
- */
-#include <stdbool.h>
-#include <signal.h>
-#include <stdio.h>
-#include <sys/types.h>
-#include <dirent.h>
-#include <dlfcn.h>
-#include <limits.h>
-
-struct esh_pipeline * find_job(int jid_look);
-
-void esh_command_jobs(struct esh_command_line * cmdline);
-
-void print_job(struct esh_pipeline * job);
-
-const char * print_job_status(enum job_status status);
-
+#ifndef __ESH_UTILS_JOBS_H
+#define __ESH_UTILS_JOBS_H
+
+/*
+ * helper functions for esh-utils
+ */
+#include <stdbool.h>
+#include <signal.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include <dirent.h>
+#include <dlfcn.h>
+#include <limits.h>
+
+/* What is kept of a job once it has finished: no commands, no
+ * terminal state, no arena. */
+struct esh_job_record {
+    int     jid;
+    pid_t   pgid;
+    enum job_status status;     /* DONE or TERMINATED */
+    int     exit_status;
+};
+
+/* Append 'job' to jobs_list and index it by jid, pgid and the pids
+ * of its commands.  SIGCHLD must be blocked. */
+void esh_job_add(struct esh_pipeline * job);
+
+/* Index 'job' by its pgid and pids once its commands have been
+ * started; esh_job_add does this for jobs started before they are
+ * added.  SIGCHLD must be blocked. */
+void esh_job_index(struct esh_pipeline * job);
+
+/* Remove 'job' from jobs_list and the indexes, and keep a record of
+ * it.  The job's memory is left to the caller. */
+void esh_job_remove(struct esh_pipeline * job);
+
+/* Set the status of 'job'.  Every status change of a job in jobs_list
+ * goes through here, so that esh_job_count() stays current. */
+void esh_job_set_status(struct esh_pipeline * job, enum job_status status);
+
+/* The number of jobs in jobs_list with status 'status' */
+int esh_job_count(enum job_status status);
+
+/* Move 'cmd', whose process is gone, from its pipeline's commands
+ * to its done commands, and remove it from the pid index */
+void esh_job_remove_command(struct esh_command * cmd);
+
+/* Lookups; NULL if there is no such job or command */
+struct esh_pipeline * find_job(int jid_look);
+struct esh_pipeline * find_job_by_pgid(pid_t pgid);
+struct esh_command * find_command(pid_t pid);
+
+/* The record of a recently finished job with job id 'jid', or NULL */
+const struct esh_job_record * find_finished_job(int jid);
+
+/* Return the list of jobs, for the shell object */
+struct list * esh_get_jobs(void);
+
+void esh_command_jobs(struct esh_command * cmd);
+
+/* Print the command line of 'job' to 'out', in parentheses */
+void print_job(FILE * out, struct esh_pipeline * job);
+
+const char * print_job_status(enum job_status status);
+
 #endif //__ESH_UTILS_JOBS_H
\ No newline at end of file
@@ -0,0 +1,154 @@
+/*
+ * esh-utils-optimize.c
+ * Pipeline rewriting.  See esh-utils-optimize.h.
+ */
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "esh.h"
+#include "esh-utils-optimize.h"
+#include "esh-utils-builtin.h"
+#include "esh-utils-filter.h"
+#include "esh-utils-plugin.h"
+
+/* --- RULES --- */
+
+/* Is 'cmd' a 'cat' program that only copies its input to the next
+ * stage?  Its arguments are up to the rule. */
+static bool
+is_plain_cat(struct esh_command *cmd)
+{
+    return strcmp(cmd->argv[0], "cat") == 0
+        && cmd->iored_output == NULL
+        && !esh_builtin_exists("cat")
+        && !esh_filter_exists("cat");
+}
+
+/* 'a | cat | b' becomes 'a | b' */
+static int
+rule_middle_cat(struct esh_pipeline *pipe)
+{
+    int removed = 0;
+    struct list_elem * e = list_next (list_begin (&pipe->commands));
+    while (e != list_end (&pipe->commands) && list_next (e) != list_end (&pipe->commands)) {
+        struct esh_command *cmd = list_entry(e, struct esh_command, elem);
+        if (is_plain_cat(cmd) && cmd->argv[1] == NULL && cmd->iored_input == NULL) {
+            e = list_remove(e);
+            removed++;
+        } else {
+            e = list_next (e);
+        }
+    }
+    return removed;
+}
+
+/* Can 'file' be opened for reading?  If not, 'cat' is left to
+ * report it.  O_NONBLOCK keeps a FIFO from blocking the open. */
+static bool
+readable(const char *file)
+{
+    int fd = open(file, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+    close(fd);
+    return true;
+}
+
+/* 'cat FILE | cmd' and 'cat < FILE | cmd' become 'cmd < FILE' */
+static int
+rule_cat_file(struct esh_pipeline *pipe)
+{
+    if (list_begin (&pipe->commands) == list_back (&pipe->commands))
+        return 0;
+
+    struct esh_command *cat = list_entry(list_front (&pipe->commands), struct esh_command, elem);
+    struct esh_command *next = list_entry(list_next (&cat->elem), struct esh_command, elem);
+    if (!is_plain_cat(cat) || next->iored_input)
+        return 0;
+
+    char *file;
+    if (cat->argv[1] && cat->argv[2] == NULL && cat->iored_input == NULL && cat->argv[1][0] != '-')
+        file = cat->argv[1];
+    else if (cat->argv[1] == NULL && cat->iored_input)
+        file = cat->iored_input;
+    else
+        return 0;
+    if (!readable(file))
+        return 0;
+
+    next->iored_input = file;
+    list_remove(&cat->elem);
+    esh_pipeline_finish(pipe);      /* the pipeline's input is now 'next's */
+    return 1;
+}
+
+/* Built-in rules, in the order they are applied */
+static int (* const rules[])(struct esh_pipeline *) = {
+    rule_middle_cat,
+    rule_cat_file,
+    NULL
+};
+
+/* Apply the built-in rules.  Returns the number of stages removed. */
+static int
+apply_rules(struct esh_pipeline *pipe)
+{
+    int i, removed = 0;
+    for (i = 0; rules[i]; i++)
+        removed += rules[i](pipe);
+    return removed;
+}
+
+/* Rewrite 'pipe' in place: the built-in rules, then the plugins'
+ * process_pipeline */
+bool
+esh_pipeline_optimize(struct esh_pipeline *pipe)
+{
+    apply_rules(pipe);
+
+    struct esh_plugin ** plugins = esh_plugin_hook_list(ESH_HOOK_PIPELINE);
+    for (; *plugins; plugins++) {
+        if ((*plugins)->process_pipeline(pipe))
+            return true;
+    }
+    return list_empty(&pipe->commands);
+}
+
+/* --- EXPLAIN --- */
+
+/* explain PIPELINE: print the pipeline as the built-in rules leave it.
+ * Plugins are not consulted: their process_pipeline may act on the
+ * pipeline rather than just rewrite it. */
+static bool
+builtin_explain(struct esh_command *cmd, void *aux)
+{
+    if (cmd->argv[1] == NULL) {
+        printf("esh:    explain: usage: explain pipeline\n");
+        esh_last_status = 2;
+        return true;
+    }
+
+    // The pipeline's first stage is 'explain' and its arguments;
+    // drop the 'explain'.  The pipeline is not run afterwards.
+    char **p = cmd->argv;
+    while ((p[0] = p[1]) != NULL)
+        p++;
+
+    struct esh_pipeline *pipe = cmd->pipeline;
+    int removed = apply_rules(pipe);
+
+    if (removed)
+        printf("esh:    explain: %d stage%s removed\n", removed, removed == 1 ? "" : "s");
+    printf("esh:    explain: built-in rules only; plugins were not consulted\n");
+    esh_pipeline_print(pipe);
+    return true;
+}
+
+/* Register the 'explain' builtin */
+void
+esh_optimize_register(void)
+{
+    esh_builtin_register("explain", builtin_explain, NULL);
+}
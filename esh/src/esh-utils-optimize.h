@@ -0,0 +1,35 @@
+#ifndef __ESH_UTILS_OPTIMIZE_H
+#define __ESH_UTILS_OPTIMIZE_H
+
+/*
+ * Pipeline rewriting.
+ *
+ * Before a pipeline runs, stages that only copy data are taken out:
+ *
+ *      cat FILE | cmd          becomes     cmd < FILE
+ *      cat < FILE | cmd        becomes     cmd < FILE
+ *      a | cat | b             becomes     a | b
+ *
+ * Each removed stage saves a fork, a pipe and a copy of the data.
+ * A 'cat' that is a builtin or a plugin filter is left alone, as is a
+ * 'cat' at the end of a pipeline, whose output may be a terminal
+ * where the previous stage's is a pipe.  So is 'cat FILE' when FILE
+ * cannot be opened for reading, for cat to report it.
+ *
+ * Plugins add their own rules through process_pipeline, which is
+ * called after the built-in rules.  'explain PIPELINE' prints what
+ * the built-in rules make of it, without running it; plugins are not
+ * consulted, since their process_pipeline may have side effects.
+ */
+#include <stdbool.h>
+
+struct esh_pipeline;
+
+/* Rewrite 'pipe' in place.  Returns true if a plugin asked that it
+ * not be run. */
+bool esh_pipeline_optimize(struct esh_pipeline *pipe);
+
+/* Register the 'explain' builtin */
+void esh_optimize_register(void);
+
+#endif //__ESH_UTILS_OPTIMIZE_H
@@ -0,0 +1,376 @@
+/*
+ * esh-utils-parallel.c
+ * The 'parallel' builtin.  See esh-utils-parallel.h.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/signalfd.h>
+
+#include "esh.h"
+#include "arena.h"
+#include "esh-sys-utils.h"
+#include "esh-utils-helper.h"
+#include "esh-utils-jobs.h"
+#include "esh-utils-path.h"
+#include "esh-utils-spawn.h"
+#include "esh-utils-parallel.h"
+
+/* One line of input and the command run for it */
+struct parallel_item {
+    struct list_elem elem;      /* Link element for 'pending', in input order */
+    struct esh_pipeline *job;   /* NULL if the command could not be started */
+    int out_fd;                 /* read end of its output pipe, -1 at EOF */
+    char *out;                  /* output captured so far */
+    size_t out_len, out_cap;
+    bool done;                  /* exited and all output read */
+    int status;                 /* exit status once done */
+};
+
+/* State of one run of parallel */
+struct parallel {
+    bool ordered;               /* write outputs in input order */
+    struct list pending;        /* items whose output is not written yet */
+    struct parallel_item **running;     /* the slots */
+    int slots, nrunning;
+    int failures;
+    char **argv;                /* the command, with {} */
+    bool has_braces;            /* some argument contains {} */
+    int devnull;
+    struct arena *scratch;      /* argument vectors before esh_pipeline_copy */
+};
+
+/* Write all of 'buf' to fd 1 */
+static void
+write_all(const char *buf, size_t len)
+{
+    while (len > 0) {
+        ssize_t n = write(STDOUT_FILENO, buf, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return;
+        buf += n;
+        len -= n;
+    }
+}
+
+/* Replace every '{}' in 'word' with 'item' */
+static char *
+substitute(struct arena *arena, const char *word, const char *item)
+{
+    size_t ilen = strlen(item), len = 0;
+    const char *p;
+    for (p = word; *p; p++) {
+        if (p[0] == '{' && p[1] == '}') {
+            len += ilen;
+            p++;
+        } else {
+            len++;
+        }
+    }
+
+    char *result = arena_alloc(arena, len + 1), *r = result;
+    for (p = word; *p; p++) {
+        if (p[0] == '{' && p[1] == '}') {
+            r = stpcpy(r, item);
+            p++;
+        } else {
+            *r++ = *p;
+        }
+    }
+    *r = '\0';
+    return result;
+}
+
+/* Start the command for 'line' as a job of its own */
+static struct parallel_item *
+item_start(struct parallel *par, const char *line)
+{
+    struct parallel_item *item = calloc(1, sizeof *item);
+    item->out_fd = -1;
+    list_push_back(&par->pending, &item->elem);
+
+    int argc = 0;
+    while (par->argv[argc])
+        argc++;
+    char **argv = arena_alloc(par->scratch, (argc + 2) * sizeof *argv);
+    int i;
+    for (i = 0; i < argc; i++)
+        argv[i] = substitute(par->scratch, par->argv[i], line);
+    if (!par->has_braces)
+        argv[argc++] = arena_strdup(par->scratch, line);
+    argv[argc] = NULL;
+
+    const char *path = esh_path_lookup(argv[0]);
+    if (path == NULL) {
+        fprintf(stderr, "esh: %s: command not found\n", argv[0]);
+        item->done = true;
+        item->status = 127;
+        return item;
+    }
+
+    struct esh_command *cmd = esh_command_create(par->scratch, argv, NULL, NULL, false);
+    cmd->path = arena_strdup(par->scratch, path);
+    struct esh_pipeline *tmp = esh_pipeline_create(par->scratch, cmd);
+    esh_pipeline_finish(tmp);
+
+    int pipefd[2];
+    if (pipe2(pipefd, O_CLOEXEC) < 0) {
+        esh_sys_error("esh: parallel: pipe: ");
+        item->done = true;
+        item->status = 126;
+        return item;
+    }
+
+    struct esh_pipeline *job = esh_pipeline_copy(tmp);
+    struct esh_command *jcmd = list_entry(list_front(&job->commands), struct esh_command, elem);
+
+    // Like a background job, an item never takes the terminal; but it
+    // is waited for like a foreground job, so it is not announced
+    if (list_empty(&jobs_list))
+        job_id = 0;
+    job->jid = ++job_id;
+    job->pgid = -1;
+    job->last_pid = -1;
+    job->exit_status = 0;
+    job->bg_job = true;
+    pid_t pid = esh_spawn_command(jcmd, job, par->devnull, pipefd[1]);
+    close(pipefd[1]);
+    if (pid < 0) {
+        close(pipefd[0]);
+        esh_pipeline_free(job);
+        item->done = true;
+        item->status = 127;
+        return item;
+    }
+
+    jcmd->pid = pid;
+    job->pgid = pid;
+    job->last_pid = pid;
+    esh_job_set_status(job, FOREGROUND);
+    esh_job_add(job);
+
+    item->job = job;
+    item->out_fd = pipefd[0];
+    return item;
+}
+
+/* Read what is available of 'item's output */
+static void
+item_read(struct parallel_item *item)
+{
+    if (item->out_cap - item->out_len < 4096) {
+        item->out_cap = item->out_cap ? 2 * item->out_cap : 8192;
+        item->out = realloc(item->out, item->out_cap);
+    }
+
+    ssize_t n = read(item->out_fd, item->out + item->out_len, item->out_cap - item->out_len);
+    if (n > 0) {
+        item->out_len += n;
+    } else if (n == 0 || errno != EINTR) {
+        close(item->out_fd);
+        item->out_fd = -1;
+    }
+}
+
+/* Has the job of a running item finished? */
+static bool
+item_finished(struct parallel_item *item)
+{
+    if (item->out_fd != -1)
+        return false;
+    if (item->job->status != DONE && item->job->status != TERMINATED)
+        return false;
+
+    // The job has been moved to the reaped jobs; it is freed with them
+    item->status = item->job->exit_status;
+    item->job = NULL;
+    item->done = true;
+    return true;
+}
+
+/* Write and free the outputs that are due */
+static void
+emit(struct parallel *par)
+{
+    struct list_elem *e = list_begin(&par->pending);
+    while (e != list_end(&par->pending)) {
+        struct parallel_item *item = list_entry(e, struct parallel_item, elem);
+        if (!item->done) {
+            if (par->ordered)
+                break;
+            e = list_next(e);
+            continue;
+        }
+
+        write_all(item->out, item->out_len);
+        if (item->status != 0)
+            par->failures++;
+        e = list_remove(e);
+        free(item->out);
+        free(item);
+    }
+}
+
+/* Move finished items out of their slots */
+static void
+collect(struct parallel *par)
+{
+    int i;
+    for (i = 0; i < par->nrunning; ) {
+        if (item_finished(par->running[i]))
+            par->running[i] = par->running[--par->nrunning];
+        else
+            i++;
+    }
+    emit(par);
+}
+
+/* Parse options into 'par'.  Returns the index of the command, or -1 */
+static int
+parse_options(struct parallel *par, char **argv)
+{
+    int i;
+    for (i = 1; argv[i] && argv[i][0] == '-'; i++) {
+        if (strcmp(argv[i], "--") == 0)
+            return argv[i + 1] ? i + 1 : -1;
+        if (strcmp(argv[i], "-u") == 0) {
+            par->ordered = false;
+        } else if (strncmp(argv[i], "-j", 2) == 0) {
+            const char *n = argv[i][2] ? argv[i] + 2 : argv[++i];
+            if (n == NULL || (par->slots = atoi(n)) <= 0)
+                return -1;
+        } else {
+            return -1;
+        }
+    }
+    return argv[i] ? i : -1;
+}
+
+/* Run parallel with arguments 'argv' on fds 0 and 1 */
+int
+esh_parallel(char **argv)
+{
+    struct parallel par = { .ordered = true };
+    par.slots = sysconf(_SC_NPROCESSORS_ONLN);
+
+    int cmd_index = parse_options(&par, argv);
+    if (cmd_index < 0) {
+        fprintf(stderr, "esh: parallel: usage: parallel [-j N] [-u] command [arg ...]\n");
+        return 2;
+    }
+    par.argv = argv + cmd_index;
+    int i;
+    for (i = 0; par.argv[i]; i++)
+        if (strstr(par.argv[i], "{}"))
+            par.has_braces = true;
+
+    // Run as a pipeline stage, in a forked copy of the shell: the
+    // commands belong to this stage's job, and the copy reaps them
+    if (getpid() != shell_pid) {
+        esh_interactive = false;
+        esh_signal_block(SIGCHLD);
+    }
+
+    // Interrupts are read from a signalfd too while commands run, so
+    // they can be passed on rather than end the shell
+    sigset_t intmask;
+    sigemptyset(&intmask);
+    sigaddset(&intmask, SIGINT);
+    sigaddset(&intmask, SIGTSTP);
+    sigprocmask(SIG_BLOCK, &intmask, NULL);
+    int int_fd = signalfd(-1, &intmask, SFD_NONBLOCK | SFD_CLOEXEC);
+
+    FILE *input = fdopen(dup(STDIN_FILENO), "r");
+    par.devnull = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    par.running = calloc(par.slots, sizeof *par.running);
+    par.scratch = arena_create();
+    list_init(&par.pending);
+    fflush(stdout);
+
+    char *line = NULL;
+    size_t linesize = 0;
+    bool more = input != NULL, interrupted = false;
+    struct pollfd *fds = calloc(par.slots + 2, sizeof *fds);
+
+    while (more || par.nrunning > 0) {
+        while (more && par.nrunning < par.slots) {
+            ssize_t len = getline(&line, &linesize, input);
+            if (len < 0) {
+                more = false;
+                break;
+            }
+            if (len > 0 && line[len - 1] == '\n')
+                line[len - 1] = '\0';
+
+            struct parallel_item *item = item_start(&par, line);
+            if (!item->done)
+                par.running[par.nrunning++] = item;
+            emit(&par);
+        }
+        if (par.nrunning == 0)
+            break;
+
+        int nfds = 0;
+        fds[nfds++] = (struct pollfd) { .fd = esh_sigchld_fd(), .events = POLLIN };
+        fds[nfds++] = (struct pollfd) { .fd = int_fd, .events = POLLIN };
+        for (i = 0; i < par.nrunning; i++)
+            fds[nfds++] = (struct pollfd) { .fd = par.running[i]->out_fd, .events = POLLIN };
+
+        if (poll(fds, nfds, -1) < 0 && errno != EINTR)
+            break;
+
+        if (fds[1].revents) {
+            struct signalfd_siginfo info;
+            while (read(int_fd, &info, sizeof info) > 0) {
+                if (info.ssi_signo != SIGINT)
+                    continue;
+                more = false;
+                interrupted = true;
+                for (i = 0; i < par.nrunning; i++) {
+                    struct esh_pipeline *job = par.running[i]->job;
+                    kill(esh_interactive ? -job->pgid : job->last_pid, SIGINT);
+                }
+            }
+        }
+        for (i = 0; i < par.nrunning; i++)
+            if (fds[i + 2].revents)
+                item_read(par.running[i]);
+        if (fds[0].revents)
+            esh_reap_children();
+        collect(&par);
+    }
+
+    // Items that were started but never finished, e.g. after a failed poll
+    emit(&par);
+    while (!list_empty(&par.pending)) {
+        struct parallel_item *item = list_entry(list_pop_front(&par.pending), struct parallel_item, elem);
+        free(item->out);
+        free(item);
+    }
+
+    free(fds);
+    free(line);
+    free(par.running);
+    arena_destroy(par.scratch);
+    close(par.devnull);
+    if (input)
+        fclose(input);
+
+    struct signalfd_siginfo info;
+    while (int_fd >= 0 && read(int_fd, &info, sizeof info) > 0)
+        continue;
+    close(int_fd);
+    sigprocmask(SIG_UNBLOCK, &intmask, NULL);
+
+    if (interrupted)
+        return 128 + SIGINT;
+    return par.failures > 101 ? 101 : par.failures;
+}
@@ -0,0 +1,28 @@
+#ifndef __ESH_UTILS_PARALLEL_H
+#define __ESH_UTILS_PARALLEL_H
+
+/*
+ * The 'parallel' builtin.
+ *
+ *      parallel [-j N] [-u] command [arg ...]
+ *
+ * runs 'command' once for each line read from standard input, with
+ * every '{}' in its arguments replaced by the line, or with the line
+ * appended if there is no '{}'.  Up to N commands (default: one per
+ * online CPU) run at a time.  Each is a job of its own in jobs_list,
+ * launched with posix_spawn, with its output captured through a pipe.
+ * Outputs are written in input order, or with -u in the order the
+ * commands finish.  The exit status is 0 if all commands succeeded,
+ * otherwise the number of failures, up to 101.
+ *
+ * An interrupt stops reading input and is passed on to the running
+ * commands.  As a pipeline stage, parallel runs in a forked copy of
+ * the shell (see esh-utils-simple.h), and the commands stay in that
+ * stage's process group.
+ */
+
+/* Run parallel with arguments 'argv' on fds 0 and 1.
+ * Returns its exit status. */
+int esh_parallel(char **argv);
+
+#endif //__ESH_UTILS_PARALLEL_H
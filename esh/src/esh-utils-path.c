@@ -0,0 +1,317 @@
+/*
+ * esh-utils-path.c
+ * Resolved-path cache for command lookup and the 'hash' builtin.
+ *
+ * Every PATH directory remembers the modification time it had when
+ * it was last searched.  Adding or removing a file changes the
+ * directory's mtime, so when a directory changed, all entries found
+ * in it or in a later directory (which it may now shadow) are
+ * dropped and looked up again.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "esh.h"
+#include "hash.h"
+#include "esh-utils-path.h"
+
+/* Search path used by execvp(3) when PATH is unset */
+#define DEFAULT_PATH "/bin:/usr/bin"
+
+/* A remembered command location */
+struct path_entry {
+    struct hash_elem elem;  /* Link element for 'path_cache' */
+    char *name;             /* argv[0] */
+    char *path;             /* where it was found */
+    int dir_idx;            /* index into 'path.dirs', -1 if seeded */
+    int hits;               /* number of lookups served */
+};
+
+static struct hash path_cache;
+static bool path_cache_ready;
+
+static struct esh_path_dirs path;
+
+static unsigned
+path_entry_hash(const struct hash_elem *e, void *aux)
+{
+    struct path_entry *p = hash_entry(e, struct path_entry, elem);
+    return hash_string(p->name);
+}
+
+static bool
+path_entry_less(const struct hash_elem *a, const struct hash_elem *b, void *aux)
+{
+    struct path_entry *pa = hash_entry(a, struct path_entry, elem);
+    struct path_entry *pb = hash_entry(b, struct path_entry, elem);
+    return strcmp(pa->name, pb->name) < 0;
+}
+
+static void
+path_entry_free(struct hash_elem *e, void *aux)
+{
+    struct path_entry *p = hash_entry(e, struct path_entry, elem);
+    free(p->name);
+    free(p->path);
+    free(p);
+}
+
+static struct path_entry *
+path_entry_find(const char *name)
+{
+    struct path_entry key = { .name = (char *) name };
+    struct hash_elem *e = hash_find(&path_cache, &key.elem);
+    return e ? hash_entry(e, struct path_entry, elem) : NULL;
+}
+
+/* Drop all entries found in directory 'idx' or a later one */
+static void
+invalidate_from(int idx)
+{
+    size_t n = 0;
+    struct path_entry ** stale = malloc(hash_size(&path_cache) * sizeof *stale + 1);
+    struct hash_iterator i;
+
+    hash_first(&i, &path_cache);
+    while (hash_next(&i)) {
+        struct path_entry *p = hash_entry(hash_cur(&i), struct path_entry, elem);
+        if (p->dir_idx >= idx)
+            stale[n++] = p;
+    }
+
+    while (n > 0) {
+        struct path_entry *p = stale[--n];
+        hash_delete(&path_cache, &p->elem);
+        path_entry_free(&p->elem, NULL);
+    }
+    free(stale);
+}
+
+/* Split PATH into 'p' again if it changed */
+bool
+esh_path_dirs_sync(struct esh_path_dirs *p)
+{
+    const char *env = getenv("PATH");
+    if (env == NULL)
+        env = DEFAULT_PATH;
+    if (p->env && strcmp(env, p->env) == 0)
+        return false;
+
+    int i;
+    for (i = 0; i < p->count; i++)
+        free(p->dirs[i].name);
+    free(p->dirs);
+    free(p->env);
+
+    p->env = strdup(env);
+    p->count = 1;
+    const char *c;
+    for (c = env; *c; c++)
+        if (*c == ':')
+            p->count++;
+
+    p->dirs = calloc(p->count, sizeof *p->dirs);
+    const char *start = env;
+    for (i = 0; i < p->count; i++) {
+        size_t len = strcspn(start, ":");
+        /* An empty entry denotes the current directory */
+        p->dirs[i].name = len ? strndup(start, len) : strdup(".");
+        start += len + 1;
+    }
+    return true;
+}
+
+/* Examine 'd' again; true if it changed */
+bool
+esh_path_dir_changed(struct esh_path_dir *d)
+{
+    struct stat st;
+    bool exists = stat(d->name, &st) == 0;
+
+    if (exists == d->exists
+        && (!exists
+            || (st.st_mtim.tv_sec == d->mtime.tv_sec
+                && st.st_mtim.tv_nsec == d->mtime.tv_nsec)))
+        return false;
+
+    d->exists = exists;
+    if (exists)
+        d->mtime = st.st_mtim;
+    return true;
+}
+
+/* Re-examine directory 'idx'.  If its mtime changed since it was
+ * last examined, drop everything that may have been affected. */
+static void
+revalidate_dir(int idx)
+{
+    if (esh_path_dir_changed(&path.dirs[idx]))
+        invalidate_from(idx);
+}
+
+/* Make sure 'path.dirs' reflects the current value of PATH */
+static void
+sync_path_dirs(void)
+{
+    if (!path_cache_ready) {
+        hash_init(&path_cache, path_entry_hash, path_entry_less, NULL);
+        path_cache_ready = true;
+    }
+
+    /* PATH changed: everything found through the old one is suspect */
+    if (esh_path_dirs_sync(&path))
+        invalidate_from(0);
+}
+
+/* Return true if 'path' names an executable regular file */
+static bool
+is_executable(const char *path)
+{
+    struct stat st;
+    return stat(path, &st) == 0 && S_ISREG(st.st_mode) && access(path, X_OK) == 0;
+}
+
+/* Resolve 'name' to the program that would be executed */
+const char *
+esh_path_lookup(const char *name)
+{
+    if (strchr(name, '/'))
+        return name;
+
+    sync_path_dirs();
+
+    struct path_entry *p = path_entry_find(name);
+    if (p) {
+        int i;
+        for (i = 0; i <= p->dir_idx; i++)
+            revalidate_dir(i);
+
+        /* 'p' may have been dropped by revalidate_dir() */
+        p = path_entry_find(name);
+        if (p) {
+            p->hits++;
+            return p->path;
+        }
+    }
+
+    int i;
+    for (i = 0; i < path.count; i++) {
+        char candidate[PATH_MAX];
+
+        revalidate_dir(i);
+        if (!path.dirs[i].exists)
+            continue;
+
+        snprintf(candidate, sizeof candidate, "%s/%s", path.dirs[i].name, name);
+        if (!is_executable(candidate))
+            continue;
+
+        p = malloc(sizeof *p);
+        p->name = strdup(name);
+        p->path = strdup(candidate);
+        p->dir_idx = i;
+        p->hits = 1;
+        hash_insert(&path_cache, &p->elem);
+        return p->path;
+    }
+
+    /* Misses are not remembered so new programs are picked up */
+    return NULL;
+}
+
+/* Forget all remembered locations */
+void
+esh_path_cache_clear(void)
+{
+    if (path_cache_ready)
+        hash_clear(&path_cache, path_entry_free);
+}
+
+/* Remember 'path' as the location of 'name' */
+void
+esh_path_cache_seed(const char *name, const char *path)
+{
+    sync_path_dirs();
+
+    struct path_entry *p = malloc(sizeof *p);
+    p->name = strdup(name);
+    p->path = strdup(path);
+    p->dir_idx = -1;
+    p->hits = 0;
+
+    struct hash_elem *old = hash_replace(&path_cache, &p->elem);
+    if (old)
+        path_entry_free(old, NULL);
+}
+
+/* Forget the location of 'name' */
+bool
+esh_path_cache_delete(const char *name)
+{
+    if (!path_cache_ready)
+        return false;
+
+    struct path_entry key = { .name = (char *) name };
+    struct hash_elem *e = hash_delete(&path_cache, &key.elem);
+    if (e == NULL)
+        return false;
+
+    path_entry_free(e, NULL);
+    return true;
+}
+
+/* Print all remembered locations */
+void
+esh_path_cache_list(void)
+{
+    if (!path_cache_ready || hash_empty(&path_cache)) {
+        printf("esh: hash table empty\n");
+        return;
+    }
+
+    struct hash_iterator i;
+    printf("hits\tcommand\n");
+    hash_first(&i, &path_cache);
+    while (hash_next(&i)) {
+        struct path_entry *p = hash_entry(hash_cur(&i), struct path_entry, elem);
+        printf("%4d\t%s\n", p->hits, p->path);
+    }
+}
+
+/* Implementation of the 'hash' builtin */
+void
+esh_command_hash(struct esh_command *cmd)
+{
+    char **argv = cmd->argv;
+
+    if (argv[1] == NULL) {
+        esh_path_cache_list();
+    }
+    else if (strcmp(argv[1], "-r") == 0) {
+        esh_path_cache_clear();
+    }
+    else if (strcmp(argv[1], "-p") == 0) {
+        if (argv[2] == NULL || argv[3] == NULL) {
+            printf("esh:    hash: usage: hash -p path name\n");
+            return;
+        }
+        esh_path_cache_seed(argv[3], argv[2]);
+    }
+    else if (strcmp(argv[1], "-d") == 0) {
+        char **name;
+        for (name = argv + 2; *name; name++)
+            if (!esh_path_cache_delete(*name))
+                printf("esh:    hash: %s: not found\n", *name);
+    }
+    else {
+        char **name;
+        for (name = argv + 1; *name; name++)
+            if (!strchr(*name, '/') && esh_path_lookup(*name) == NULL)
+                printf("esh:    hash: %s: not found\n", *name);
+    }
+}
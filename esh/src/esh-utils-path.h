@@ -0,0 +1,73 @@
+#ifndef __ESH_UTILS_PATH_H
+#define __ESH_UTILS_PATH_H
+
+/*
+ * Resolved-path cache for command lookup, in the spirit of bash's
+ * 'hash' builtin.
+ *
+ * The shell resolves argv[0] against PATH in the parent, so a child
+ * can execve() a known absolute path and a missing command is
+ * reported without forking.  Entries are keyed by argv[0] and are
+ * dropped when the modification time of a PATH directory at or
+ * before the one they were found in changes, or when PATH itself
+ * changes.  Command completion watches the PATH directories the same
+ * way, through esh_path_dirs_sync() and esh_path_dir_changed().
+ */
+#include <stdbool.h>
+#include <time.h>
+
+struct esh_command;
+
+/* A directory on PATH */
+struct esh_path_dir {
+    char *name;
+    struct timespec mtime;  /* mtime when last examined */
+    bool exists;            /* false if stat() failed */
+};
+
+/* The directories of PATH ("/bin:/usr/bin" if it is unset), in order.
+ * An empty entry denotes the current directory.  Zero-initialize. */
+struct esh_path_dirs {
+    char *env;              /* PATH the directories were split from */
+    struct esh_path_dir *dirs;
+    int count;
+};
+
+/* Split PATH into 'p' again if it changed since the last call.  The
+ * new directories are not yet examined.  Returns true if it did. */
+bool esh_path_dirs_sync(struct esh_path_dirs *p);
+
+/* Examine 'd' again.  Returns true if its mtime changed, or it came
+ * or went, since it was last examined; its files may have changed. */
+bool esh_path_dir_changed(struct esh_path_dir *d);
+
+/* Resolve 'name' to the program that would be executed.
+ * Names containing a '/' are returned as is.
+ * Returns NULL if no executable is found on PATH.
+ * The returned string is owned by the cache and remains valid
+ * until the next lookup or until the cache is cleared. */
+const char * esh_path_lookup(const char *name);
+
+/* Forget all remembered locations */
+void esh_path_cache_clear(void);
+
+/* Remember 'path' as the location of 'name'.  Seeded entries are
+ * not subject to PATH directory invalidation. */
+void esh_path_cache_seed(const char *name, const char *path);
+
+/* Forget the location of 'name'.  Returns false if it was not cached */
+bool esh_path_cache_delete(const char *name);
+
+/* Print all remembered locations */
+void esh_path_cache_list(void);
+
+/* Implementation of the 'hash' builtin.
+ *   hash               list remembered locations
+ *   hash -r            forget all remembered locations
+ *   hash -d name...    forget the location of each name
+ *   hash -p path name  remember 'path' as the location of 'name'
+ *   hash name...       look up and remember each name
+ */
+void esh_command_hash(struct esh_command *cmd);
+
+#endif //__ESH_UTILS_PATH_H
@@ -0,0 +1,1069 @@
+/*
+ * esh-utils-plugin.c
+ * Plugin manifest and lazy loading.  See esh-utils-plugin.h.
+ *
+ * The manifest is a text file in the plugin directory:
+ *
+ *      esh-plugin-manifest 2
+ *      <file> <mtime sec> <mtime nsec> <size> <rank> <hooks> [<name> ...]
+ *
+ * with one line per plugin.  Each name is a builtin, or a stream
+ * filter if it starts with '|'.  It is rewritten whenever a plugin is
+ * added, removed or changed.  If the directory is not writable, the
+ * manifest is simply not cached.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <dirent.h>
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+
+#include "esh.h"
+#include "hash.h"
+#include "esh-utils-plugin.h"
+#include "esh-utils-builtin.h"
+#include "esh-utils-filter.h"
+#include "esh-utils-helper.h"
+#include "esh-utils-prompt.h"
+
+#define PSH_MODULE_NAME "esh_module"
+#define MANIFEST_NAME   ".esh-plugins"
+#define MANIFEST_MAGIC  "esh-plugin-manifest 2"
+
+/* What the shell knows about a plugin file */
+struct plugin_entry {
+    char *path;                 /* directory/file.so */
+    char *file;                 /* file.so, points into 'path' */
+    struct timespec mtime;      /* of the .so that was described */
+    off_t size;
+    int rank;
+    unsigned hooks;             /* ESH_HOOK_* */
+    char **builtins;            /* NULL-terminated builtin_names */
+    char **filters;             /* NULL-terminated filter_names */
+    int dir;                    /* index in 'dirs' */
+    struct esh_plugin *plugin;  /* NULL until loaded */
+    void *handle;               /* dlopen handle, once loaded */
+    int alias_fd;               /* see open_plugin(), or -1 */
+    bool failed;                /* dlopen failed, do not retry */
+    bool disabled;              /* unloaded by 'plugin unload' */
+    bool dead;                  /* replaced or removed; dropped by
+                                   compact_entries() */
+    bool seen;                  /* found by the current scan */
+};
+
+static struct plugin_entry *entries;
+static int nentries, entries_capacity;
+
+/* Hooks for which every plugin implementing them has been loaded */
+static unsigned loaded_hooks;
+
+/* Loaded plugins per hook, see esh_plugin_hook_list() */
+static struct esh_plugin **hook_lists[ESH_HOOK_COUNT];
+static int hook_counts[ESH_HOOK_COUNT];         /* lengths of hook_lists */
+
+/* Directories loaded so far.  The same one may be named twice, as
+ * with 'esh -p plugins' next to the default 'plugins/'. */
+struct plugin_dir {
+    char *name;
+    struct stat st;
+};
+
+static struct plugin_dir *dirs;
+static int ndirs;
+
+/* Plugins unloaded while a thread was still running their code;
+ * they are closed once it is done */
+struct retired_plugin {
+    void *handle;
+    struct esh_plugin *plugin;
+    int alias_fd;
+};
+
+static struct retired_plugin *retired;
+static int nretired;
+
+/* inotify descriptor watching 'dirs', or -1 */
+static int watch_fd = -1;
+
+/* Shell object passed to init(), once esh_plugin_initialize ran */
+static struct esh_shell *plugin_shell;
+
+/* --- DESCRIBING PLUGINS --- */
+
+/* Hook bits of a plugin descriptor */
+static unsigned
+hooks_of(struct esh_plugin *p)
+{
+    unsigned hooks = 0;
+    if (p->process_raw_cmdline)
+        hooks |= 1 << ESH_HOOK_RAW_CMDLINE;
+    if (p->process_pipeline)
+        hooks |= 1 << ESH_HOOK_PIPELINE;
+    if (p->process_builtin && p->builtin_names == NULL)
+        hooks |= 1 << ESH_HOOK_BUILTIN;
+    if (p->make_prompt)
+        hooks |= 1 << ESH_HOOK_PROMPT;
+    if (p->pipeline_forked)
+        hooks |= 1 << ESH_HOOK_FORKED;
+    if (p->command_status_change)
+        hooks |= 1 << ESH_HOOK_STATUS_CHANGE;
+    return hooks;
+}
+
+static char **
+copy_names(const char **names)
+{
+    int n = 0;
+    while (names && names[n])
+        n++;
+
+    char **copy = malloc((n + 1) * sizeof *copy);
+    int i;
+    for (i = 0; i < n; i++)
+        copy[i] = strdup(names[i]);
+    copy[n] = NULL;
+    return copy;
+}
+
+static void
+free_names(char **names)
+{
+    char **n;
+    for (n = names; n && *n; n++)
+        free(*n);
+    free(names);
+}
+
+/* dlopen 'path'.  If an earlier version of it is still mapped, as a
+ * retired plugin, dlopen would hand that back; the new version is then
+ * opened under a name of its own, /proc/self/fd/N, and *alias_fd is
+ * set to N, which must stay open as long as the plugin is loaded so
+ * that the name stays unique.  Otherwise *alias_fd is -1. */
+static void *
+open_plugin(const char *path, int flags, int *alias_fd)
+{
+    *alias_fd = -1;
+    void *old = dlopen(path, RTLD_LAZY | RTLD_NOLOAD);
+    if (old == NULL)
+        return dlopen(path, flags);
+    dlclose(old);
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return NULL;
+    char alias[32];
+    snprintf(alias, sizeof alias, "/proc/self/fd/%d", fd);
+    void *handle = dlopen(alias, flags);
+    if (handle == NULL)
+        close(fd);
+    else
+        *alias_fd = fd;
+    return handle;
+}
+
+static void
+close_plugin(void *handle, int alias_fd)
+{
+    dlclose(handle);
+    if (alias_fd != -1)
+        close(alias_fd);
+}
+
+/* Open the plugin just long enough to read its descriptor */
+static bool
+describe_plugin(struct plugin_entry *entry)
+{
+    int alias_fd;
+    void *handle = open_plugin(entry->path, RTLD_LAZY | RTLD_LOCAL, &alias_fd);
+    if (handle == NULL) {
+        fprintf(stderr, "Could not open %s: %s\n", entry->path, dlerror());
+        return false;
+    }
+
+    struct esh_plugin * p = dlsym(handle, PSH_MODULE_NAME);
+    if (p == NULL) {
+        fprintf(stderr, "%s does not define %s\n", entry->path, PSH_MODULE_NAME);
+        close_plugin(handle, alias_fd);
+        return false;
+    }
+
+    entry->rank = p->rank;
+    entry->hooks = hooks_of(p);
+    entry->builtins = copy_names(p->builtin_names);
+    entry->filters = copy_names(p->run_filter ? p->filter_names : NULL);
+    close_plugin(handle, alias_fd);
+    return true;
+}
+
+/* --- MANIFEST --- */
+
+/* Read the manifest of 'dirname' into a malloc'd array of entries
+ * whose 'path' is only the file name.  Returns the number read. */
+static int
+manifest_read(const char *dirname, struct plugin_entry **cached)
+{
+    char name[PATH_MAX + 1];
+    snprintf(name, sizeof name, "%s/%s", dirname, MANIFEST_NAME);
+
+    *cached = NULL;
+    FILE *f = fopen(name, "re");
+    if (f == NULL)
+        return 0;
+
+    char *line = NULL;
+    size_t linesize = 0;
+    int n = 0, capacity = 0;
+
+    if (getline(&line, &linesize, f) < 0 || strcmp(line, MANIFEST_MAGIC "\n") != 0)
+        goto out;
+
+    while (getline(&line, &linesize, f) > 0) {
+        struct plugin_entry e = { 0 };
+        char *save, *tok;
+        long long sec, nsec, size;
+        int rank;
+        unsigned hooks;
+
+        line[strcspn(line, "\n")] = '\0';
+        tok = strtok_r(line, " ", &save);
+        if (tok == NULL)
+            continue;
+        e.path = tok;
+        tok = strtok_r(NULL, "", &save);
+        int used;
+        if (tok == NULL || sscanf(tok, "%lld %lld %lld %d %u%n",
+                                  &sec, &nsec, &size, &rank, &hooks, &used) != 5)
+            continue;
+
+        e.path = strdup(e.path);
+        e.mtime.tv_sec = sec;
+        e.mtime.tv_nsec = nsec;
+        e.size = size;
+        e.rank = rank;
+        e.hooks = hooks;
+
+        /* the remaining words are builtin and filter names */
+        const char *names[64], *filters[64];
+        int nnames = 0, nfilters = 0;
+        char *word;
+        for (word = strtok_r(tok + used, " ", &save); word;
+             word = strtok_r(NULL, " ", &save)) {
+            if (word[0] == '|' && nfilters < 63)
+                filters[nfilters++] = word + 1;
+            else if (word[0] != '|' && nnames < 63)
+                names[nnames++] = word;
+        }
+        names[nnames] = NULL;
+        filters[nfilters] = NULL;
+        e.builtins = copy_names(names);
+        e.filters = copy_names(filters);
+
+        if (n == capacity) {
+            capacity = capacity ? 2 * capacity : 16;
+            *cached = realloc(*cached, capacity * sizeof **cached);
+        }
+        (*cached)[n++] = e;
+    }
+
+out:
+    free(line);
+    fclose(f);
+    return n;
+}
+
+/* Write the manifest for the entries of directory 'd' */
+static void
+manifest_write(int d)
+{
+    char name[PATH_MAX + 1], tmpname[PATH_MAX + 16];
+    snprintf(name, sizeof name, "%s/%s", dirs[d].name, MANIFEST_NAME);
+    snprintf(tmpname, sizeof tmpname, "%s.%d", name, getpid());
+
+    FILE *f = fopen(tmpname, "we");
+    if (f == NULL)
+        return;
+
+    fprintf(f, "%s\n", MANIFEST_MAGIC);
+    int i;
+    for (i = 0; i < nentries; i++) {
+        struct plugin_entry *e = &entries[i];
+        if (e->dir != d || e->dead || strpbrk(e->file, " \t\n"))
+            continue;
+
+        fprintf(f, "%s %lld %lld %lld %d %u", e->file,
+                (long long) e->mtime.tv_sec, (long long) e->mtime.tv_nsec,
+                (long long) e->size, e->rank, e->hooks);
+        char **n;
+        for (n = e->builtins; *n; n++)
+            fprintf(f, " %s", *n);
+        for (n = e->filters; *n; n++)
+            fprintf(f, " |%s", *n);
+        fprintf(f, "\n");
+    }
+
+    if (fclose(f) != 0 || rename(tmpname, name) != 0)
+        unlink(tmpname);
+}
+
+/* --- LOADING --- */
+
+static bool
+sort_by_rank(const struct list_elem *a,
+             const struct list_elem *b,
+             void *aux __attribute__((unused)))
+{
+    struct esh_plugin * pa =  list_entry(a, struct esh_plugin, elem);
+    struct esh_plugin * pb =  list_entry(b, struct esh_plugin, elem);
+    return pa->rank < pb->rank;
+}
+
+/* Does loaded plugin 'p' implement 'hook'? */
+static bool
+implements(struct esh_plugin *p, enum esh_plugin_hook hook)
+{
+    return (hooks_of(p) & (1 << hook)) != 0;
+}
+
+static void forget_legacy_dispatch(void);
+
+/* Rebuild the per-hook arrays from esh_plugin_list */
+static void
+build_hook_lists(void)
+{
+    forget_legacy_dispatch();
+
+    int hook;
+    for (hook = 0; hook < ESH_HOOK_COUNT; hook++) {
+        int n = 0;
+        struct list_elem * e;
+        for (e = list_begin(&esh_plugin_list); e != list_end(&esh_plugin_list); e = list_next(e))
+            n += implements(list_entry(e, struct esh_plugin, elem), hook);
+
+        struct esh_plugin **list = realloc(hook_lists[hook], (n + 1) * sizeof *list);
+        if (list == NULL)
+            continue;
+
+        n = 0;
+        for (e = list_begin(&esh_plugin_list); e != list_end(&esh_plugin_list); e = list_next(e)) {
+            struct esh_plugin *p = list_entry(e, struct esh_plugin, elem);
+            if (implements(p, hook))
+                list[n++] = p;
+        }
+        list[n] = NULL;
+        hook_lists[hook] = list;
+        hook_counts[hook] = n;
+    }
+}
+
+static void register_names(int i);
+
+/* dlopen a plugin for use, add it to esh_plugin_list and initialize it.
+ * Returns the plugin, or NULL if it cannot be loaded. */
+static struct esh_plugin *
+load_entry(struct plugin_entry *entry)
+{
+    if (entry->plugin || entry->failed || entry->disabled || entry->dead)
+        return entry->plugin;
+
+    entry->failed = true;
+    void *handle = open_plugin(entry->path, RTLD_LAZY, &entry->alias_fd);
+    if (handle == NULL) {
+        fprintf(stderr, "Could not open %s: %s\n", entry->path, dlerror());
+        return NULL;
+    }
+
+    struct esh_plugin * p = dlsym(handle, PSH_MODULE_NAME);
+    if (p == NULL) {
+        fprintf(stderr, "%s does not define %s\n", entry->path, PSH_MODULE_NAME);
+        close_plugin(handle, entry->alias_fd);
+        entry->alias_fd = -1;
+        return NULL;
+    }
+
+    /* The same .so reached through another directory or a hard link:
+     * dlopen handed back the module another entry already loaded.  It
+     * must not be linked into esh_plugin_list twice; the names go back
+     * to the entry that has it. */
+    int i;
+    for (i = 0; i < nentries; i++) {
+        if (entries[i].plugin == p) {
+            fprintf(stderr, "%s is the same module as %s, not loaded again\n",
+                    entry->path, entries[i].path);
+            close_plugin(handle, entry->alias_fd);
+            entry->alias_fd = -1;
+            register_names(i);
+            return p;
+        }
+    }
+
+    entry->failed = false;
+    entry->plugin = p;
+    entry->handle = handle;
+    list_insert_ordered(&esh_plugin_list, &p->elem, sort_by_rank, NULL);
+    build_hook_lists();
+
+    /* plugins loaded before esh_plugin_initialize are initialized there */
+    if (plugin_shell && p->init)
+        p->init(plugin_shell);
+    return p;
+}
+
+/* The plugins implementing 'hook', loading them first if needed */
+struct esh_plugin **
+esh_plugin_hook_list(enum esh_plugin_hook hook)
+{
+    static struct esh_plugin *none[] = { NULL };
+
+    if (!(loaded_hooks & (1 << hook))) {
+        int i;
+        for (i = 0; i < nentries; i++)
+            if (entries[i].hooks & (1 << hook))
+                load_entry(&entries[i]);
+        loaded_hooks |= 1 << hook;
+    }
+    return hook_lists[hook] ? hook_lists[hook] : none;
+}
+
+/* --- LEGACY BUILTINS --- */
+
+/* Plugins that did not declare builtin_names are asked about every
+ * command.  Which of them took a command name, or that none did, is
+ * remembered until the set of plugins changes, so that with many of
+ * them a name is offered to all only once. */
+struct legacy_entry {
+    struct hash_elem elem;      /* Link element for 'legacy_cache' */
+    char *name;
+    unsigned hash;              /* hash_string(name) */
+    struct esh_plugin *plugin;  /* that took 'name', or NULL */
+};
+
+#define LEGACY_CACHE_MAX 256
+
+/* Below this many such plugins, asking each of them is cheaper than
+ * looking the name up (esh-bench dispatch_plugin, dispatch_miss) */
+#define LEGACY_CACHE_MIN_PLUGINS 16
+
+static struct hash legacy_cache;
+static bool legacy_ready;
+static unsigned legacy_generation;      /* of the set of plugins */
+
+static unsigned
+legacy_entry_hash(const struct hash_elem *e, void *aux)
+{
+    return hash_entry(e, struct legacy_entry, elem)->hash;
+}
+
+static bool
+legacy_entry_less(const struct hash_elem *a, const struct hash_elem *b, void *aux)
+{
+    struct legacy_entry *la = hash_entry(a, struct legacy_entry, elem);
+    struct legacy_entry *lb = hash_entry(b, struct legacy_entry, elem);
+    if (la->hash != lb->hash)
+        return la->hash < lb->hash;
+    return strcmp(la->name, lb->name) < 0;
+}
+
+static void
+legacy_entry_free(struct hash_elem *e, void *aux)
+{
+    struct legacy_entry *l = hash_entry(e, struct legacy_entry, elem);
+    free(l->name);
+    free(l);
+}
+
+/* Drop what the plugins did with each name */
+static void
+forget_legacy_dispatch(void)
+{
+    legacy_generation++;
+    if (legacy_ready)
+        hash_clear(&legacy_cache, legacy_entry_free);
+}
+
+/* Remember that 'plugin', or none if NULL, took 'name' */
+static void
+remember_legacy_dispatch(const char *name, unsigned hash, struct esh_plugin *plugin)
+{
+    if (!legacy_ready) {
+        hash_init(&legacy_cache, legacy_entry_hash, legacy_entry_less, NULL);
+        legacy_ready = true;
+    }
+    if (hash_size(&legacy_cache) >= LEGACY_CACHE_MAX)
+        hash_clear(&legacy_cache, legacy_entry_free);
+
+    struct legacy_entry *l = malloc(sizeof *l);
+    if (l == NULL)
+        return;
+    l->name = strdup(name);
+    l->hash = hash;
+    l->plugin = plugin;
+    if (l->name == NULL) {
+        free(l);
+        return;
+    }
+    struct hash_elem *old = hash_replace(&legacy_cache, &l->elem);
+    if (old)
+        legacy_entry_free(old, NULL);
+}
+
+/* Offer 'cmd' to the plugins that did not declare builtin_names.
+ * When there are many, the plugin that took argv[0] before is asked
+ * first; if none did, none is asked. */
+bool
+esh_plugin_process_builtin(struct esh_command *cmd)
+{
+    struct esh_plugin **list = esh_plugin_hook_list(ESH_HOOK_BUILTIN);
+    struct esh_plugin **p;
+    if (hook_counts[ESH_HOOK_BUILTIN] < LEGACY_CACHE_MIN_PLUGINS) {
+        for (p = list; *p; p++)
+            if ((*p)->process_builtin(cmd))
+                return true;
+        return false;
+    }
+
+    const char *name = cmd->argv[0];
+    struct legacy_entry key = { .name = (char *) name, .hash = hash_string(name) };
+    struct hash_elem *e = legacy_ready ? hash_find(&legacy_cache, &key.elem) : NULL;
+    struct esh_plugin *known = NULL;
+    if (e) {
+        known = hash_entry(e, struct legacy_entry, elem)->plugin;
+        if (known == NULL)
+            return false;
+        if (known->process_builtin(cmd))
+            return true;
+    }
+
+    // A builtin may load or unload plugins; what it says about the
+    // previous set is not remembered
+    unsigned generation = legacy_generation;
+    struct esh_plugin *taker = NULL;
+    for (p = list; *p && generation == legacy_generation; p++) {
+        if (*p != known && (*p)->process_builtin(cmd)) {
+            taker = *p;
+            break;
+        }
+    }
+    // The plugin that took the name before may take it with other
+    // arguments, so it stays the one asked first
+    if (generation == legacy_generation && (taker || !known))
+        remember_legacy_dispatch(name, key.hash, taker);
+    return taker != NULL;
+}
+
+/* Registry handler for a builtin declared by a plugin.
+ * 'aux' is the index of the plugin's entry. */
+static bool
+run_plugin_builtin(struct esh_command *cmd, void *aux)
+{
+    struct esh_plugin *p = load_entry(&entries[(intptr_t) aux]);
+    return p && p->process_builtin && p->process_builtin(cmd);
+}
+
+/* Filter resolver for a filter declared by a plugin.
+ * 'aux' is the index of the plugin's entry. */
+static esh_filter_func
+resolve_plugin_filter(const char *name, void *aux)
+{
+    struct esh_plugin *p = load_entry(&entries[(intptr_t) aux]);
+    return p ? p->run_filter : NULL;
+}
+
+/* Enter the builtins and filters of entry 'i' in the registries */
+static void
+register_names(int i)
+{
+    char **n;
+    for (n = entries[i].builtins; *n; n++)
+        esh_builtin_register(*n, run_plugin_builtin, (void *) (intptr_t) i);
+    for (n = entries[i].filters; *n; n++)
+        esh_filter_register(*n, resolve_plugin_filter, (void *) (intptr_t) i);
+}
+
+static void
+unregister_names(struct plugin_entry *e)
+{
+    char **n;
+    for (n = e->builtins; *n; n++)
+        esh_builtin_unregister(*n);
+    for (n = e->filters; *n; n++)
+        esh_filter_unregister(*n);
+}
+
+/* Is 'name' that of a plugin file, ending in ".so"?  Not "x.so.1" or
+ * an editor's "x.so~" */
+static bool
+is_plugin_file(const char *name)
+{
+    size_t len = strlen(name);
+    return len > 3 && strcmp(name + len - 3, ".so") == 0;
+}
+
+/* The live entry of file 'file' in directory 'd', or -1 */
+static int
+find_entry(int d, const char *file)
+{
+    int i;
+    for (i = 0; i < nentries; i++)
+        if (!entries[i].dead && entries[i].dir == d && strcmp(entries[i].file, file) == 0)
+            return i;
+    return -1;
+}
+
+/* Does 'name' in a 'plugin' command, with or without .so, name 'file'? */
+static bool
+names_file(const char *name, const char *file)
+{
+    size_t len = strlen(name);
+    return strncmp(name, file, len) == 0 && (file[len] == '\0' || strcmp(file + len, ".so") == 0);
+}
+
+static bool
+named(char **names, const char *file)
+{
+    for (; names && *names; names++)
+        if (names_file(*names, file))
+            return true;
+    return false;
+}
+
+/* Add an entry for plugin file 'file' of directory 'd', taking its
+ * description from the manifest entries 'cached' if one is current.
+ * *described is set if the plugin had to be opened instead.
+ * Returns the entry's index, or -1 if it is not a usable plugin. */
+static int
+add_entry(int d, const char *file, const struct stat *st,
+          struct plugin_entry *cached, int ncached, bool *described)
+{
+    if (nentries == entries_capacity) {
+        entries_capacity = entries_capacity ? 2 * entries_capacity : 16;
+        entries = realloc(entries, entries_capacity * sizeof *entries);
+    }
+    struct plugin_entry *e = &entries[nentries];
+    memset(e, 0, sizeof *e);
+
+    char modname[PATH_MAX + 1];
+    snprintf(modname, sizeof modname, "%s/%s", dirs[d].name, file);
+    e->path = strdup(modname);
+    e->file = e->path + strlen(dirs[d].name) + 1;
+    e->mtime = st->st_mtim;
+    e->size = st->st_size;
+    e->dir = d;
+    e->alias_fd = -1;
+
+    struct plugin_entry *c = NULL;
+    int i;
+    for (i = 0; i < ncached; i++) {
+        if (cached[i].path && strcmp(cached[i].path, e->file) == 0) {
+            c = &cached[i];
+            break;
+        }
+    }
+
+    *described = false;
+    if (c && c->mtime.tv_sec == e->mtime.tv_sec
+          && c->mtime.tv_nsec == e->mtime.tv_nsec && c->size == e->size) {
+        e->rank = c->rank;
+        e->hooks = c->hooks;
+        e->builtins = c->builtins;
+        e->filters = c->filters;
+        c->builtins = NULL;
+        c->filters = NULL;
+    } else {
+        *described = true;
+        if (!describe_plugin(e)) {
+            free(e->path);
+            return -1;
+        }
+    }
+    return nentries++;
+}
+
+static void unload_entry(struct plugin_entry *e);
+
+/* Bring the entries of directory 'd' up to date with its files: add
+ * the new plugins, replace the changed ones and drop the removed
+ * ones.  A changed plugin that was loaded is loaded again right away.
+ * Plugins in 'reload' are replaced even if unchanged.  Each change is
+ * listed on 'report', if not NULL.  Returns the number of changes. */
+static int
+scan_directory(int d, char **reload, FILE *report)
+{
+    DIR * dir = opendir(dirs[d].name);
+    if (dir == NULL) {
+        perror("opendir");
+        return 0;
+    }
+
+    struct plugin_entry *cached;
+    int ncached = manifest_read(dirs[d].name, &cached);
+    int changes = 0, live = 0, i;
+    bool rewrite = false;
+
+    for (i = 0; i < nentries; i++)
+        entries[i].seen = false;
+
+    struct dirent * dentry;
+    while ((dentry = readdir(dir)) != NULL) {
+        if (!is_plugin_file(dentry->d_name))
+            continue;
+
+        char modname[PATH_MAX + 1];
+        snprintf(modname, sizeof modname, "%s/%s", dirs[d].name, dentry->d_name);
+        struct stat st;
+        if (stat(modname, &st) != 0)
+            continue;
+
+        int old = find_entry(d, dentry->d_name);
+        if (old >= 0 && !named(reload, dentry->d_name)
+                     && entries[old].mtime.tv_sec == st.st_mtim.tv_sec
+                     && entries[old].mtime.tv_nsec == st.st_mtim.tv_nsec
+                     && entries[old].size == st.st_size) {
+            entries[old].seen = true;
+            live++;
+            continue;
+        }
+
+        // The new version is described first; if it cannot be, the
+        // old one stays.  open_plugin() keeps dlopen from handing back
+        // the old one.
+        bool described;
+        int e = add_entry(d, dentry->d_name, &st, cached, ncached, &described);
+        if (e < 0 && old >= 0) {
+            fprintf(stderr, "esh: keeping the loaded version of %s\n", entries[old].path);
+            entries[old].seen = true;
+            live++;
+            continue;
+        }
+        rewrite = rewrite || described || old >= 0;
+        if (e < 0)
+            continue;
+
+        bool reopen = false;
+        if (old >= 0) {
+            reopen = entries[old].plugin != NULL;
+            unload_entry(&entries[old]);
+            entries[old].dead = true;
+        }
+        entries[e].seen = true;
+        live++;
+        register_names(e);
+        if (reopen)
+            load_entry(&entries[e]);
+
+        changes++;
+        if (report)
+            fprintf(report, " %s (%s)", entries[e].file, old >= 0 ? "reloaded" : "added");
+    }
+    closedir(dir);
+
+    for (i = 0; i < nentries; i++) {
+        struct plugin_entry *e = &entries[i];
+        if (e->dir != d || e->dead || e->seen)
+            continue;
+        unload_entry(e);
+        e->dead = true;
+        rewrite = true;
+        changes++;
+        if (report)
+            fprintf(report, " %s (removed)", e->file);
+    }
+
+    for (i = 0; i < ncached; i++) {
+        free(cached[i].path);
+        free_names(cached[i].builtins);
+        free_names(cached[i].filters);
+    }
+    free(cached);
+
+    if (rewrite || ncached != live)
+        manifest_write(d);
+    return changes;
+}
+
+/* Load plugins from directory dirname.
+ * Only new or changed plugins are opened, to describe them. */
+void
+esh_plugin_load_from_directory(char *dirname)
+{
+    struct stat dst;
+    if (stat(dirname, &dst) != 0) {
+        perror("opendir");
+        return;
+    }
+
+    int d;
+    for (d = 0; d < ndirs; d++)
+        if (dirs[d].st.st_dev == dst.st_dev && dirs[d].st.st_ino == dst.st_ino)
+            return;
+    // Rescans must find it after a 'cd'
+    char *name = realpath(dirname, NULL);
+    dirs = realloc(dirs, (ndirs + 1) * sizeof *dirs);
+    dirs[ndirs].name = name ? name : strdup(dirname);
+    dirs[ndirs].st = dst;
+    ndirs++;
+    if (watch_fd != -1)
+        inotify_add_watch(watch_fd, dirs[d].name, IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE);
+
+    scan_directory(d, NULL, NULL);
+
+    /* new plugins may implement hooks that were already loaded */
+    loaded_hooks = 0;
+}
+
+/* Initialize loaded plugins.
+ * Plugins loaded later are initialized as they are loaded. */
+void
+esh_plugin_initialize(struct esh_shell *shell)
+{
+    plugin_shell = shell;
+
+    /* Sort plugins and call init() method. */
+    list_sort(&esh_plugin_list, sort_by_rank, NULL);
+    build_hook_lists();
+
+    struct list_elem * e = list_begin(&esh_plugin_list);
+    for (; e != list_end(&esh_plugin_list); e = list_next(e)) {
+        struct esh_plugin *plugin = list_entry(e, struct esh_plugin, elem);
+        if (plugin->init)
+            plugin->init(shell);
+    }
+}
+
+/* --- UNLOADING AND RELOADING --- */
+
+/* Is a thread other than the main thread running code of 'p'? */
+static bool
+plugin_busy(struct esh_plugin *p)
+{
+    return (p->run_filter && esh_filter_running(p->run_filter)) || esh_prompt_running(p);
+}
+
+/* Close the retired plugins no thread runs anymore */
+static void
+close_retired(void)
+{
+    int i, n = 0;
+    for (i = 0; i < nretired; i++) {
+        if (plugin_busy(retired[i].plugin))
+            retired[n++] = retired[i];
+        else
+            close_plugin(retired[i].handle, retired[i].alias_fd);
+    }
+    nretired = n;
+}
+
+/* Take entry 'e' out of the registries, the plugin list and the hook
+ * lists, and close its plugin if it was loaded.  Its builtins and
+ * filters are gone, and the shell builtins they overrode are missing,
+ * until register_all() rebuilds the registries.  A plugin whose filter or prompt fragment is still
+ * running on a thread is closed later, by close_retired(). */
+static void
+unload_entry(struct plugin_entry *e)
+{
+    unregister_names(e);
+    if (e->plugin == NULL)
+        return;
+
+    list_remove(&e->plugin->elem);
+    build_hook_lists();
+    esh_prompt_release(e->plugin);
+
+    if (plugin_busy(e->plugin)) {
+        retired = realloc(retired, (nretired + 1) * sizeof *retired);
+        retired[nretired++] = (struct retired_plugin) { e->handle, e->plugin, e->alias_fd };
+    } else {
+        close_plugin(e->handle, e->alias_fd);
+    }
+    e->plugin = NULL;
+    e->handle = NULL;
+    e->alias_fd = -1;
+}
+
+/* Drop the dead entries.  The registries hold entry indexes, which
+ * this changes, so register_all() must follow. */
+static void
+compact_entries(void)
+{
+    int i, n = 0;
+    for (i = 0; i < nentries; i++) {
+        struct plugin_entry *e = &entries[i];
+        if (e->dead) {
+            free(e->path);
+            free_names(e->builtins);
+            free_names(e->filters);
+        } else {
+            entries[n++] = *e;
+        }
+    }
+    nentries = n;
+}
+
+/* Rebuild the registries: the shell's builtins, which restores those
+ * an unloaded plugin overrode, then the names of all entries in use,
+ * in the order they were added, so that later plugins override
+ * earlier ones as at startup.  A plugin that failed to load does not
+ * hide a shell builtin. */
+static void
+register_all(void)
+{
+    compact_entries();
+    esh_register_builtins();
+
+    int i;
+    for (i = 0; i < nentries; i++)
+        if (!entries[i].disabled && !entries[i].failed)
+            register_names(i);
+}
+
+static double
+ms_since(const struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1e3 + (now.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+/* Rescan the plugin directories and apply what changed */
+int
+esh_plugin_reload(char **reload, FILE *report)
+{
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    close_retired();
+
+    char *changed = NULL;
+    size_t size = 0;
+    FILE *list = open_memstream(&changed, &size);
+    int changes = 0, d;
+    for (d = 0; d < ndirs; d++)
+        changes += scan_directory(d, reload, list);
+    fclose(list);
+
+    register_all();
+    loaded_hooks = 0;               /* new plugins may implement loaded hooks */
+
+    if (report && changes)
+        fprintf(report, "esh: plugins reloaded in %.2f ms:%s\n", ms_since(&start), changed);
+    else if (report)
+        fprintf(report, "esh: no plugins changed (%.2f ms)\n", ms_since(&start));
+    free(changed);
+    return changes;
+}
+
+/* Watch the plugin directories for changes */
+int
+esh_plugin_watch(void)
+{
+    if (watch_fd != -1)
+        return watch_fd;
+
+    watch_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    int d;
+    for (d = 0; watch_fd != -1 && d < ndirs; d++)
+        inotify_add_watch(watch_fd, dirs[d].name, IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE);
+    return watch_fd;
+}
+
+/* Read the pending events of the watch descriptor */
+bool
+esh_plugin_watch_event(void)
+{
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    bool plugin_changed = false;
+    ssize_t len;
+
+    while ((len = read(watch_fd, buf, sizeof buf)) > 0) {
+        char *p = buf;
+        while (p < buf + len) {
+            struct inotify_event *ev = (struct inotify_event *) p;
+            if (ev->len > 0 && is_plugin_file(ev->name))
+                plugin_changed = true;
+            p += sizeof *ev + ev->len;
+        }
+    }
+    return plugin_changed;
+}
+
+/* --- PLUGIN --- */
+
+static const char *
+entry_state(struct plugin_entry *e)
+{
+    if (e->disabled)
+        return "unloaded";
+    if (e->failed)
+        return "failed";
+    return e->plugin ? "loaded" : "lazy";
+}
+
+/* plugin [list | reload [name ...] | unload name ...] */
+static bool
+builtin_plugin(struct esh_command *cmd, void *aux)
+{
+    char *verb = cmd->argv[1] ? cmd->argv[1] : "list";
+    char **names = cmd->argv[1] ? cmd->argv + 2 : cmd->argv + 1;
+    int i;
+
+    if (strcmp(verb, "list") == 0 && *names == NULL) {
+        for (i = 0; i < nentries; i++) {
+            struct plugin_entry *e = &entries[i];
+            if (e->dead)
+                continue;
+            printf("%-24s rank %-4d %-9s", e->path, e->rank, entry_state(e));
+            char **n;
+            for (n = e->builtins; *n; n++)
+                printf(" %s", *n);
+            for (n = e->filters; *n; n++)
+                printf(" |%s", *n);
+            printf("\n");
+        }
+        return true;
+    }
+
+    if (strcmp(verb, "reload") == 0) {
+        esh_plugin_reload(names, stdout);
+        return true;
+    }
+
+    if (strcmp(verb, "unload") == 0 && *names) {
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (; *names; names++) {
+            bool found = false;
+            for (i = 0; i < nentries; i++) {
+                struct plugin_entry *e = &entries[i];
+                if (e->dead || !names_file(*names, e->file))
+                    continue;
+                unload_entry(e);
+                e->disabled = true;
+                found = true;
+            }
+            if (!found) {
+                printf("esh:    plugin: %s: no such plugin\n", *names);
+                esh_last_status = 1;
+            }
+        }
+        register_all();
+        printf("esh: plugins unloaded in %.2f ms\n", ms_since(&start));
+        return true;
+    }
+
+    printf("esh:    plugin: usage: plugin [list | reload [name ...] | unload name ...]\n");
+    esh_last_status = 2;
+    return true;
+}
+
+/* Register the 'plugin' builtin */
+void
+esh_plugin_register(void)
+{
+    esh_builtin_register("plugin", builtin_plugin, NULL);
+}
@@ -0,0 +1,84 @@
+#ifndef __ESH_UTILS_PLUGIN_H
+#define __ESH_UTILS_PLUGIN_H
+
+/*
+ * Plugin manifest and lazy loading.
+ *
+ * esh_plugin_load_from_directory() does not dlopen the plugins it
+ * finds.  It consults a manifest cached in the plugin directory
+ * (see MANIFEST_NAME in esh-utils-plugin.c), which records for each
+ * .so its rank, the hooks it implements, and the builtin commands and
+ * stream filters it declares in 'builtin_names' and 'filter_names'.
+ * Only plugins that are new or whose .so changed since (by mtime and
+ * size) are opened to describe them.
+ *
+ * A plugin is loaded, inserted into esh_plugin_list by rank, and
+ * initialized when one of its commands is first run or when one of
+ * its hooks is first needed.  The declared names go into the builtin
+ * registry (esh-utils-builtin.h) and the filter registry
+ * (esh-utils-filter.h) right away.  For each hook there is a
+ * NULL-terminated array of the plugins implementing it, in rank
+ * order, so running a hook does not walk esh_plugin_list.  A .so
+ * reached under two names, through a hard link or another directory,
+ * is loaded once; the other entry shows as failed.
+ *
+ * esh_plugin_reload() rescans the plugin directories.  A plugin whose
+ * .so changed is unloaded: its names leave the registries, it leaves
+ * esh_plugin_list and the hook arrays, and it is dlclose'd.  If it had
+ * been loaded, the new version is loaded and initialized right away;
+ * otherwise it stays lazy.  If the new version cannot be opened, the
+ * old one stays in use.  New plugins are added and removed ones
+ * unloaded, and a shell builtin that an unloaded plugin overrode is
+ * registered again.  A plugin whose filter or prompt fragment is
+ * running on a thread when it is unloaded stays mapped until that is
+ * done.  Jobs are not touched; a forked child has its own copy of the
+ * plugin.  Only files whose names end in ".so" are plugins.
+ */
+#include <stdbool.h>
+#include <stdio.h>
+
+struct esh_plugin;
+struct esh_command;
+
+/* Hook kinds.  The manifest records them as a mask of (1 << hook). */
+enum esh_plugin_hook {
+    ESH_HOOK_RAW_CMDLINE,       /* process_raw_cmdline */
+    ESH_HOOK_PIPELINE,          /* process_pipeline */
+    ESH_HOOK_BUILTIN,           /* process_builtin without declared
+                                   builtin_names */
+    ESH_HOOK_PROMPT,            /* make_prompt */
+    ESH_HOOK_FORKED,            /* pipeline_forked */
+    ESH_HOOK_STATUS_CHANGE,     /* command_status_change */
+    ESH_HOOK_COUNT
+};
+
+/* The plugins implementing 'hook', in rank order, NULL-terminated.
+ * Loads them first if needed.  The array is valid until the next
+ * plugin is loaded. */
+struct esh_plugin ** esh_plugin_hook_list(enum esh_plugin_hook hook);
+
+/* Offer 'cmd' to the plugins that did not declare builtin_names.
+ * Returns true if one of them handled it.  Such plugins are taken to
+ * decide by argv[0]: until the set of plugins changes, a name none of
+ * them took is not offered again, and one a plugin took is offered to
+ * that plugin first. */
+bool esh_plugin_process_builtin(struct esh_command *cmd);
+
+/* Rescan the plugin directories and apply what changed.  Plugins
+ * named in the NULL-terminated 'reload', with or without ".so", are
+ * reloaded even if unchanged.  The changes and the time taken are
+ * reported on 'report', if not NULL.  Returns the number of changes. */
+int esh_plugin_reload(char **reload, FILE *report);
+
+/* An inotify descriptor watching the plugin directories, readable when
+ * one changes, or -1 */
+int esh_plugin_watch(void);
+
+/* Consume the events on esh_plugin_watch().
+ * Returns true if a plugin file was among the files changed. */
+bool esh_plugin_watch_event(void);
+
+/* Register the 'plugin' builtin */
+void esh_plugin_register(void);
+
+#endif //__ESH_UTILS_PLUGIN_H
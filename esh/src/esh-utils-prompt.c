@@ -0,0 +1,364 @@
+/*
+ * esh-utils-prompt.c
+ * Prompt assembly on worker threads.  See esh-utils-prompt.h.
+ */
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include "esh.h"
+#include "esh-utils-plugin.h"
+#include "esh-utils-prompt.h"
+
+#define DEFAULT_BUDGET_MS 50
+#define DEFAULT_PROMPT "esh> "
+
+/* The fragment of one plugin.  'shown' and 'plugin' belong to the
+ * main thread; the rest is shared, under 'lock'. */
+struct fragment {
+    struct esh_plugin *plugin;
+    pthread_cond_t wake;        /* the worker waits here to be asked */
+    bool threaded;              /* false: no worker, computed inline */
+    bool asked;                 /* a fresh value is wanted */
+    bool busy;                  /* asked, and not yet delivered */
+    bool quit;                  /* the plugin is gone, the worker is to exit */
+    bool exited;                /* the worker is done with this */
+    char *fresh;                /* delivered and not taken yet */
+    char *shown;                /* the value in the last prompt */
+};
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t delivered;
+
+static struct fragment **fragments;
+static int nfragments;
+
+/* Fragments whose workers were told to quit, until they have */
+static struct fragment **retiring;
+static int nretiring;
+
+static int budget_ms = DEFAULT_BUDGET_MS;
+static int notify_fd = -1;
+
+static void
+setup(void)
+{
+    if (notify_fd != -1)
+        return;
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&delivered, &attr);
+    pthread_condattr_destroy(&attr);
+
+    notify_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+}
+
+/* Set the shell's budget, in ms, for threaded fragments */
+void
+esh_prompt_set_budget(int ms)
+{
+    budget_ms = ms < 0 ? DEFAULT_BUDGET_MS : ms;
+}
+
+/* --- WORKERS --- */
+
+static void
+fragment_free(struct fragment *f)
+{
+    pthread_cond_destroy(&f->wake);
+    free(f->fresh);
+    free(f->shown);
+    free(f);
+}
+
+/* Call make_prompt whenever asked, until told to quit */
+static void *
+worker(void *arg)
+{
+    struct fragment *f = arg;
+
+    pthread_mutex_lock(&lock);
+    for (;;) {
+        while (!f->asked && !f->quit)
+            pthread_cond_wait(&f->wake, &lock);
+        if (f->quit)
+            break;
+        f->asked = false;
+        pthread_mutex_unlock(&lock);
+
+        char *p = f->plugin->make_prompt();
+
+        pthread_mutex_lock(&lock);
+        free(f->fresh);
+        f->fresh = p ? p : strdup("");
+        f->busy = false;
+        pthread_cond_broadcast(&delivered);
+
+        // Wakes the line editor, in case the prompt went out without it
+        uint64_t one = 1;
+        ssize_t n = write(notify_fd, &one, sizeof one);
+        (void) n;                       /* if it fails, it is readable already */
+    }
+    f->exited = true;
+    pthread_mutex_unlock(&lock);
+    return NULL;
+}
+
+/* A fragment for 'plugin', with a worker if it asks for one and one
+ * can be started */
+static struct fragment *
+fragment_create(struct esh_plugin *plugin)
+{
+    struct fragment *f = calloc(1, sizeof *f);
+    f->plugin = plugin;
+    pthread_cond_init(&f->wake, NULL);
+    if (!plugin->prompt_threaded)
+        return f;
+
+    // Signals are for the main thread, and for children it forks
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+
+    pthread_t thread;
+    f->threaded = pthread_create(&thread, NULL, worker, f) == 0;
+    if (f->threaded)
+        pthread_detach(thread);
+
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    return f;
+}
+
+/* Let the worker of 'f' go, or free 'f' if it has none */
+static void
+fragment_retire(struct fragment *f)
+{
+    if (!f->threaded) {
+        fragment_free(f);
+        return;
+    }
+    pthread_mutex_lock(&lock);
+    f->quit = true;
+    pthread_cond_signal(&f->wake);
+    pthread_mutex_unlock(&lock);
+
+    retiring = realloc(retiring, (nretiring + 1) * sizeof *retiring);
+    retiring[nretiring++] = f;
+}
+
+/* Free the retired fragments whose workers have exited.
+ * Called with 'lock' held. */
+static void
+reap_retired(void)
+{
+    int i, n = 0;
+    for (i = 0; i < nretiring; i++) {
+        if (retiring[i]->exited)
+            fragment_free(retiring[i]);
+        else
+            retiring[n++] = retiring[i];
+    }
+    nretiring = n;
+}
+
+/* Stop asking 'plugin' for fragments */
+void
+esh_prompt_release(struct esh_plugin *plugin)
+{
+    int i;
+    for (i = 0; i < nfragments; i++) {
+        if (fragments[i]->plugin == plugin) {
+            fragment_retire(fragments[i]);
+            memmove(fragments + i, fragments + i + 1, (nfragments - i - 1) * sizeof *fragments);
+            nfragments--;
+            return;
+        }
+    }
+}
+
+/* True while a worker may still be in the make_prompt of 'plugin' */
+bool
+esh_prompt_running(struct esh_plugin *plugin)
+{
+    bool running = false;
+    int i;
+
+    pthread_mutex_lock(&lock);
+    reap_retired();
+    for (i = 0; i < nretiring; i++)
+        running = running || retiring[i]->plugin == plugin;
+    for (i = 0; i < nfragments; i++)
+        running = running || (fragments[i]->plugin == plugin && fragments[i]->busy);
+    pthread_mutex_unlock(&lock);
+    return running;
+}
+
+/* Match the fragments to 'plugins', the plugins implementing
+ * make_prompt in rank order, keeping those of plugins still there */
+static void
+sync_fragments(struct esh_plugin **plugins)
+{
+    int n = 0, i, j;
+    bool same = true;
+    for (n = 0; plugins[n]; n++)
+        same = same && n < nfragments && fragments[n]->plugin == plugins[n];
+    if (same && n == nfragments)
+        return;
+
+    struct fragment **updated = calloc(n, sizeof *updated);
+    for (i = 0; i < n; i++) {
+        for (j = 0; j < nfragments; j++) {
+            if (fragments[j] && fragments[j]->plugin == plugins[i]) {
+                updated[i] = fragments[j];
+                fragments[j] = NULL;
+                break;
+            }
+        }
+        if (updated[i] == NULL)
+            updated[i] = fragment_create(plugins[i]);
+    }
+    for (j = 0; j < nfragments; j++)
+        if (fragments[j])
+            fragment_retire(fragments[j]);
+
+    free(fragments);
+    fragments = updated;
+    nfragments = n;
+}
+
+/* --- ASSEMBLY --- */
+
+/* Move the delivered values to 'shown'.  Called with 'lock' held.
+ * Returns true if there were any. */
+static bool
+take_fresh(void)
+{
+    bool any = false;
+    int i;
+    for (i = 0; i < nfragments; i++) {
+        struct fragment *f = fragments[i];
+        if (f->fresh) {
+            free(f->shown);
+            f->shown = f->fresh;
+            f->fresh = NULL;
+            any = true;
+        }
+    }
+    return any;
+}
+
+/* Join the shown fragments, in one allocation */
+static char *
+assemble(void)
+{
+    size_t lengths[nfragments ? nfragments : 1];
+    size_t total = 0;
+    int i;
+    for (i = 0; i < nfragments; i++) {
+        lengths[i] = fragments[i]->shown ? strlen(fragments[i]->shown) : 0;
+        total += lengths[i];
+    }
+    if (total == 0)
+        return strdup(DEFAULT_PROMPT);
+
+    char *prompt = malloc(total + 1), *p = prompt;
+    for (i = 0; i < nfragments; i++) {
+        memcpy(p, fragments[i]->shown, lengths[i]);
+        p += lengths[i];
+    }
+    *p = '\0';
+    return prompt;
+}
+
+static void
+drain_notifications(void)
+{
+    uint64_t count;
+    while (read(notify_fd, &count, sizeof count) > 0)
+        ;
+}
+
+/* Build the prompt, as shell.build_prompt */
+char *
+esh_prompt_build(void)
+{
+    setup();
+    sync_fragments(esh_plugin_hook_list(ESH_HOOK_PROMPT));
+    drain_notifications();
+
+    int i;
+    for (i = 0; i < nfragments; i++) {
+        struct fragment *f = fragments[i];
+        if (!f->threaded) {
+            char *p = f->plugin->make_prompt();
+            free(f->fresh);
+            f->fresh = p ? p : strdup("");
+        }
+    }
+
+    // Ask every idle worker, then wait for each until its own
+    // deadline, counted from now
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    pthread_mutex_lock(&lock);
+    for (i = 0; i < nfragments; i++) {
+        struct fragment *f = fragments[i];
+        if (f->threaded && !f->busy) {
+            f->busy = f->asked = true;
+            pthread_cond_signal(&f->wake);
+        }
+    }
+    for (i = 0; i < nfragments; i++) {
+        struct fragment *f = fragments[i];
+        int ms = f->plugin->prompt_budget_ms > 0 ? f->plugin->prompt_budget_ms : budget_ms;
+        struct timespec deadline = start;
+        deadline.tv_sec += ms / 1000;
+        deadline.tv_nsec += (ms % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+
+        while (f->busy) {
+            int rc = ms == 0 ? pthread_cond_wait(&delivered, &lock)
+                             : pthread_cond_timedwait(&delivered, &lock, &deadline);
+            if (rc == ETIMEDOUT)
+                break;
+        }
+    }
+    take_fresh();
+    reap_retired();
+    pthread_mutex_unlock(&lock);
+
+    return assemble();
+}
+
+/* A descriptor that becomes readable when a late fragment arrives */
+int
+esh_prompt_fd(void)
+{
+    setup();
+    return notify_fd;
+}
+
+/* The prompt with the fragments that arrived late, or NULL */
+char *
+esh_prompt_refresh(void)
+{
+    drain_notifications();
+
+    pthread_mutex_lock(&lock);
+    bool any = take_fresh();
+    pthread_mutex_unlock(&lock);
+
+    return any ? assemble() : NULL;
+}
@@ -0,0 +1,53 @@
+#ifndef __ESH_UTILS_PROMPT_H
+#define __ESH_UTILS_PROMPT_H
+
+/*
+ * Prompt assembly from the plugins implementing 'make_prompt'.
+ *
+ * By default make_prompt is called on the main thread, and the prompt
+ * waits for it.  A plugin that sets prompt_threaded gets a worker
+ * thread that calls its make_prompt instead.  Before a prompt, every
+ * worker that is idle is asked for a fresh fragment, and the shell
+ * waits for each at most its budget: the plugin's prompt_budget_ms,
+ * or else the shell's (ESH_PROMPT_BUDGET, in ms; 50 by default, 0 to
+ * wait as long as it takes).  The budgets run concurrently, from when
+ * the workers are asked, so the prompt waits for the longest of them,
+ * not for their sum.  A fragment that is late is shown as it was last
+ * time, and its worker is not asked again until it has delivered.
+ * When it does, esh_prompt_fd() becomes readable and the line editor
+ * can redraw the prompt with esh_prompt_refresh().
+ *
+ * The fragments are joined in rank order with one allocation.  If
+ * there are no fragments, or they are all empty, the prompt is the
+ * default "esh> ".
+ *
+ * A plugin that is unloaded is released first; its worker exits once
+ * it returns from make_prompt, which the plugin loader waits for
+ * before it closes the plugin.
+ */
+#include <stdbool.h>
+
+struct esh_plugin;
+
+/* Set the shell's budget, in ms, for a threaded fragment whose plugin
+ * sets none.  0 waits for it. */
+void esh_prompt_set_budget(int ms);
+
+/* Build the prompt, as shell.build_prompt.  The result is malloc'd. */
+char * esh_prompt_build(void);
+
+/* A descriptor that becomes readable when a late fragment arrives */
+int esh_prompt_fd(void);
+
+/* Take the fragments that arrived since the last build or refresh.
+ * Returns the prompt with them, malloc'd, or NULL if none arrived. */
+char * esh_prompt_refresh(void);
+
+/* Stop asking 'plugin' for fragments, before it is unloaded */
+void esh_prompt_release(struct esh_plugin *plugin);
+
+/* True while a worker may still be running the make_prompt of
+ * 'plugin', which then must stay loaded */
+bool esh_prompt_running(struct esh_plugin *plugin);
+
+#endif //__ESH_UTILS_PROMPT_H
@@ -0,0 +1,628 @@
+/*
+ * esh-utils-simple.c
+ * Simple builtins: echo, printf, true, false, test, [ and pwd, and the
+ * dispatch of parallel.  See esh-utils-simple.h.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "esh.h"
+#include "esh-sys-utils.h"
+#include "esh-utils-builtin.h"
+#include "esh-utils-simple.h"
+#include "esh-utils-parallel.h"
+
+/* --- ESCAPES --- */
+
+/* Write the character of the backslash escape at 'p' to 'out'.
+ * 'zero_octal' selects echo's \0nnn over printf's \nnn form.  Sets
+ * *stop for \c.  Returns a pointer to the last character consumed. */
+static const char *
+put_escape(FILE *out, const char *p, bool zero_octal, bool *stop)
+{
+    const char *start = p++;
+    switch (*p) {
+    case 'a':  putc('\a', out); return p;
+    case 'b':  putc('\b', out); return p;
+    case 'e':  putc('\033', out); return p;
+    case 'f':  putc('\f', out); return p;
+    case 'n':  putc('\n', out); return p;
+    case 'r':  putc('\r', out); return p;
+    case 't':  putc('\t', out); return p;
+    case 'v':  putc('\v', out); return p;
+    case '\\': putc('\\', out); return p;
+    case 'c':  *stop = true; return p;
+    }
+
+    if (*p >= '0' && *p <= '7' && (!zero_octal || *p == '0')) {
+        if (zero_octal)
+            p++;
+        int value = 0, digits;
+        for (digits = 0; digits < 3 && *p >= '0' && *p <= '7'; digits++, p++)
+            value = value * 8 + (*p - '0');
+        putc(value, out);
+        return p - 1;
+    }
+
+    // Not an escape: the backslash stands for itself
+    putc('\\', out);
+    return start;
+}
+
+/* Write 's' to 'out', interpreting echo-style escapes.
+ * Returns false if output was cut short by \c. */
+static bool
+put_escaped(FILE *out, const char *s)
+{
+    bool stop = false;
+    for (; *s && !stop; s++) {
+        if (*s == '\\')
+            s = put_escape(out, s, true, &stop);
+        else
+            putc(*s, out);
+    }
+    return !stop;
+}
+
+/* --- ECHO, TRUE, FALSE, PWD --- */
+
+static int
+simple_echo(char **argv)
+{
+    bool newline = true, escapes = false;
+    char **a = argv + 1;
+
+    // Options are only taken while every letter is one of n, e, E
+    for (; *a && (*a)[0] == '-' && (*a)[1]; a++) {
+        const char *o = *a + 1;
+        if (o[strspn(o, "neE")] != '\0')
+            break;
+        for (; *o; o++) {
+            if (*o == 'n')
+                newline = false;
+            else
+                escapes = *o == 'e';
+        }
+    }
+
+    char **first = a;
+    for (; *a; a++) {
+        if (a != first)
+            putchar(' ');
+        if (!escapes)
+            fputs(*a, stdout);
+        else if (!put_escaped(stdout, *a))
+            return 0;
+    }
+    if (newline)
+        putchar('\n');
+    return 0;
+}
+
+static int
+simple_true(char **argv)
+{
+    return 0;
+}
+
+static int
+simple_false(char **argv)
+{
+    return 1;
+}
+
+static int
+simple_pwd(char **argv)
+{
+    char cwd[PATH_MAX];
+    if (getcwd(cwd, sizeof cwd) == NULL) {
+        esh_sys_error("esh: pwd: ");
+        return 1;
+    }
+    puts(cwd);
+    return 0;
+}
+
+/* --- PRINTF --- */
+
+/* Numeric argument of printf, as for printf(1): a leading quote
+ * gives the value of the next character */
+static bool
+printf_number(const char *arg, bool is_signed, long long *value)
+{
+    if (arg == NULL || *arg == '\0') {
+        *value = 0;
+        return true;
+    }
+    if (*arg == '\'' || *arg == '"') {
+        *value = (unsigned char) arg[1];
+        return true;
+    }
+
+    char *end;
+    errno = 0;
+    *value = is_signed ? strtoll(arg, &end, 0) : (long long) strtoull(arg, &end, 0);
+    if (*end != '\0' || errno != 0) {
+        fprintf(stderr, "esh: printf: %s: invalid number\n", arg);
+        return false;
+    }
+    return true;
+}
+
+/* Print one conversion of format 'spec' ('%', flags, width, precision
+ * and conversion character) with argument 'arg', which may be NULL.
+ * Returns false on a bad argument or conversion. */
+static bool
+printf_convert(char *spec, size_t len, const char *arg)
+{
+    char conv = spec[len - 1];
+    char fmt[64];
+    long long n;
+
+    switch (conv) {
+    case 'd': case 'i':
+    case 'o': case 'u': case 'x': case 'X':
+        // widen to long long: "%5d" becomes "%5lld"
+        snprintf(fmt, sizeof fmt, "%.*sll%c", (int) len - 1, spec, conv);
+        if (!printf_number(arg, conv == 'd' || conv == 'i', &n)) {
+            printf(fmt, 0LL);
+            return false;
+        }
+        printf(fmt, n);
+        return true;
+
+    case 'f': case 'F': case 'e': case 'E':
+    case 'g': case 'G': case 'a': case 'A': {
+        char *end = NULL;
+        double d = arg ? strtod(arg, &end) : 0;
+        snprintf(fmt, sizeof fmt, "%.*s", (int) len, spec);
+        printf(fmt, d);
+        if (arg && *end != '\0') {
+            fprintf(stderr, "esh: printf: %s: invalid number\n", arg);
+            return false;
+        }
+        return true;
+    }
+
+    case 'c':
+        snprintf(fmt, sizeof fmt, "%.*s", (int) len, spec);
+        printf(fmt, arg && *arg ? *arg : '\0');
+        return true;
+
+    case 's':
+        snprintf(fmt, sizeof fmt, "%.*s", (int) len, spec);
+        printf(fmt, arg ? arg : "");
+        return true;
+
+    case 'b': {
+        // %b is %s with the argument's escapes expanded
+        char *buf = NULL;
+        size_t buflen = 0;
+        FILE *mem = open_memstream(&buf, &buflen);
+        if (mem == NULL)
+            return false;
+        put_escaped(mem, arg ? arg : "");
+        fclose(mem);
+        snprintf(fmt, sizeof fmt, "%.*ss", (int) len - 1, spec);
+        printf(fmt, buf);
+        free(buf);
+        return true;
+    }
+    }
+
+    fprintf(stderr, "esh: printf: %c: invalid format character\n", conv);
+    return false;
+}
+
+static int
+simple_printf(char **argv)
+{
+    if (argv[1] == NULL) {
+        fprintf(stderr, "esh: printf: usage: printf format [arguments]\n");
+        return 2;
+    }
+
+    const char *format = argv[1];
+    char **args = argv + 2;
+    int status = 0;
+
+    // The format is reused as long as it consumes arguments
+    do {
+        char **before = args;
+        const char *p;
+        bool stop = false;
+
+        for (p = format; *p && !stop; p++) {
+            if (*p == '\\') {
+                p = put_escape(stdout, p, false, &stop);
+                continue;
+            }
+            if (*p != '%') {
+                putchar(*p);
+                continue;
+            }
+            if (p[1] == '%') {
+                putchar('%');
+                p++;
+                continue;
+            }
+
+            // Collect the conversion spec; '*' takes an argument
+            char spec[48];
+            size_t len = 0;
+            spec[len++] = *p++;
+            while (*p && strchr("-+ #0123456789.*", *p) && len < sizeof spec - 16) {
+                if (*p == '*') {
+                    long long w = 0;
+                    if (!printf_number(*args, true, &w))
+                        status = 1;
+                    if (*args)
+                        args++;
+                    len += snprintf(spec + len, sizeof spec - len, "%d", (int) w);
+                } else {
+                    spec[len++] = *p;
+                }
+                p++;
+            }
+            if (*p == '\0') {
+                fprintf(stderr, "esh: printf: missing format character\n");
+                return 1;
+            }
+            spec[len++] = *p;
+
+            if (!printf_convert(spec, len, *args))
+                status = 1;
+            if (*args)
+                args++;
+        }
+        if (stop || args == before)
+            break;
+    } while (*args);
+
+    return status;
+}
+
+/* --- TEST --- */
+
+/* Parser state of test(1) */
+struct test_state {
+    char **argv;
+    int pos, argc;
+    bool error;
+};
+
+static const char *test_binary_ops[] = {
+    "=", "==", "!=", "<", ">", "-eq", "-ne", "-lt", "-le", "-gt", "-ge",
+    "-nt", "-ot", "-ef", NULL
+};
+
+static bool
+is_op(const char *word, const char **ops)
+{
+    for (; *ops; ops++)
+        if (strcmp(word, *ops) == 0)
+            return true;
+    return false;
+}
+
+static bool
+is_unary_op(const char *word)
+{
+    return word[0] == '-' && word[1] && !word[2] && strchr("bcdefghLnprsStuwxzGO", word[1]);
+}
+
+static void
+test_syntax_error(struct test_state *t, const char *what, const char *word)
+{
+    if (!t->error)
+        fprintf(stderr, "esh: test: %s%s%s\n", word ? word : "", word ? ": " : "", what);
+    t->error = true;
+}
+
+static long long
+test_integer(struct test_state *t, const char *word)
+{
+    char *end;
+    errno = 0;
+    long long n = strtoll(word, &end, 10);
+    while (*end == ' ' || *end == '\t')
+        end++;
+    if (*word == '\0' || *end != '\0' || errno != 0)
+        test_syntax_error(t, "integer expression expected", word);
+    return n;
+}
+
+static bool
+test_unary(struct test_state *t, char op, const char *arg)
+{
+    struct stat st;
+    switch (op) {
+    case 'n': return *arg != '\0';
+    case 'z': return *arg == '\0';
+    case 't': return isatty(test_integer(t, arg));
+    case 'h': case 'L':
+        return lstat(arg, &st) == 0 && S_ISLNK(st.st_mode);
+    case 'r': return access(arg, R_OK) == 0;
+    case 'w': return access(arg, W_OK) == 0;
+    case 'x': return access(arg, X_OK) == 0;
+    }
+
+    if (stat(arg, &st) != 0)
+        return false;
+    switch (op) {
+    case 'b': return S_ISBLK(st.st_mode);
+    case 'c': return S_ISCHR(st.st_mode);
+    case 'd': return S_ISDIR(st.st_mode);
+    case 'e': return true;
+    case 'f': return S_ISREG(st.st_mode);
+    case 'g': return (st.st_mode & S_ISGID) != 0;
+    case 'p': return S_ISFIFO(st.st_mode);
+    case 's': return st.st_size > 0;
+    case 'S': return S_ISSOCK(st.st_mode);
+    case 'u': return (st.st_mode & S_ISUID) != 0;
+    case 'G': return st.st_gid == getegid();
+    case 'O': return st.st_uid == geteuid();
+    }
+    return false;
+}
+
+/* Compare modification times for -nt and -ot; a missing file is older */
+static int
+test_mtime_cmp(const char *a, const char *b)
+{
+    struct stat sa, sb;
+    bool ha = stat(a, &sa) == 0, hb = stat(b, &sb) == 0;
+    if (!ha || !hb)
+        return ha - hb;
+    if (sa.st_mtim.tv_sec != sb.st_mtim.tv_sec)
+        return sa.st_mtim.tv_sec < sb.st_mtim.tv_sec ? -1 : 1;
+    if (sa.st_mtim.tv_nsec != sb.st_mtim.tv_nsec)
+        return sa.st_mtim.tv_nsec < sb.st_mtim.tv_nsec ? -1 : 1;
+    return 0;
+}
+
+static bool
+test_binary(struct test_state *t, const char *a, const char *op, const char *b)
+{
+    if (strcmp(op, "=") == 0 || strcmp(op, "==") == 0)
+        return strcmp(a, b) == 0;
+    if (strcmp(op, "!=") == 0)
+        return strcmp(a, b) != 0;
+    if (strcmp(op, "<") == 0)
+        return strcmp(a, b) < 0;
+    if (strcmp(op, ">") == 0)
+        return strcmp(a, b) > 0;
+    if (strcmp(op, "-nt") == 0)
+        return test_mtime_cmp(a, b) > 0;
+    if (strcmp(op, "-ot") == 0)
+        return test_mtime_cmp(a, b) < 0;
+    if (strcmp(op, "-ef") == 0) {
+        struct stat sa, sb;
+        return stat(a, &sa) == 0 && stat(b, &sb) == 0
+            && sa.st_dev == sb.st_dev && sa.st_ino == sb.st_ino;
+    }
+
+    long long x = test_integer(t, a), y = test_integer(t, b);
+    switch (op[1] * 256 + op[2]) {
+    case 'e' * 256 + 'q': return x == y;
+    case 'n' * 256 + 'e': return x != y;
+    case 'l' * 256 + 't': return x < y;
+    case 'l' * 256 + 'e': return x <= y;
+    case 'g' * 256 + 't': return x > y;
+    default:              return x >= y;
+    }
+}
+
+static bool test_or(struct test_state *t);
+
+static bool
+test_primary(struct test_state *t)
+{
+    if (t->pos >= t->argc) {
+        test_syntax_error(t, "argument expected", NULL);
+        return false;
+    }
+
+    char **w = t->argv + t->pos;
+    int left = t->argc - t->pos;
+
+    if (left >= 3 && is_op(w[1], test_binary_ops)) {
+        t->pos += 3;
+        return test_binary(t, w[0], w[1], w[2]);
+    }
+    if (strcmp(w[0], "(") == 0 && left >= 2) {
+        t->pos++;
+        bool value = test_or(t);
+        if (t->pos >= t->argc || strcmp(t->argv[t->pos], ")") != 0)
+            test_syntax_error(t, "')' expected", NULL);
+        t->pos++;
+        return value;
+    }
+    if (is_unary_op(w[0]) && left >= 2) {
+        t->pos += 2;
+        return test_unary(t, w[0][1], w[1]);
+    }
+    t->pos++;
+    return w[0][0] != '\0';
+}
+
+static bool
+test_not(struct test_state *t)
+{
+    if (t->pos < t->argc - 1 && strcmp(t->argv[t->pos], "!") == 0) {
+        t->pos++;
+        return !test_not(t);
+    }
+    return test_primary(t);
+}
+
+static bool
+test_and(struct test_state *t)
+{
+    bool value = test_not(t);
+    while (t->pos < t->argc && strcmp(t->argv[t->pos], "-a") == 0) {
+        t->pos++;
+        value = test_not(t) && value;
+    }
+    return value;
+}
+
+static bool
+test_or(struct test_state *t)
+{
+    bool value = test_and(t);
+    while (t->pos < t->argc && strcmp(t->argv[t->pos], "-o") == 0) {
+        t->pos++;
+        value = test_and(t) || value;
+    }
+    return value;
+}
+
+/* test and [: 0 if the expression is true, 1 if false, 2 on error */
+static int
+simple_test(char **argv)
+{
+    int argc = 0;
+    while (argv[argc])
+        argc++;
+
+    if (strcmp(argv[0], "[") == 0) {
+        if (strcmp(argv[argc - 1], "]") != 0) {
+            fprintf(stderr, "esh: [: missing ']'\n");
+            return 2;
+        }
+        argc--;
+    }
+
+    struct test_state t = { .argv = argv + 1, .pos = 0, .argc = argc - 1 };
+    if (t.argc == 0)
+        return 1;
+
+    bool value = test_or(&t);
+    if (t.pos < t.argc)
+        test_syntax_error(&t, "too many arguments", NULL);
+    return t.error ? 2 : !value;
+}
+
+/* --- DISPATCH --- */
+
+struct simple_builtin {
+    const char *name;
+    int (* run)(char **argv);
+};
+
+static const struct simple_builtin simple_builtins[] = {
+    { "echo",   simple_echo },
+    { "printf", simple_printf },
+    { "true",   simple_true },
+    { "false",  simple_false },
+    { "test",   simple_test },
+    { "[",      simple_test },
+    { "pwd",    simple_pwd },
+    { "parallel", esh_parallel },
+    { NULL,     NULL }
+};
+
+static const struct simple_builtin *
+simple_find(const char *name)
+{
+    const struct simple_builtin *b;
+    for (b = simple_builtins; b->name; b++)
+        if (strcmp(b->name, name) == 0)
+            return b;
+    return NULL;
+}
+
+/* Make 'file' the shell's fd 'fd' and return a saved copy of the
+ * old one, or -1 after reporting an error */
+static int
+redirect_fd(int fd, const char *file, int flags)
+{
+    int new_fd = open(file, flags | O_CLOEXEC, 0666);
+    if (new_fd < 0) {
+        esh_sys_error("esh: %s: ", file);
+        return -1;
+    }
+
+    int saved = fcntl(fd, F_DUPFD_CLOEXEC, 10);
+    dup2(new_fd, fd);
+    close(new_fd);
+    return saved;
+}
+
+static void
+restore_fd(int fd, int saved)
+{
+    if (saved >= 0) {
+        dup2(saved, fd);
+        close(saved);
+    }
+}
+
+/* Registry handler: run a simple builtin in the shell itself */
+static bool
+run_simple(struct esh_command *cmd, void *aux)
+{
+    const struct simple_builtin *b = aux;
+
+    // A pipeline stage or a background job needs its own process
+    if (cmd -> pipeline -> is_piped || cmd -> pipeline -> bg_job)
+        return false;
+
+    int saved_in = -1, saved_out = -1;
+    fflush(stdout);
+    if (cmd -> iored_input) {
+        saved_in = redirect_fd(STDIN_FILENO, cmd -> iored_input, O_RDONLY);
+        if (saved_in < 0) {
+            esh_last_status = 1;
+            return true;
+        }
+    }
+    if (cmd -> iored_output) {
+        int flags = O_CREAT | O_WRONLY | (cmd -> append_to_output ? O_APPEND : O_TRUNC);
+        saved_out = redirect_fd(STDOUT_FILENO, cmd -> iored_output, flags);
+        if (saved_out < 0) {
+            restore_fd(STDIN_FILENO, saved_in);
+            esh_last_status = 1;
+            return true;
+        }
+    }
+
+    esh_last_status = b -> run(cmd -> argv);
+
+    fflush(stdout);
+    restore_fd(STDOUT_FILENO, saved_out);
+    restore_fd(STDIN_FILENO, saved_in);
+    return true;
+}
+
+/* Register the simple builtins in the builtin registry */
+void
+esh_simple_register(void)
+{
+    const struct simple_builtin *b;
+    for (b = simple_builtins; b->name; b++)
+        esh_builtin_register(b->name, run_simple, (void *) b);
+}
+
+/* True if 'name' is a simple builtin */
+bool
+esh_simple_exists(const char *name)
+{
+    return simple_find(name) != NULL;
+}
+
+/* Run simple builtin argv[0] on the current fds 0 and 1 */
+int
+esh_simple_run(char **argv)
+{
+    const struct simple_builtin *b = simple_find(argv[0]);
+    return b ? b -> run(argv) : 127;
+}
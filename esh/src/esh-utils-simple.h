@@ -0,0 +1,29 @@
+#ifndef __ESH_UTILS_SIMPLE_H
+#define __ESH_UTILS_SIMPLE_H
+
+/*
+ * Simple builtins: echo, printf, true, false, test, [ and pwd, and
+ * parallel (esh-utils-parallel.h).
+ *
+ * They only need their arguments and fds 0 and 1, so the shell runs
+ * them itself instead of forking and exec'ing a program.  Redirections
+ * are applied to the shell's own fds 0 and 1 for the duration of the
+ * command and then undone.
+ *
+ * As a stage of a pipeline, or in the background, a simple builtin
+ * still needs a process of its own.  It is then forked like any other
+ * stage, but the child runs the builtin instead of exec'ing.
+ */
+#include <stdbool.h>
+
+/* Register the simple builtins in the builtin registry */
+void esh_simple_register(void);
+
+/* True if 'name' is a simple builtin */
+bool esh_simple_exists(const char *name);
+
+/* Run simple builtin argv[0] on the current fds 0 and 1, without
+ * redirections.  Returns its exit status. */
+int esh_simple_run(char **argv);
+
+#endif //__ESH_UTILS_SIMPLE_H
@@ -0,0 +1,158 @@
+/*
+ * esh-utils-slots.c
+ * Job slots for background jobs.  See esh-utils-slots.h.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "esh.h"
+#include "esh-utils-builtin.h"
+#include "esh-utils-helper.h"
+#include "esh-utils-jobs.h"
+#include "esh-utils-slots.h"
+
+/* Pressure is sampled again this often while jobs wait for it */
+#define RETRY_MS 1000
+
+static int slot_limit;              /* 0: no limit */
+static double cpu_threshold;        /* 0: off */
+static double memory_threshold;     /* 0: off */
+
+/* The 'some avg10' figure of pressure file 'path', or -1 */
+static double
+pressure(const char *path)
+{
+    char buf[256];
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+    ssize_t n = read(fd, buf, sizeof buf - 1);
+    close(fd);
+    if (n <= 0)
+        return -1;
+    buf[n] = '\0';
+
+    double avg10;
+    if (sscanf(buf, "some avg10=%lf", &avg10) != 1)
+        return -1;
+    return avg10;
+}
+
+/* Apply one word of the settings */
+static bool
+configure_word(const char *word)
+{
+    char *end;
+    double *threshold = NULL;
+    const char *value = word;
+    if (strncmp(word, "cpu=", 4) == 0) {
+        threshold = &cpu_threshold;
+        value = word + 4;
+    } else if (strncmp(word, "memory=", 7) == 0) {
+        threshold = &memory_threshold;
+        value = word + 7;
+    }
+
+    if (threshold) {
+        double pct = strtod(value, &end);
+        if (end == value || *end != '\0' || pct < 0)
+            return false;
+        *threshold = pct;
+    } else {
+        long n = strtol(value, &end, 10);
+        if (end == value || *end != '\0' || n < 0)
+            return false;
+        slot_limit = n;
+    }
+    return true;
+}
+
+/* Apply the settings in 'spec' */
+bool
+esh_slots_configure(const char *spec)
+{
+    char *copy = strdup(spec), *save, *word;
+    bool ok = true;
+    for (word = strtok_r(copy, ", \t", &save); word && ok; word = strtok_r(NULL, ", \t", &save))
+        ok = configure_word(word);
+    free(copy);
+    return ok;
+}
+
+/* True if a background job may start now */
+bool
+esh_slots_admit(void)
+{
+    if (slot_limit > 0 && esh_job_count(BACKGROUND) >= slot_limit)
+        return false;
+    if (cpu_threshold > 0 && pressure("/proc/pressure/cpu") >= cpu_threshold)
+        return false;
+    if (memory_threshold > 0 && pressure("/proc/pressure/memory") >= memory_threshold)
+        return false;
+    return true;
+}
+
+/* When to try admission again if no job finishes */
+int
+esh_slots_retry_ms(void)
+{
+    if (cpu_threshold <= 0 && memory_threshold <= 0)
+        return -1;
+    return esh_job_count(QUEUED) > 0 ? RETRY_MS : -1;
+}
+
+/* --- JOBSLOTS --- */
+
+/* Print a pressure threshold and the current figure */
+static void
+print_threshold(const char *name, double threshold, const char *path)
+{
+    double now = pressure(path);
+    if (threshold > 0)
+        printf("%-8s%.2f", name, threshold);
+    else
+        printf("%-8soff", name);
+    if (now >= 0)
+        printf(" (now %.2f)\n", now);
+    else
+        printf(" (unavailable)\n");
+}
+
+/* jobslots [N] [cpu=PCT] [memory=PCT] */
+static bool
+builtin_jobslots(struct esh_command *cmd, void *aux)
+{
+    char **word;
+    for (word = cmd->argv + 1; *word; word++) {
+        if (!esh_slots_configure(*word)) {
+            printf("esh:    jobslots: usage: jobslots [N] [cpu=PCT] [memory=PCT]\n");
+            esh_last_status = 2;
+            return true;
+        }
+    }
+
+    // A higher limit may let queued jobs start
+    esh_start_queued_jobs();
+
+    if (cmd->argv[1] == NULL) {
+        if (slot_limit > 0)
+            printf("%-8s%d\n", "limit", slot_limit);
+        else
+            printf("%-8snone\n", "limit");
+        print_threshold("cpu", cpu_threshold, "/proc/pressure/cpu");
+        print_threshold("memory", memory_threshold, "/proc/pressure/memory");
+        printf("%-8s%d\n", "running", esh_job_count(BACKGROUND));
+        printf("%-8s%d\n", "queued", esh_job_count(QUEUED));
+    }
+    return true;
+}
+
+/* Register the 'jobslots' builtin */
+void
+esh_slots_register(void)
+{
+    esh_builtin_register("jobslots", builtin_jobslots, NULL);
+}
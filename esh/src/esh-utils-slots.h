@@ -0,0 +1,49 @@
+#ifndef __ESH_UTILS_SLOTS_H
+#define __ESH_UTILS_SLOTS_H
+
+/*
+ * Job slots: admission control for background jobs.
+ *
+ * At most 'limit' background jobs run at a time.  A job started with
+ * & while every slot is taken is kept in jobs_list with status QUEUED
+ * and no processes; 'jobs' lists it as Queued.  Queued jobs are
+ * started oldest first by esh_start_queued_jobs() (esh-utils-helper.h)
+ * when a running background job finishes or stops.  'fg' starts a
+ * queued job right away, 'kill' drops it.  'bg' resumes a stopped job
+ * only if it could be admitted, with no job queued before it.
+ *
+ * Admission can also be gated on the kernel's pressure stall
+ * information: while the 'some avg10' figure of /proc/pressure/cpu
+ * or /proc/pressure/memory is at or above its threshold, no queued
+ * job is started.  Pressure is checked again every RETRY_MS while
+ * jobs are queued.  Without /proc/pressure, there is no gating.
+ *
+ * The settings are words of the form
+ *
+ *      N               run at most N background jobs (0: no limit)
+ *      cpu=PCT         hold jobs while CPU pressure >= PCT (0: off)
+ *      memory=PCT      hold jobs while memory pressure >= PCT (0: off)
+ *
+ * given in ESH_JOB_SLOTS, separated by commas or blanks, or as the
+ * arguments of the 'jobslots' builtin.  Without arguments, 'jobslots'
+ * prints the settings and the number of running and queued jobs.
+ * By default there are no limits and no job is ever queued.
+ */
+#include <stdbool.h>
+
+/* Apply the settings in 'spec'.  Returns false if a word is not
+ * understood or has an empty value; the words before it are applied. */
+bool esh_slots_configure(const char *spec);
+
+/* True if a background job may start now */
+bool esh_slots_admit(void);
+
+/* How long, in ms, to wait before admission is tried again if no
+ * job finishes: -1 (for ever) unless jobs are queued behind a
+ * pressure threshold */
+int esh_slots_retry_ms(void);
+
+/* Register the 'jobslots' builtin */
+void esh_slots_register(void);
+
+#endif //__ESH_UTILS_SLOTS_H
@@ -0,0 +1,107 @@
+/*
+ * esh-utils-spawn.c
+ * posix_spawn based launcher for pipeline stages.
+ *
+ * Performs the same setup as the fork path in esh-utils-helper.c
+ * (process group, terminal, pipe wiring and I/O redirection), but
+ * expresses it as spawn attributes and file actions so the shell
+ * is never duplicated.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <spawn.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/types.h>
+
+#include "esh.h"
+#include "esh-sys-utils.h"
+#include "esh-utils-spawn.h"
+
+extern char **environ;
+
+enum esh_launch_mode esh_launch_mode = ESH_LAUNCH_FORK;
+
+/* Select the launcher by name */
+bool
+esh_launch_mode_set(const char *name)
+{
+    if (strcmp(name, "fork") == 0)
+        esh_launch_mode = ESH_LAUNCH_FORK;
+    else if (strcmp(name, "spawn") == 0)
+        esh_launch_mode = ESH_LAUNCH_SPAWN;
+    else
+        return false;
+
+    return true;
+}
+
+/* Launch 'cmd' as a stage of 'pipeline' via posix_spawn */
+pid_t
+esh_spawn_command(struct esh_command *cmd, struct esh_pipeline *pipeline,
+                  int in_fd, int out_fd)
+{
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attr;
+    sigset_t emptymask;
+    pid_t pid;
+
+    posix_spawn_file_actions_init(&actions);
+    posix_spawnattr_init(&attr);
+
+    // ---------- Process Group and Signals ----------- //
+    // pgroup 0 makes the first stage the leader of a new group,
+    // just like setpgid(0, 0) in the fork path.  Without job control
+    // the child stays in the shell's group.
+    short spawn_flags = POSIX_SPAWN_SETSIGMASK;
+    if (esh_interactive) {
+        posix_spawnattr_setpgroup(&attr, pipeline -> pgid == -1 ? 0 : pipeline -> pgid);
+        spawn_flags |= POSIX_SPAWN_SETPGROUP;
+    }
+
+    // The shell keeps SIGCHLD blocked for its signalfd; the child
+    // must not inherit that mask.
+    sigemptyset(&emptymask);
+    posix_spawnattr_setsigmask(&attr, &emptymask);
+    posix_spawnattr_setflags(&attr, spawn_flags);
+
+    // The first stage of a foreground job takes the terminal after
+    // it has moved into its own process group.
+    if (esh_interactive && !pipeline -> bg_job && pipeline -> pgid == -1)
+        posix_spawn_file_actions_addtcsetpgrp_np(&actions, esh_sys_tty_getfd());
+
+    // ---------------- Pipes ----------------- //
+    // Pipe ends are created O_CLOEXEC, so only the dup2'd copies
+    // survive into the new program.
+    if (in_fd != -1)
+        posix_spawn_file_actions_adddup2(&actions, in_fd, STDIN_FILENO);
+    if (out_fd != -1)
+        posix_spawn_file_actions_adddup2(&actions, out_fd, STDOUT_FILENO);
+
+    // ---------- Input and Output ----------- //
+    if (cmd -> iored_output) {
+        int flags = O_CREAT | O_WRONLY | (cmd -> append_to_output ? O_APPEND : O_TRUNC);
+        posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO,
+                                         cmd -> iored_output, flags, 0666);
+    }
+    if (cmd -> iored_input) {
+        posix_spawn_file_actions_addopen(&actions, STDIN_FILENO,
+                                         cmd -> iored_input, O_RDONLY, 0);
+    }
+
+    // ------------- Execute Command ------------ //
+    int rc = posix_spawn(&pid, cmd -> path, &actions, &attr, cmd -> argv, environ);
+
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+
+    if (rc != 0) {
+        errno = rc;
+        esh_sys_error("%s: ", cmd -> argv[0]);
+        return -1;
+    }
+    return pid;
+}
@@ -0,0 +1,38 @@
+#ifndef __ESH_UTILS_SPAWN_H
+#define __ESH_UTILS_SPAWN_H
+
+/*
+ * posix_spawn based launcher for pipeline stages.
+ *
+ * The fork path in esh-utils-helper.c copies the whole shell (page
+ * tables included) for every command.  posix_spawn(3) on glibc uses
+ * clone(CLONE_VM|CLONE_VFORK), so the cost of launching a command no
+ * longer grows with the size of the shell.
+ */
+#include <stdbool.h>
+#include <sys/types.h>
+
+enum esh_launch_mode {
+    ESH_LAUNCH_FORK,        /* fork() + esh_command_helper() in child */
+    ESH_LAUNCH_SPAWN        /* posix_spawnp() with file actions */
+};
+
+/* The launcher used by esh_pipeline_helper */
+extern enum esh_launch_mode esh_launch_mode;
+
+/* Select the launcher by name ("fork" or "spawn").
+ * Returns false if the name is not recognized. */
+bool esh_launch_mode_set(const char *name);
+
+/* Launch 'cmd' as a stage of 'pipeline'.
+ * 'in_fd' and 'out_fd' are the pipe ends that become the stage's
+ * stdin and stdout, or -1 if the stage is not connected to a pipe.
+ * The child joins pipeline->pgid, or starts a new process group
+ * if pipeline->pgid is -1.  A foreground pipeline's first stage
+ * also takes over the terminal.
+ * cmd->path must have been resolved.
+ * Returns the child's pid, or -1 if the command could not be started. */
+pid_t esh_spawn_command(struct esh_command *cmd, struct esh_pipeline *pipeline,
+                        int in_fd, int out_fd);
+
+#endif //__ESH_UTILS_SPAWN_H
@@ -0,0 +1,246 @@
+/*
+ * esh-utils-stats.c
+ * Latency histograms.  See esh-utils-stats.h.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "esh.h"
+#include "esh-parse-cache.h"
+#include "esh-utils-builtin.h"
+#include "esh-utils-stats.h"
+
+/* Buckets per power of two, and how many bits select one */
+#define SUB_BITS    3
+#define SUB_BUCKETS (1 << SUB_BITS)
+#define NBUCKETS    ((64 - SUB_BITS + 1) * SUB_BUCKETS)
+
+struct histogram {
+    uint64_t count;
+    uint64_t max;
+    uint64_t buckets[NBUCKETS];
+};
+
+static struct histogram histograms[ESH_STATS_COUNT];
+
+static const char *phase_names[ESH_STATS_COUNT] = {
+    "parse", "dispatch", "launch", "exec", "wait", "prompt"
+};
+
+/* File named by ESH_STATS, for the dump at exit */
+static char *dump_path;
+
+/* Clock readings at startup, to convert ticks to ns */
+static uint64_t start_ticks, start_ns;
+
+/* --- RECORDING --- */
+
+/* The bucket of 'ns'.  Values below SUB_BUCKETS have one bucket each;
+ * above, each power of two is split into SUB_BUCKETS equal parts. */
+static int
+bucket_of(uint64_t ns)
+{
+    if (ns < SUB_BUCKETS)
+        return ns;
+    int msb = 63 - __builtin_clzll(ns);
+    int sub = (ns >> (msb - SUB_BITS)) & (SUB_BUCKETS - 1);
+    return (msb - SUB_BITS + 1) * SUB_BUCKETS + sub;
+}
+
+/* The smallest value in bucket 'b' */
+static uint64_t
+bucket_low(int b)
+{
+    if (b < SUB_BUCKETS)
+        return b;
+    int msb = b / SUB_BUCKETS + SUB_BITS - 1;
+    return (uint64_t) (SUB_BUCKETS + b % SUB_BUCKETS) << (msb - SUB_BITS);
+}
+
+/* The largest value in bucket 'b' */
+static uint64_t
+bucket_high(int b)
+{
+    return b + 1 < NBUCKETS ? bucket_low(b + 1) - 1 : UINT64_MAX;
+}
+
+static uint64_t
+monotonic_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* The current time in clock ticks */
+uint64_t
+esh_stats_now(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return monotonic_ns();
+#endif
+}
+
+/* Record the time since 'start' for 'phase' */
+void
+esh_stats_record(enum esh_stats_phase phase, uint64_t start)
+{
+    uint64_t ticks = esh_stats_now() - start;
+    struct histogram *h = &histograms[phase];
+    h->count++;
+    h->buckets[bucket_of(ticks)]++;
+    if (ticks > h->max)
+        h->max = ticks;
+}
+
+/* --- REPORTING --- */
+
+/* Clock ticks per ns, measured against CLOCK_MONOTONIC since startup */
+static double
+ticks_per_ns(void)
+{
+    uint64_t ns = monotonic_ns(), ticks = esh_stats_now();
+    if (ns - start_ns < 10000000) {
+        // Too short a time to tell; wait a little
+        struct timespec pause = { 0, 10000000 };
+        nanosleep(&pause, NULL);
+        ns = monotonic_ns();
+        ticks = esh_stats_now();
+    }
+    return (double) (ticks - start_ticks) / (ns - start_ns);
+}
+
+/* The value, in ticks, below which a fraction 'q' of the samples
+ * fall, as the upper bound of its bucket */
+static uint64_t
+percentile(struct histogram *h, double q)
+{
+    uint64_t rank = q * h->count, seen = 0;
+    int b;
+    for (b = 0; b < NBUCKETS; b++) {
+        seen += h->buckets[b];
+        if (seen > rank)
+            return bucket_high(b) < h->max ? bucket_high(b) : h->max;
+    }
+    return h->max;
+}
+
+/* Write 'ticks' in ns, us, ms or s, whichever suits it */
+static char *
+format_ticks(char *buf, size_t size, uint64_t ticks, double scale)
+{
+    uint64_t ns = ticks / scale;
+    if (ns < 1000)
+        snprintf(buf, size, "%luns", (unsigned long) ns);
+    else if (ns < 1000000)
+        snprintf(buf, size, "%.1fus", ns / 1e3);
+    else if (ns < 1000000000)
+        snprintf(buf, size, "%.1fms", ns / 1e6);
+    else
+        snprintf(buf, size, "%.2fs", ns / 1e9);
+    return buf;
+}
+
+/* Print the summary of every phase to 'out' */
+void
+esh_stats_print(FILE *out)
+{
+    char p50[16], p99[16], p999[16], max[16];
+    double scale = ticks_per_ns();
+    int i;
+
+    fprintf(out, "%-10s %8s %9s %9s %9s %9s\n", "phase", "count", "p50", "p99", "p999", "max");
+    for (i = 0; i < ESH_STATS_COUNT; i++) {
+        struct histogram *h = &histograms[i];
+        if (h->count == 0) {
+            fprintf(out, "%-10s %8d\n", phase_names[i], 0);
+            continue;
+        }
+        fprintf(out, "%-10s %8lu %9s %9s %9s %9s\n", phase_names[i], (unsigned long) h->count,
+                format_ticks(p50, sizeof p50, percentile(h, 0.5), scale),
+                format_ticks(p99, sizeof p99, percentile(h, 0.99), scale),
+                format_ticks(p999, sizeof p999, percentile(h, 0.999), scale),
+                format_ticks(max, sizeof max, h->max, scale));
+    }
+
+    struct esh_parse_cache_stats cache;
+    esh_parse_cache_get_stats(&cache);
+    fprintf(out, "parse cache: %lu hits, %lu misses, %d of %d entries\n",
+            cache.hits, cache.misses, cache.entries, cache.capacity);
+}
+
+/* Write every non-empty bucket to ESH_STATS */
+static void
+dump_at_exit(void)
+{
+    // Forked copies of the shell that exit keep quiet
+    if (getpid() != shell_pid)
+        return;
+
+    FILE *out = strcmp(dump_path, "-") == 0 ? stderr : fopen(dump_path, "w");
+    if (out == NULL)
+        return;
+
+    esh_stats_print(out);
+    double scale = ticks_per_ns();
+    int i, b;
+    for (i = 0; i < ESH_STATS_COUNT; i++) {
+        struct histogram *h = &histograms[i];
+        if (h->count == 0)
+            continue;
+        fprintf(out, "\n%s: %lu samples, ns\n", phase_names[i], (unsigned long) h->count);
+        for (b = 0; b < NBUCKETS; b++)
+            if (h->buckets[b])
+                fprintf(out, "  %12lu %12lu %10lu\n", (unsigned long) (bucket_low(b) / scale),
+                        (unsigned long) (bucket_high(b) / scale), (unsigned long) h->buckets[b]);
+    }
+    if (out != stderr)
+        fclose(out);
+}
+
+/* --- STATS --- */
+
+/* stats [-r] */
+static bool
+builtin_stats(struct esh_command *cmd, void *aux)
+{
+    if (cmd->argv[1] && strcmp(cmd->argv[1], "-r") == 0) {
+        memset(histograms, 0, sizeof histograms);
+        return true;
+    }
+    if (cmd->argv[1]) {
+        printf("esh:    stats: usage: stats [-r]\n");
+        esh_last_status = 2;
+        return true;
+    }
+    esh_stats_print(stdout);
+    return true;
+}
+
+/* Register the 'stats' builtin and, the first time, the dump at exit */
+void
+esh_stats_register(void)
+{
+    esh_builtin_register("stats", builtin_stats, NULL);
+
+    // Called again when plugins are unloaded; start only once
+    if (start_ns != 0)
+        return;
+    start_ns = monotonic_ns();
+    start_ticks = esh_stats_now();
+
+    char *path = getenv("ESH_STATS");
+    if (path && *path) {
+        dump_path = strdup(path);
+        atexit(dump_at_exit);
+    }
+}
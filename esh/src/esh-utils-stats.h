@@ -0,0 +1,56 @@
+#ifndef __ESH_UTILS_STATS_H
+#define __ESH_UTILS_STATS_H
+
+/*
+ * Latency histograms for the phases of running a command line.
+ *
+ *      parse       shell.parse_command_line
+ *      dispatch    the builtin registry and plugins' process_builtin,
+ *                  once per pipeline; for a builtin, this includes
+ *                  running it
+ *      launch      each fork() or posix_spawn() of a stage
+ *      exec        from the start of a pipeline until all its stages
+ *                  are launched: lookup, rewriting, copy and launches
+ *      wait        wait_for_job for a foreground job
+ *      prompt      from the end of a command line until the next
+ *                  prompt is shown: reaping, notifications, prompt
+ *
+ * Times are read from the time stamp counter on x86 (rdtsc, about
+ * half the cost of a vDSO clock_gettime) and from CLOCK_MONOTONIC
+ * elsewhere.  They are counted in log-linear buckets, 8 per power
+ * of two, so a percentile is within 12.5% of the true value, and
+ * only converted to ns when reported.  Recording is a few additions,
+ * cheap enough to stay on all the time.
+ *
+ * 'stats' prints the count, p50, p99, p999 and maximum of each phase
+ * and the parse cache counters; 'stats -r' clears the histograms.
+ * If ESH_STATS names a file ('-' for standard error), the non-empty
+ * buckets of every phase are written to it when the shell exits.
+ */
+#include <stdint.h>
+#include <stdio.h>
+
+enum esh_stats_phase {
+    ESH_STATS_PARSE,
+    ESH_STATS_DISPATCH,
+    ESH_STATS_LAUNCH,
+    ESH_STATS_EXEC,
+    ESH_STATS_WAIT,
+    ESH_STATS_PROMPT,
+    ESH_STATS_COUNT
+};
+
+/* The current time in clock ticks, to pass to esh_stats_record */
+uint64_t esh_stats_now(void);
+
+/* Record the time since 'start' for 'phase' */
+void esh_stats_record(enum esh_stats_phase phase, uint64_t start);
+
+/* Print the summary of every phase to 'out', as 'stats' does */
+void esh_stats_print(FILE *out);
+
+/* Register the 'stats' builtin, and the dump at exit if ESH_STATS
+ * is set */
+void esh_stats_register(void);
+
+#endif //__ESH_UTILS_STATS_H
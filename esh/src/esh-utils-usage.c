@@ -0,0 +1,161 @@
+/*
+ * esh-utils-usage.c
+ * Resource usage of jobs.  See esh-utils-usage.h.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/time.h>
+
+#include "esh.h"
+#include "esh-utils-builtin.h"
+#include "esh-utils-usage.h"
+
+/* Add 'ru' to 'total' */
+void
+esh_usage_add(struct rusage *total, const struct rusage *ru)
+{
+    timeradd(&total->ru_utime, &ru->ru_utime, &total->ru_utime);
+    timeradd(&total->ru_stime, &ru->ru_stime, &total->ru_stime);
+    if (ru->ru_maxrss > total->ru_maxrss)
+        total->ru_maxrss = ru->ru_maxrss;
+    total->ru_minflt += ru->ru_minflt;
+    total->ru_majflt += ru->ru_majflt;
+    total->ru_nvcsw += ru->ru_nvcsw;
+    total->ru_nivcsw += ru->ru_nivcsw;
+}
+
+static double
+seconds_tv(const struct timeval *tv)
+{
+    return tv->tv_sec + tv->tv_usec / 1e6;
+}
+
+/* Seconds from 'a' to 'b' */
+static double
+seconds_between(const struct timespec *a, const struct timespec *b)
+{
+    return (b->tv_sec - a->tv_sec) + (b->tv_nsec - a->tv_nsec) / 1e9;
+}
+
+/* Print one stage: its pid, name and state or usage.  The stages
+ * of a queued job have no pid yet. */
+static void
+print_stage(FILE *out, struct esh_pipeline *job, struct esh_command *cmd, bool gone)
+{
+    if (job->status == QUEUED) {
+        // Not started, so there is no pid yet
+        fprintf(out, "\t%7s  %-12s  queued\n", "", cmd->argv[0]);
+        return;
+    }
+
+    if (cmd->pid > 0)
+        fprintf(out, "\t%7d  %-12s", cmd->pid, cmd->argv[0]);
+    else
+        fprintf(out, "\t%7s  %-12s", "-", cmd->argv[0]);     /* in-process filter */
+
+    if (!gone) {
+        fprintf(out, "  running\n");
+        return;
+    }
+
+    const struct rusage *ru = &cmd->usage;
+    fprintf(out, "  real %.3fs  user %.3fs  sys %.3fs  maxrss %ldk  faults %ld/%ld  switches %ld/%ld\n",
+            seconds_between(&job->started, &cmd->ended),
+            seconds_tv(&ru->ru_utime), seconds_tv(&ru->ru_stime), ru->ru_maxrss,
+            ru->ru_majflt, ru->ru_minflt, ru->ru_nvcsw, ru->ru_nivcsw);
+}
+
+/* Print a line for each stage of 'job', merging the running and the
+ * done commands back into pipeline order */
+void
+esh_usage_print_stages(FILE *out, struct esh_pipeline *job)
+{
+    struct list_elem *r = list_begin(&job->commands);
+    struct list_elem *d = list_begin(&job->done);
+
+    while (r != list_end(&job->commands) || d != list_end(&job->done)) {
+        struct esh_command *running = r != list_end(&job->commands)
+                                    ? list_entry(r, struct esh_command, elem) : NULL;
+        struct esh_command *done = d != list_end(&job->done)
+                                 ? list_entry(d, struct esh_command, elem) : NULL;
+
+        if (done == NULL || (running && running->stage < done->stage)) {
+            print_stage(out, job, running, false);
+            r = list_next(r);
+        } else {
+            print_stage(out, job, done, true);
+            d = list_next(d);
+        }
+    }
+}
+
+/* Print times the way sh(1)'s 'time' does */
+static void
+print_times(FILE *out, double real, double user, double sys)
+{
+    fprintf(out, "\nreal\t%dm%.3fs\n", (int) real / 60, real - 60 * ((int) real / 60));
+    fprintf(out, "user\t%dm%.3fs\n", (int) user / 60, user - 60 * ((int) user / 60));
+    fprintf(out, "sys\t%dm%.3fs\n", (int) sys / 60, sys - 60 * ((int) sys / 60));
+}
+
+/* Print the report of 'time' for 'job' */
+void
+esh_usage_report(FILE *out, struct esh_pipeline *job)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    print_times(out, seconds_between(&job->started, &now),
+                seconds_tv(&job->usage.ru_utime), seconds_tv(&job->usage.ru_stime));
+
+    // Only a pipeline has stages worth telling apart
+    if (list_begin(&job->done) != list_back(&job->done))
+        esh_usage_print_stages(out, job);
+}
+
+/* --- TIME --- */
+
+/* time PIPELINE: run PIPELINE and report its usage.  The pipeline's
+ * first stage is 'time' and its arguments; once the 'time' is
+ * dropped, the pipeline runs as usual, unless it is a builtin. */
+static bool
+builtin_time(struct esh_command *cmd, void *aux)
+{
+    if (cmd->argv[1] == NULL) {
+        printf("esh:    time: usage: time pipeline\n");
+        esh_last_status = 2;
+        return true;
+    }
+
+    char **p = cmd->argv;
+    while ((p[0] = p[1]) != NULL)
+        p++;
+    cmd->pipeline->timed = true;
+
+    // A builtin runs in the shell, so it is timed here
+    if (!esh_builtin_exists(cmd->argv[0]))
+        return false;
+
+    struct timespec start, end;
+    struct rusage before, after;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    getrusage(RUSAGE_SELF, &before);
+    if (!esh_builtin_run(cmd))
+        return false;               /* declined, it will be forked */
+    getrusage(RUSAGE_SELF, &after);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    fflush(stdout);
+    print_times(stderr, seconds_between(&start, &end),
+                seconds_tv(&after.ru_utime) - seconds_tv(&before.ru_utime),
+                seconds_tv(&after.ru_stime) - seconds_tv(&before.ru_stime));
+    return true;
+}
+
+/* Register the 'time' builtin */
+void
+esh_usage_register(void)
+{
+    esh_builtin_register("time", builtin_time, NULL);
+}
@@ -0,0 +1,39 @@
+#ifndef __ESH_UTILS_USAGE_H
+#define __ESH_UTILS_USAGE_H
+
+/*
+ * Resource usage of jobs.
+ *
+ * Children are reaped with wait4(2), so each command that is gone
+ * keeps its process's rusage: user and system CPU, maximum RSS, page
+ * faults and context switches.  An in-process filter gets its
+ * thread's usage instead.  The usage of a pipeline's commands is
+ * summed in the pipeline.
+ *
+ *      jobs -l             lists each stage of each job, with its pid and,
+ *                          once it is gone, its usage
+ *      time PIPELINE       runs PIPELINE, then prints its wall-clock and
+ *                          CPU time, and those of each stage
+ *
+ * 'time' on a background job reports when the job is over, along with
+ * the job's Done notification.
+ */
+#include <stdio.h>
+#include <sys/resource.h>
+
+struct esh_pipeline;
+
+/* Add 'ru' to 'total'.  Times and counts add up; the maximum RSS is
+ * the largest of the two. */
+void esh_usage_add(struct rusage *total, const struct rusage *ru);
+
+/* Print a line for each stage of 'job' to 'out' */
+void esh_usage_print_stages(FILE *out, struct esh_pipeline *job);
+
+/* Print the report of 'time' for 'job', which is over */
+void esh_usage_report(FILE *out, struct esh_pipeline *job);
+
+/* Register the 'time' builtin */
+void esh_usage_register(void);
+
+#endif //__ESH_UTILS_USAGE_H
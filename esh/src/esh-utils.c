@@ -6,53 +6,66 @@
  * Virginia Tech.
  */
 #include <stdio.h>
+#include <string.h>
 #include <sys/types.h>
-#include <dirent.h>
-#include <dlfcn.h>
 #include <limits.h>
 
 #include "esh.h"
+#include "arena.h"
 
-#ifdef __clang__
-#pragma clang diagnostic push
-#pragma clang diagnostic ignored "-Wunused-const-variable"
+#ifdef __GNUC__
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-const-variable"
 #endif
 static const char rcsid [] = "$Id: esh-utils.c,v 1.5 2011/03/29 15:46:28 cs3214 Exp $";
-#ifdef __clang__
-#pragma clang diagnostic pop
+#ifdef __GNUC__
+#pragma GCC diagnostic pop
 #endif
 
 /* List of loaded plugins */
 struct list esh_plugin_list;
 
+/* Job control state shared by the shell and its plugins */
+struct list jobs_list;
+int job_id;
+struct termios * terminal;
+pid_t shell_pid;
+bool esh_interactive;
+int esh_last_status;
+
 
 /* Create new command structure and initialize first command word,
  * and/or input or output redirect file. */
 struct esh_command * 
-esh_command_create(char ** argv, 
+esh_command_create(struct arena *arena,
+                   char ** argv, 
                    char *iored_input, 
                    char *iored_output, 
                    bool append_to_output)
 {
-    struct esh_command *cmd = malloc(sizeof *cmd);
+    struct esh_command *cmd = arena_alloc(arena, sizeof *cmd);
 
     cmd->iored_input = iored_input;
     cmd->iored_output = iored_output;
     cmd->argv = argv;
     cmd->append_to_output = append_to_output;
+    cmd->path = NULL;
 
     return cmd;
 }
 
 /* Create a new pipeline containing only one command */
 struct esh_pipeline *
-esh_pipeline_create(struct esh_command *cmd)
+esh_pipeline_create(struct arena *arena, struct esh_command *cmd)
 {
-    struct esh_pipeline *pipe = malloc(sizeof *pipe);
+    struct esh_pipeline *pipe = arena_alloc(arena, sizeof *pipe);
 
     pipe -> bg_job = false;
+    pipe -> timed = false;
+    pipe -> arena = NULL;
     cmd -> pipeline = pipe;
     list_init(&pipe->commands);
+    list_init(&pipe->done);
     list_push_back(&pipe->commands, &cmd->elem);
     
     return pipe;
@@ -62,7 +75,7 @@ esh_pipeline_create(struct esh_command *cmd)
 void
 esh_pipeline_finish(struct esh_pipeline *pipe)
 {
-    if (list_size(&pipe->commands) == 0)
+    if (list_empty(&pipe->commands))
         return;
 
     struct esh_command *first;
@@ -75,21 +88,141 @@ esh_pipeline_finish(struct esh_pipeline *pipe)
     pipe->append_to_output = last->append_to_output;
 }
 
+/* Copy a string into 'arena', preserving NULL */
+static char *
+copy_string(struct arena *arena, const char *s)
+{
+    return s ? arena_strdup(arena, s) : NULL;
+}
+
+/* Arena space taken by 'str', see copy_string */
+static size_t
+string_copy_size(const char *str)
+{
+    return str ? arena_alloc_size(strlen(str) + 1) : 0;
+}
+
+/* Length of the title of 'pipe': its words, with " | " between commands */
+static size_t
+title_length(struct esh_pipeline *pipe)
+{
+    size_t len = 0;
+    struct list_elem * e = list_begin (&pipe->commands);
+    for (; e != list_end (&pipe->commands); e = list_next (e)) {
+        struct esh_command *cmd = list_entry(e, struct esh_command, elem);
+        char **w;
+        for (w = cmd->argv; *w; w++)
+            len += strlen(*w) + 1;
+        len += 2;               /* "| " */
+    }
+    return len;
+}
+
+/* Write the title of 'pipe' into 'buf' */
+static void
+title_write(struct esh_pipeline *pipe, char *buf)
+{
+    char *p = buf;
+    struct list_elem * e = list_begin (&pipe->commands);
+    for (; e != list_end (&pipe->commands); e = list_next (e)) {
+        struct esh_command *cmd = list_entry(e, struct esh_command, elem);
+        char **w;
+        if (p != buf)
+            p = stpcpy(p, "| ");
+        for (w = cmd->argv; *w; w++) {
+            p = stpcpy(p, *w);
+            *p++ = ' ';
+        }
+    }
+    if (p != buf)
+        p--;                    /* trailing blank */
+    *p = '\0';
+}
+
+/* Arena space a copy of 'pipe' made by esh_pipeline_copy takes */
+static size_t
+pipeline_copy_size(struct esh_pipeline *pipe)
+{
+    size_t size = arena_alloc_size(sizeof (struct esh_pipeline));
+
+    struct list_elem * e = list_begin (&pipe->commands);
+    for (; e != list_end (&pipe->commands); e = list_next (e)) {
+        struct esh_command *cmd = list_entry(e, struct esh_command, elem);
+
+        int argc = 0;
+        while (cmd->argv[argc])
+            size += string_copy_size(cmd->argv[argc++]);
+
+        size += arena_alloc_size((argc + 1) * sizeof (char *))
+              + arena_alloc_size(sizeof (struct esh_command))
+              + string_copy_size(cmd->iored_input)
+              + string_copy_size(cmd->iored_output)
+              + string_copy_size(cmd->path);
+    }
+    return size + arena_alloc_size(title_length(pipe) + 1);
+}
+
+/* Copy a pipeline into a new job-lifetime arena */
+struct esh_pipeline *
+esh_pipeline_copy(struct esh_pipeline *pipe)
+{
+    // Size the arena to fit: a session may hold thousands of jobs
+    struct arena *arena = arena_create_sized(pipeline_copy_size(pipe));
+    struct esh_pipeline *copy = arena_alloc(arena, sizeof *copy);
+
+    *copy = *pipe;
+    copy->arena = arena;
+    copy->title = arena_alloc(arena, title_length(pipe) + 1);
+    title_write(pipe, copy->title);
+    list_init(&copy->commands);
+    list_init(&copy->done);
+    memset(&copy->usage, 0, sizeof copy->usage);
+
+    int stage = 0;
+    struct list_elem * e = list_begin (&pipe->commands);
+    for (; e != list_end (&pipe->commands); e = list_next (e)) {
+        struct esh_command *cmd = list_entry(e, struct esh_command, elem);
+
+        int argc = 0;
+        while (cmd->argv[argc])
+            argc++;
+
+        char **argv = arena_alloc(arena, (argc + 1) * sizeof *argv);
+        int i;
+        for (i = 0; i < argc; i++)
+            argv[i] = arena_strdup(arena, cmd->argv[i]);
+        argv[argc] = NULL;
+
+        struct esh_command *ccmd = esh_command_create(arena, argv,
+                                        copy_string(arena, cmd->iored_input),
+                                        copy_string(arena, cmd->iored_output),
+                                        cmd->append_to_output);
+        ccmd->pid = cmd->pid;
+        ccmd->stage = stage++;
+        ccmd->path = copy_string(arena, cmd->path);
+        ccmd->pipeline = copy;
+        list_push_back(&copy->commands, &ccmd->elem);
+    }
+    esh_pipeline_finish(copy);
+    return copy;
+}
+
 /* Create an empty command line */
 struct esh_command_line *
-esh_command_line_create_empty(void)
+esh_command_line_create_empty(struct arena *arena)
 {
-    struct esh_command_line *cmdline = malloc(sizeof *cmdline);
+    struct esh_command_line *cmdline = arena_alloc(arena, sizeof *cmdline);
 
     list_init(&cmdline->pipes);
+    cmdline->arena = arena;
     return cmdline;
 }
 
 /* Create a command line with a single pipeline */
 struct esh_command_line *
-esh_command_line_create(struct esh_pipeline *pipe)
+esh_command_line_create(struct arena *arena, struct esh_pipeline *pipe)
 {
-    struct esh_command_line *cmdline = esh_command_line_create_empty();
+    struct esh_command_line *cmdline = esh_command_line_create_empty(arena);
 
     list_push_back(&cmdline->pipes, &pipe->elem);
     return cmdline;
@@ -155,117 +288,13 @@ esh_command_line_print(struct esh_command_line *cmdline)
 void 
 esh_command_line_free(struct esh_command_line *cmdline)
 {
-    struct list_elem * e = list_begin (&cmdline->pipes); 
-
-    for (; e != list_end (&cmdline->pipes); ) {
-        struct esh_pipeline *pipe = list_entry(e, struct esh_pipeline, elem);
-        e = list_remove(e);
-        esh_pipeline_free(pipe);
-    }
-    free(cmdline);
+    /* The command line itself lives in its arena */
+    arena_destroy(cmdline->arena);
 }
 
 void 
 esh_pipeline_free(struct esh_pipeline *pipe)
 {
-    struct list_elem * e = list_begin (&pipe->commands); 
-
-    for (; e != list_end (&pipe->commands); ) {
-        struct esh_command *cmd = list_entry(e, struct esh_command, elem);
-        e = list_remove(e);
-        esh_command_free(cmd);
-    }
-    free(pipe);
-}
-
-void 
-esh_command_free(struct esh_command * cmd)
-{
-    char ** p = cmd->argv;
-    while (*p) {
-        free(*p++);
-    }
-    if (cmd->iored_input)
-        free(cmd->iored_input);
-    if (cmd->iored_output)
-        free(cmd->iored_output);
-    free(cmd->argv);
-    free(cmd);
-}
-
-#define PSH_MODULE_NAME "esh_module"
-
-/* Load a plugin referred to by modname */
-static struct esh_plugin *
-load_plugin(char *modname)
-{
-    printf("Loading %s ...", modname);
-    fflush(stdout);
-
-    void *handle = dlopen(modname, RTLD_LAZY);
-    if (handle == NULL) {
-        fprintf(stderr, "Could not open %s: %s\n", modname, dlerror());
-        return NULL;
-    }
-
-    struct esh_plugin * p = dlsym(handle, PSH_MODULE_NAME);
-    if (p == NULL) {
-        fprintf(stderr, "%s does not define %s\n", modname, PSH_MODULE_NAME);
-        dlclose(handle);
-        return NULL;
-    }
-
-    printf("done.\n");
-    return p;
+    if (pipe->arena)
+        arena_destroy(pipe->arena);
 }
-
-static bool sort_by_rank (const struct list_elem *a,
-                          const struct list_elem *b,
-                          void *aux __attribute__((unused)))
-{
-    struct esh_plugin * pa =  list_entry(a, struct esh_plugin, elem);
-    struct esh_plugin * pb =  list_entry(b, struct esh_plugin, elem);
-    return pa->rank < pb->rank;
-}
-
-/* Load plugins from directory dirname */
-void 
-esh_plugin_load_from_directory(char *dirname)
-{
-    DIR * dir = opendir(dirname);
-    if (dir == NULL) {
-        perror("opendir");
-        return;
-    }
-
-    struct dirent * dentry;
-    while ((dentry = readdir(dir)) != NULL) {
-        if (!strstr(dentry->d_name, ".so"))
-            continue;
-
-        char modname[PATH_MAX + 1];
-        snprintf(modname, sizeof modname, "%s/%s", dirname, dentry->d_name);
-
-        struct esh_plugin * plugin = load_plugin(modname);
-        if (plugin)
-            list_push_back(&esh_plugin_list, &plugin->elem);
-    }
-    closedir(dir);
-}
-
-/* Initialize loaded plugins */
-void 
-esh_plugin_initialize(struct esh_shell *shell)
-{
-    /* Sort plugins and call init() method. */
-    list_sort(&esh_plugin_list, sort_by_rank, NULL);
-
-    struct list_elem * e = list_begin(&esh_plugin_list);
-    for (; e != list_end(&esh_plugin_list); e = list_next(e)) {
-        struct esh_plugin *plugin = list_entry(e, struct esh_plugin, elem);
-        if (plugin->init)
-            plugin->init(shell);
-    }
-}
-
-/* TBD: implement unloading. */
@@ -10,56 +10,167 @@
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <sys/epoll.h>
+#include <errno.h>
 #include "esh.h"
 #include "esh-utils-helper.h"
+#include "esh-utils-jobs.h"
 #include "esh-sys-utils.h"
+#include "esh-utils-spawn.h"
+#include "esh-parse-cache.h"
+#include "esh-script.h"
+#include "esh-utils-plugin.h"
+#include "esh-utils-prompt.h"
+#include "esh-utils-history.h"
+#include "esh-utils-complete.h"
+#include "esh-utils-slots.h"
+#include "esh-utils-stats.h"
 
 //#define DEBUG 1
 #define PLUG_IN 0
 static void
 usage(char *progname)
 {
-    printf("Usage: %s -h\n"
+    printf("Usage: %s [-h] [-p plugindir] [-l launcher] [-c cmdline | script]\n"
         " -h            print this help\n"
-        " -p  plugindir directory from which to load plug-ins\n",
+        " -c  cmdline   run 'cmdline', then exit with its status\n"
+        " -p  plugindir directory from which to load plug-ins\n"
+        " -l  launcher  how to start commands: 'fork' (default) or 'spawn'\n"
+        "               (also settable through ESH_LAUNCH)\n"
+        " script        run the commands in file 'script', then exit\n"
+        "Without -c or a script, commands are read from standard input;\n"
+        "job control and prompts are only used if it is a terminal.\n"
+        "Environment:\n"
+        " ESH_PARSE_CACHE=n  number of parsed lines to memoize (0 disables)\n"
+        " ESH_HISTFILE=file  command history (default ~/.esh_history, empty for none)\n",
         progname);
 
     exit(EXIT_SUCCESS);
 }
 
-/* Build a prompt by assembling fragments from loaded plugins that 
- * implement 'make_prompt.'
- *
- * This function demonstrates how to iterate over all loaded plugins.
- */
+/* --- Event loop --- */
+
+/* Descriptors the interactive shell waits on between commands */
+static int event_fd = -1;
+static int sigchld_fd = -1;
+
+/* When the last command line was done, for the 'prompt' phase */
+static uint64_t line_done;
+
+static char * event_line;
+static bool event_line_done;
+
+static void
+event_line_handler(char *line)
+{
+    event_line = line;
+    event_line_done = true;
+    rl_callback_handler_remove();
+}
+
+/* Show the prompt again if a plugin's fragment of it came late */
+static void
+redraw_prompt(void)
+{
+    char *prompt = esh_prompt_refresh();
+    if (prompt == NULL)
+        return;
+    if (!event_line_done) {
+        rl_set_prompt(prompt);
+        rl_forced_update_display();
+    }
+    free(prompt);
+}
+
+/* Apply changes to the plugin directories, reported by inotify.  The
+ * line being typed stays; the prompt is built again, since the
+ * plugins making it may have changed. */
+static void
+reload_plugins(void)
+{
+    if (!esh_plugin_watch_event())
+        return;
+
+    char *report = NULL;
+    size_t size = 0;
+    FILE *f = open_memstream(&report, &size);
+    int changes = esh_plugin_reload(NULL, f);
+    fclose(f);
+
+    if (changes && !event_line_done) {
+        printf("\n%s", report);
+        char *prompt = esh_prompt_build();
+        rl_set_prompt(prompt);
+        rl_on_new_line();
+        rl_forced_update_display();
+        free(prompt);
+    }
+    free(report);
+}
+
+/* Read a line with readline's callback interface.  While the user
+ * types, children that change status are reaped as SIGCHLD arrives
+ * on 'sigchld_fd', so the shell never does that work in a signal
+ * handler.  Notices about background jobs are printed with the
+ * prompt, all at once. */
 static char *
-build_prompt_from_plugins(void)
+readline_events(const char *prompt)
 {
-    char *prompt = NULL;
-    struct list_elem * e = list_begin(&esh_plugin_list);
-
-    for (; e != list_end(&esh_plugin_list); e = list_next(e)) {
-        struct esh_plugin *plugin = list_entry(e, struct esh_plugin, elem);
-
-        if (plugin->make_prompt == NULL)
-            continue;
-
-        /* append prompt fragment created by plug-in */
-        char * p = plugin->make_prompt();
-        if (prompt == NULL) {
-            prompt = p;
-        } else {
-            prompt = realloc(prompt, strlen(prompt) + strlen(p) + 1);
-            strcat(prompt, p);
-            free(p);
-        }
+    if (event_fd == -1) {
+        event_fd = epoll_create1(EPOLL_CLOEXEC);
+        if (event_fd < 0)
+            esh_sys_fatal_error("epoll_create1: ");
+
+        struct epoll_event ev = { .events = EPOLLIN, .data.fd = STDIN_FILENO };
+        epoll_ctl(event_fd, EPOLL_CTL_ADD, STDIN_FILENO, &ev);
+        ev.data.fd = sigchld_fd;
+        epoll_ctl(event_fd, EPOLL_CTL_ADD, sigchld_fd, &ev);
+        ev.data.fd = esh_prompt_fd();
+        epoll_ctl(event_fd, EPOLL_CTL_ADD, ev.data.fd, &ev);
+        ev.data.fd = esh_plugin_watch();
+        if (ev.data.fd != -1)
+            epoll_ctl(event_fd, EPOLL_CTL_ADD, ev.data.fd, &ev);
+
+        esh_history_bind();             // the history itself is read when first used
+        esh_complete_bind();            // and PATH when first completed from
     }
 
-    /* default prompt */
-    if (prompt == NULL)
-        prompt = strdup("esh> ");
+    esh_reap_children();
+    esh_job_notifications_flush();
+
+    event_line = NULL;
+    event_line_done = false;
+    rl_callback_handler_install(prompt, event_line_handler);
+    if (line_done) {
+        esh_stats_record(ESH_STATS_PROMPT, line_done);
+        line_done = 0;
+    }
+
+    while (!event_line_done) {
+        struct epoll_event ev[4];
+        int n = epoll_wait(event_fd, ev, 4, esh_slots_retry_ms());
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            esh_sys_fatal_error("epoll_wait: ");
+        }
+        if (n == 0)                     // pressure may have eased
+            esh_start_queued_jobs();
 
-    return prompt;
+        for (int i = 0; i < n; i++) {
+            if (ev[i].data.fd == sigchld_fd)
+                esh_reap_children();
+            else if (ev[i].data.fd == esh_prompt_fd())
+                redraw_prompt();
+            else if (ev[i].data.fd == esh_plugin_watch())
+                reload_plugins();
+            else if (!event_line_done)
+                rl_callback_read_char();
+        }
+    }
+    if (event_line)
+        esh_history_add(event_line);
+    return event_line;
 }
 
 /* The shell object plugins use.
@@ -67,12 +178,82 @@ build_prompt_from_plugins(void)
  */
 struct esh_shell shell =
 {
-    .build_prompt = build_prompt_from_plugins,
-    .readline = readline,                        /* GNU readline(3) */ 
-    .parse_command_line = esh_parse_command_line /* Default parser */
-    
+    .get_jobs = esh_get_jobs,
+    .get_job_from_jid = find_job,
+    .get_job_from_pgid = find_job_by_pgid,
+    .get_cmd_from_pid = find_command,
+    .build_prompt = esh_prompt_build,            /* plugins' fragments, see esh-utils-prompt.h */
+    .readline = readline_events,                 /* GNU readline(3), callback mode */
+    .parse_command_line = esh_parse_command_line_cached /* Default parser,
+                                                            memoized */
 };
 
+/* Give plugins that implement 'process_raw_cmdline' a chance to
+ * inspect or rewrite the command line.
+ * Returns true if a plugin asked for processing to stop.
+ * If the line was changed, *rewritten is set to the new, malloc'd
+ * line; otherwise it is set to NULL. */
+static bool
+process_raw_cmdline_from_plugins(const char *cmdline, char **rewritten)
+{
+    char *work = NULL;
+    struct esh_plugin ** plugins = esh_plugin_hook_list(ESH_HOOK_RAW_CMDLINE);
+
+    *rewritten = NULL;
+    for (; *plugins; plugins++) {
+        struct esh_plugin *plugin = *plugins;
+
+        /* plugins may rewrite or free the line they are handed,
+         * so they work on a malloc'd copy */
+        if (work == NULL)
+            work = strdup(cmdline);
+
+        if (plugin->process_raw_cmdline(&work)) {
+            free(work);
+            return true;
+        }
+    }
+
+    if (work && strcmp(work, cmdline) != 0)
+        *rewritten = work;
+    else
+        free(work);
+    return false;
+}
+
+/* Parse and execute one command line.
+ * 'cmdline' remains owned by the caller. */
+static void
+eval_command_line(char *cmdline)
+{
+    char * rewritten;
+    if (process_raw_cmdline_from_plugins(cmdline, &rewritten))
+        return;
+    
+    // A rewritten line bypasses the parse cache, the cache must
+    // only ever map what the user typed to its parse
+    struct esh_command_line * cline;
+    uint64_t start = esh_stats_now();
+    if (rewritten && shell.parse_command_line == esh_parse_command_line_cached)
+        cline = esh_parse_command_line(rewritten);
+    else
+        cline = shell.parse_command_line(rewritten ? rewritten : cmdline);  // cmdline parsed into cline
+    esh_stats_record(ESH_STATS_PARSE, start);
+    
+    free (rewritten);
+    if (cline == NULL) {                /* Error in command line */
+        esh_last_status = 2;
+        return;
+    }
+
+    if (list_empty(&cline->pipes)) {    /* User hit enter */
+        esh_command_line_free(cline);                                       
+        return;
+    }
+    esh_command_line_helper(cline);
+    esh_command_line_free(cline);
+}
+
 /**
  * Assign ownership of the terminal to process group
  * pgid, restoring its terminal state if provided.
@@ -89,6 +270,9 @@ give_terminal_to(pid_t pgid, struct termios *pg_tty_state)
     #ifdef DEBUG
         printf("\nIn give_terminal_to\n");
     #endif
+    if (!esh_interactive)
+        return;
+
     esh_signal_block(SIGTTOU);
     int rc = tcsetpgrp(esh_sys_tty_getfd(), pgid);
     if (rc == -1)
@@ -107,13 +291,34 @@ main(int ac, char *av[])
 {
     int opt;
     list_init(&esh_plugin_list);
+    esh_register_builtins();                // before plugins, which may override them
     
     // Job List
     job_id = 0;
     list_init(&jobs_list);
+    sigchld_fd = esh_sigchld_init();
     
+    char * cache_size = getenv("ESH_PARSE_CACHE");
+    if (cache_size)
+        esh_parse_cache_set_capacity(atoi(cache_size));
+
+    char * launcher = getenv("ESH_LAUNCH");
+    if (launcher && !esh_launch_mode_set(launcher))
+        fprintf(stderr, "esh: unknown launcher '%s' in ESH_LAUNCH\n", launcher);
+
+    char * budget = getenv("ESH_PROMPT_BUDGET");
+    if (budget)
+        esh_prompt_set_budget(atoi(budget));
+
+    esh_history_set_file(getenv("ESH_HISTFILE"));
+
+    char * slots = getenv("ESH_JOB_SLOTS");
+    if (slots && !esh_slots_configure(slots))
+        fprintf(stderr, "esh: bad job slots '%s' in ESH_JOB_SLOTS\n", slots);
+
     /* Process command-line arguments. See getopt(3) */
-    while ((opt = getopt(ac, av, "hp:")) > 0) {
+    char * command_string = NULL;
+    while ((opt = getopt(ac, av, "hp:l:c:")) > 0) {
         switch (opt) {
         case 'h':
             usage(av[0]);
@@ -122,40 +327,70 @@ main(int ac, char *av[])
         case 'p':
             esh_plugin_load_from_directory(optarg);
             break;
+
+        case 'l':
+            if (!esh_launch_mode_set(optarg))
+                usage(av[0]);
+            break;
+
+        case 'c':
+            command_string = optarg;
+            break;
         }
     }
+    char * script = optind < ac ? av[optind] : NULL;
     
     #ifdef PLUG_IN
         esh_plugin_load_from_directory("plugins/");
     #endif
     esh_plugin_initialize(&shell);
-    setpgrp();                              // set current pid to pgid
     shell_pid = getpid();                    
-    terminal = esh_sys_tty_init();
-    give_terminal_to(shell_pid, terminal);
+    
+    /* Job control only when reading commands from our terminal.
+     * Otherwise the terminal, if there is one, is left alone. */
+    if (!command_string && !script && isatty(0))
+        terminal = esh_sys_tty_try_init();
+    esh_interactive = terminal != NULL;
+    
+    if (esh_interactive) {
+        setpgrp();                          // set current pid to pgid
+        give_terminal_to(shell_pid, terminal);
+    }
+    
+    /* -c mode: evaluate the argument's lines */
+    if (command_string) {
+        esh_script_run_string(command_string, eval_command_line);
+        esh_wait_queued_jobs();
+        return esh_last_status;
+    }
+    
+    /* Script mode: evaluate the file's lines, no readline, no prompts */
+    if (script) {
+        if (!esh_script_run_file(script, eval_command_line))
+            esh_sys_fatal_error("esh: %s: ", script);
+        esh_wait_queued_jobs();
+        return esh_last_status;
+    }
+    
+    /* Standard input is not a terminal: read it like a script */
+    if (!esh_interactive) {
+        esh_script_run_fd(0, eval_command_line);
+        esh_wait_queued_jobs();
+        return esh_last_status;
+    }
     
     /* Read/eval loop. */
     for (;;) {
-        /* Do not output a prompt unless shell's stdin is a terminal */
-        char * prompt = isatty(0) ? shell.build_prompt() : NULL; 	// Name of the shell i.e: esh>
+        char * prompt = shell.build_prompt(); 	                    // Name of the shell i.e: esh>
         char * cmdline = shell.readline(prompt);			        // cmdline: Commands i.e: ls
                                                                     // Reads the command here
         free (prompt);
         if (cmdline == NULL)  /* User typed EOF */
             break;
     
-        struct esh_command_line * cline = shell.parse_command_line(cmdline);    // cmdline parsed into cline
-        
+        eval_command_line(cmdline);
         free (cmdline);
-        if (cline == NULL)                  /* Error in command line */
-            continue;
-
-        if (list_empty(&cline->pipes)) {    /* User hit enter */
-            esh_command_line_free(cline);                                       
-            continue;
-        }
-        esh_command_line_helper(cline);
-        esh_command_line_free(cline);
+        line_done = esh_stats_now();
     }
-    return 0;
+    return esh_last_status;
 }
@@ -13,12 +13,16 @@
 #include <obstack.h>
 #include <stdlib.h>
 #include <termios.h>
+#include <time.h>
+#include <sys/resource.h>
 #include "list.h"
+#include "hash.h"
 
 /* Forward declarations. */
 struct esh_command;
 struct esh_pipeline;
 struct esh_command_line;
+struct arena;
 
 /*
  * A esh_shell object allows plugins to access services and information. 
@@ -83,7 +87,8 @@ struct esh_plugin {
     bool (* process_builtin)(struct esh_command *);
 
     /* Manufacture part of a prompt.  Memory must be allocated via malloc(). 
-     * If no plugin implements this, the shell will provide a default prompt. */
+     * If no plugin implements this, the shell will provide a default prompt.
+     * Called on the main thread, unless prompt_threaded is set. */
     char * (* make_prompt)(void);
 
     /* The process or processes that are part of a new pipeline
@@ -97,18 +102,49 @@ struct esh_plugin {
     /* Notify the plugin about a child's status change.
      * 'waitstatus' is the value returned by waitpid(2) 
      *
-     * May be called from SIGCHLD handler.
-     * The status of the associated pipeline has not yet been
-     * updated.
+     * Called from the shell's event loop, never from a signal
+     * handler.  The status of the associated pipeline has not yet
+     * been updated.
      * */
     bool (* command_status_change)(struct esh_command *, int waitstatus);
 
+    /* NULL-terminated names of the commands process_builtin handles.
+     * They let the shell find the plugin without loading it, see
+     * esh-utils-plugin.h.  If NULL, the plugin is loaded and asked
+     * about every command. */
+    const char **builtin_names;
+
+    /* NULL-terminated names of the stream filters run_filter
+     * implements.  A filter can be a stage of a pipeline, as in
+     * 'cat log | fields 2 | sort'. */
+    const char **filter_names;
+
+    /* Run filter argv[0]: read 'in_fd' until EOF or until done, write
+     * to 'out_fd', and return the exit status of the stage.
+     * Runs on a thread of the shell rather than in a process of its
+     * own, concurrently with the shell and with other filters, so it
+     * must not use shell state or stdio's stdin/stdout.  The shell
+     * closes both descriptors when it returns. */
+    int (* run_filter)(int in_fd, int out_fd, char **argv);
+
+    /* Call make_prompt on a worker thread of its own rather than on the
+     * main thread.  It then must not touch the shell's job list; if it
+     * takes longer than its budget, its previous fragment stays on
+     * screen until it returns (see esh-utils-prompt.h). */
+    bool prompt_threaded;
+
+    /* The budget of a threaded make_prompt, in ms; 0 for the shell's
+     * (ESH_PROMPT_BUDGET) */
+    int prompt_budget_ms;
+
     /* Add additional fields here if needed. */
 };
 
 /* A command line may contain multiple pipelines. */
 struct esh_command_line {
     struct list/* <esh_pipeline> */ pipes;        /* List of pipelines */
+    struct arena *arena;     /* Region holding this command line, its
+                                pipelines, commands and words. */
 
     /* Add additional fields here if needed. */
 };
@@ -121,7 +157,9 @@ enum job_status  {
     NEEDSTERMINAL,  /* job is stopped because it was a background job
                        and requires exclusive terminal access */
     TERMINATED,     /* job is terminated via SIGTERM */
-    DONE            /* job is exited successfully */
+    DONE,           /* job is exited successfully */
+    QUEUED          /* background job waiting for a job slot, see
+                       esh-utils-slots.h.  It has no processes yet. */
 };
 
 /* A pipeline is a list of one or more commands. 
@@ -143,6 +181,23 @@ struct esh_pipeline {
     struct termios saved_tty_state;  /* The state of the terminal when this job was 
                                         stopped after having been in foreground */
     bool is_piped;
+    struct arena *arena;     /* Job-lifetime region holding this pipeline
+                                and its commands, or NULL while the
+                                pipeline is part of a command line. */
+    pid_t   last_pid;        /* Process id of the last stage, whose status
+                                is the pipeline's exit status. */
+    int     exit_status;     /* Exit status as reported by $? in sh(1):
+                                the exit code, or 128 + signal number. */
+    struct hash_elem jid_elem;      /* Link elements for the job table's */
+    struct hash_elem pgid_elem;     /* indexes, see esh-utils-jobs.h */
+    char   *title;           /* The job's commands as 'jobs' shows them, for
+                                notifications.  Set by esh_pipeline_copy. */
+    struct list/* <esh_command> */ done;    /* Commands whose process is
+                                gone, in pipeline order */
+    struct rusage usage;     /* Resources used by the commands in 'done' */
+    struct timespec started; /* When the job was launched, CLOCK_MONOTONIC */
+    bool    timed;           /* Report 'usage' when the job is over, see
+                                the 'time' builtin */
     /* Add additional fields here if needed. */
 };
 
@@ -159,35 +214,53 @@ struct esh_command {
 
     pid_t   pid;             /* Process id. */
     struct esh_pipeline * pipeline;     /* The pipeline of which this job is a part. */                      
+    char *path;              /* Program to execute, resolved from argv[0]
+                                through the PATH cache before launch. */
+    struct hash_elem pid_elem;      /* Link element for the pid index */
+    int     stage;           /* Position in the pipeline, from 0.  Set by
+                                esh_pipeline_copy. */
+    struct rusage usage;     /* Resources used by the process, as reported
+                                by wait4(2) once it is gone */
+    struct timespec ended;   /* When it was reaped, CLOCK_MONOTONIC */
     
     /* Add additional fields here if needed. */
 };
 
 /** ----------------------------------------------------------- */
 
+/* The objects below are allocated from an arena (see arena.h)
+ * and are never freed individually. */
+
 /* Create new command structure and initialize it */
-struct esh_command * esh_command_create(char ** argv, 
+struct esh_command * esh_command_create(struct arena *arena,
+                   char ** argv, 
                    char *iored_input, 
                    char *iored_output, 
                    bool append_to_output);
 
 /* Create a new pipeline containing only one command */
-struct esh_pipeline * esh_pipeline_create(struct esh_command *cmd);
+struct esh_pipeline * esh_pipeline_create(struct arena *arena, struct esh_command *cmd);
 
 /* Complete a pipe's setup by copying I/O redirection information
  * from first and last command */
 void esh_pipeline_finish(struct esh_pipeline *pipe);
 
+/* Copy a pipeline into a new job-lifetime arena, so that it can
+ * outlive the command line it is part of. */
+struct esh_pipeline * esh_pipeline_copy(struct esh_pipeline *pipe);
+
 /* Create an empty command line */
-struct esh_command_line * esh_command_line_create_empty(void);
+struct esh_command_line * esh_command_line_create_empty(struct arena *arena);
 
 /* Create a command line with a single pipeline */
-struct esh_command_line * esh_command_line_create(struct esh_pipeline *pipe);
+struct esh_command_line * esh_command_line_create(struct arena *arena, struct esh_pipeline *pipe);
 
-/* Deallocation functions */
+/* Deallocation functions.
+ * esh_command_line_free releases the command line's arena.
+ * esh_pipeline_free releases a pipeline created by esh_pipeline_copy;
+ * pipelines that are part of a command line go with the command line. */
 void esh_command_line_free(struct esh_command_line *);
 void esh_pipeline_free(struct esh_pipeline *);
-void esh_command_free(struct esh_command *);
 
 /* Print functions */
 void esh_command_print(struct esh_command *cmd);
@@ -197,6 +270,10 @@ void esh_command_line_print(struct esh_command_line *line);
 /* Parse a command line.  Implemented in esh-grammar.y */
 struct esh_command_line * esh_parse_command_line(char * line);
 
+/* Parse a command line into an arena whose first chunk holds 'size'
+ * bytes; see arena_allocated().  Implemented in esh-grammar.y */
+struct esh_command_line * esh_parse_command_line_sized(char * line, size_t size);
+
 /* Load plugins from directory dir */
 void esh_plugin_load_from_directory(char *dirname);
 
@@ -207,12 +284,22 @@ void esh_plugin_initialize(struct esh_shell *shell);
 extern struct list esh_plugin_list;
 
 /* List of jobs */
-struct list jobs_list;
+extern struct list jobs_list;
+
+/* Most recently assigned job id */
+extern int job_id;
+
+/* Terminal state of the shell, see esh_sys_tty_init() */
+extern struct termios * terminal;
 
-int job_id;
+extern pid_t shell_pid;
 
-struct termios * terminal;
+/* True if the shell reads commands from its controlling terminal and
+ * does job control.  Otherwise (-c, scripts, stdin not a tty) it never
+ * touches the terminal and its children stay in its process group. */
+extern bool esh_interactive;
 
-pid_t shell_pid;
+/* Exit status of the most recent foreground pipeline or builtin */
+extern int esh_last_status;
 
 #endif //__ESH_H
@@ -0,0 +1,148 @@
+/*
+ * An example plug-in with two stream filters, which run inside the
+ * shell when they are part of a pipeline:
+ *
+ *      fields N [M ...]    print fields N, M, ... (counted from 1, split
+ *                          at blanks) of each line, separated by blanks
+ *      tag TEXT            print each line prefixed with TEXT and a blank
+ */
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "../esh.h"
+
+#define BUFSIZE 65536
+
+/* Output buffer of a filter */
+struct out {
+    int fd;
+    size_t len;
+    bool failed;
+    char buf[BUFSIZE];
+};
+
+static void
+out_flush(struct out *o)
+{
+    size_t done = 0;
+    while (!o->failed && done < o->len) {
+        ssize_t n = write(o->fd, o->buf + done, o->len - done);
+        if (n < 0)
+            o->failed = true;       /* e.g. EPIPE, the reader is gone */
+        else
+            done += n;
+    }
+    o->len = 0;
+}
+
+static void
+out_put(struct out *o, const char *s, size_t len)
+{
+    while (len > 0) {
+        if (o->len == BUFSIZE)
+            out_flush(o);
+        size_t n = BUFSIZE - o->len < len ? BUFSIZE - o->len : len;
+        memcpy(o->buf + o->len, s, n);
+        o->len += n;
+        s += n;
+        len -= n;
+    }
+}
+
+/* Call 'line' for each line read from 'in_fd'.  A last line without a
+ * newline is passed with one. */
+static int
+for_each_line(int in_fd, struct out *o, char **argv,
+              void (*line)(struct out *, char *, size_t, char **))
+{
+    char *buf = malloc(BUFSIZE + 1);
+    size_t size = BUFSIZE, have = 0;
+    ssize_t n = 0;
+
+    while (!o->failed && (n = read(in_fd, buf + have, size - have)) > 0) {
+        have += n;
+        char *start = buf, *nl;
+        while ((nl = memchr(start, '\n', buf + have - start)) != NULL) {
+            line(o, start, nl - start + 1, argv);
+            start = nl + 1;
+        }
+        have = buf + have - start;
+        memmove(buf, start, have);
+        if (have == size) {          /* a very long line */
+            size *= 2;
+            buf = realloc(buf, size + 1);
+        }
+    }
+    if (have > 0 && !o->failed) {
+        buf[have++] = '\n';
+        line(o, buf, have, argv);
+    }
+    free(buf);
+    out_flush(o);
+    return o->failed || n < 0;
+}
+
+static void
+fields_line(struct out *o, char *s, size_t len, char **argv)
+{
+    const char *start[64];
+    size_t flen[64];
+    int nf = 0;
+    size_t i = 0;
+
+    while (nf < 64) {
+        while (i < len && (s[i] == ' ' || s[i] == '\t' || s[i] == '\n'))
+            i++;
+        if (i == len)
+            break;
+        start[nf] = s + i;
+        while (i < len && s[i] != ' ' && s[i] != '\t' && s[i] != '\n')
+            i++;
+        flen[nf] = s + i - start[nf];
+        nf++;
+    }
+
+    char **a;
+    for (a = argv + 1; *a; a++) {
+        int f = atoi(*a);
+        if (a != argv + 1)
+            out_put(o, " ", 1);
+        if (f >= 1 && f <= nf)
+            out_put(o, start[f - 1], flen[f - 1]);
+    }
+    out_put(o, "\n", 1);
+}
+
+static void
+tag_line(struct out *o, char *s, size_t len, char **argv)
+{
+    out_put(o, argv[1], strlen(argv[1]));
+    out_put(o, " ", 1);
+    out_put(o, s, len);
+}
+
+static int
+run_filter(int in_fd, int out_fd, char **argv)
+{
+    if (argv[1] == NULL) {
+        dprintf(2, "usage: %s\n", strcmp(argv[0], "tag") ? "fields N [M ...]" : "tag TEXT");
+        return 2;
+    }
+
+    struct out *o = malloc(sizeof *o);
+    o->fd = out_fd;
+    o->len = 0;
+    o->failed = false;
+    int rc = for_each_line(in_fd, o, argv,
+                           strcmp(argv[0], "tag") ? fields_line : tag_line);
+    free(o);
+    return rc;
+}
+
+struct esh_plugin esh_module = {
+    .rank = 20,
+    .filter_names = (const char *[]) { "fields", "tag", NULL },
+    .run_filter = run_filter
+};